@@ -1,4 +1,5 @@
 #include "ble_client.hpp"
+#include "log.hpp"
 #include <cstdio>
 #include <cstring>
 
@@ -11,16 +12,56 @@ static void static_packet_handler(uint8_t packet_type, uint16_t channel,
   }
 }
 
+// TLV tags for the last connected device per link ('ZPLA', 'ZPLB')
+static const uint32_t TLV_TAG_KNOWN_DEVICE[BLE_MAX_LINKS] = {
+    BTSTACK_TAG32('Z', 'P', 'L', 'A'), BTSTACK_TAG32('Z', 'P', 'L', 'B')};
+
+static void connect_timeout_handler(btstack_timer_source_t *ts) {
+  (void)ts;
+  if (instance) {
+    instance->on_connect_timeout();
+  }
+}
+
+static void stall_timeout_handler(btstack_timer_source_t *ts) {
+  if (instance) {
+    instance->on_stall_timeout(
+        (size_t)(uintptr_t)btstack_run_loop_get_timer_context(ts));
+  }
+}
+
 BLEClient::BLEClient()
-    : connected(false), connection_handle(HCI_CON_HANDLE_INVALID),
-      last_notification_ms(0) {
+    : active_link(BLE_LINK_PRIMARY), outage_start_ms(0),
+      connect_path(ConnectPath::NONE), scan_connect_link(-1),
+      cancel_pending(false), scan_passive(false), passive_missed(false) {
+  memset(links, 0, sizeof(links));
+  for (size_t i = 0; i < BLE_MAX_LINKS; i++) {
+    links[i].target_name =
+        (i == BLE_LINK_PRIMARY) ? &BLE_TARGET_NAME : &BLE_STANDBY_NAME;
+    links[i].tlv_tag = TLV_TAG_KNOWN_DEVICE[i];
+    links[i].enabled = !links[i].target_name->empty();
+    links[i].handle = HCI_CON_HANDLE_INVALID;
+    links[i].discovery_state = DiscoveryState::IDLE;
+    btstack_run_loop_set_timer_handler(&links[i].stall_timer,
+                                       &stall_timeout_handler);
+    btstack_run_loop_set_timer_context(&links[i].stall_timer,
+                                       (void *)(uintptr_t)i);
+  }
+  memset(&failover_stats, 0, sizeof(failover_stats));
+  memset(&direct_stats, 0, sizeof(direct_stats));
+  memset(&scan_stats, 0, sizeof(scan_stats));
+  memset(power_adv_addr, 0, sizeof(power_adv_addr));
+  connect_timer.process = &connect_timeout_handler;
   instance = this;
 }
 
 void BLEClient::set_power_callback(PowerCallback cb) { power_callback = cb; }
 void BLEClient::set_scan_callback(ScanCallback cb) { scan_callback = cb; }
+void BLEClient::set_notification_callback(NotificationCallback cb) {
+  notification_callback = cb;
+}
 
-bool BLEClient::is_connected() { return connected; }
+bool BLEClient::is_connected() { return links[active_link].connected; }
 
 void BLEClient::init() {
   l2cap_init();
@@ -34,122 +75,799 @@ void BLEClient::init() {
   hci_power_control(HCI_POWER_ON);
 }
 
-void BLEClient::packet_handler(uint8_t packet_type, uint16_t channel,
-                               uint8_t *packet, uint16_t size) {
-  if (packet_type != HCI_EVENT_PACKET)
+BLEClient::Link *BLEClient::find_link(hci_con_handle_t handle) {
+  if (handle == HCI_CON_HANDLE_INVALID)
+    return nullptr;
+  for (Link &link : links) {
+    if (link.connected && link.handle == handle)
+      return &link;
+  }
+  return nullptr;
+}
+
+void BLEClient::load_known_device(Link &link) {
+  const btstack_tlv_t *tlv_impl = nullptr;
+  void *tlv_context = nullptr;
+  btstack_tlv_get_instance(&tlv_impl, &tlv_context);
+  if (!tlv_impl)
     return;
 
-  uint8_t event = hci_event_packet_get_type(packet);
-  printf("HCI Event: 0x%02x\n", event);
+  // Stored as [addr_type, addr[6]]
+  uint8_t data[7];
+  int len = tlv_impl->get_tag(tlv_context, link.tlv_tag, data, sizeof(data));
+  if (len != (int)sizeof(data))
+    return;
 
-  switch (event) {
-  case BTSTACK_EVENT_STATE:
-    if (btstack_event_state_get_state(packet) == HCI_STATE_WORKING) {
-      printf("BLE Enabled. Scanning for %s...\n", BLE_TARGET_NAME.c_str());
-      // Active scanning (1), Interval 48ms (0x30), Window 48ms (0x30)
-      gap_set_scan_parameters(1, 0x0030, 0x0030);
-      gap_start_scan();
-      printf("gap_start_scan called\n");
+  link.known_addr_type = (bd_addr_type_t)data[0];
+  memcpy(link.known_addr, &data[1], sizeof(link.known_addr));
+  link.have_known_device = true;
+  printf("[BLE] Known %s: %s (type %d)\n", link.target_name->c_str(),
+         bd_addr_to_str(link.known_addr), (int)link.known_addr_type);
+}
+
+void BLEClient::store_known_device(Link &link, const bd_addr_t addr,
+                                   bd_addr_type_t addr_type) {
+  // Avoid rewriting flash on every reconnect to the same device
+  if (link.have_known_device && link.known_addr_type == addr_type &&
+      memcmp(link.known_addr, addr, sizeof(link.known_addr)) == 0)
+    return;
+
+  memcpy(link.known_addr, addr, sizeof(link.known_addr));
+  link.known_addr_type = addr_type;
+  link.have_known_device = true;
+
+  const btstack_tlv_t *tlv_impl = nullptr;
+  void *tlv_context = nullptr;
+  btstack_tlv_get_instance(&tlv_impl, &tlv_context);
+  if (!tlv_impl)
+    return;
+
+  uint8_t data[7];
+  data[0] = (uint8_t)addr_type;
+  memcpy(&data[1], addr, sizeof(link.known_addr));
+  tlv_impl->store_tag(tlv_context, link.tlv_tag, data, sizeof(data));
+  printf("[BLE] Stored %s address %s\n", link.target_name->c_str(),
+         bd_addr_to_str(link.known_addr));
+}
+
+// Entry point on boot and after a drop: try the known devices of all missing
+// links directly via the controller whitelist, otherwise scan by name. Only
+// one connection attempt runs at a time; this is called again after each
+// connection completes until every enabled link is up.
+void BLEClient::start_connecting() {
+  if (connect_path != ConnectPath::NONE)
+    return;
+
+  bool any_missing = false;
+  bool any_known = false;
+  gap_whitelist_clear();
+  for (Link &link : links) {
+    if (!link.enabled || link.connected)
+      continue;
+    any_missing = true;
+    if (link.have_known_device) {
+      gap_whitelist_add(link.known_addr_type, link.known_addr);
+      any_known = true;
     }
-    break;
+  }
+  if (!any_missing)
+    return;
 
-  case GAP_EVENT_ADVERTISING_REPORT: {
-    uint8_t event_type =
-        gap_event_advertising_report_get_advertising_event_type(packet);
-    uint8_t data_length = gap_event_advertising_report_get_data_length(packet);
-    const uint8_t *data = gap_event_advertising_report_get_data(packet);
+  // Initial connection parameters used by both direct and scan connects
+  gap_set_connection_parameters(0x0030, 0x0030, BLE_CONN_INTERVAL_MIN,
+                                BLE_CONN_INTERVAL_MAX, BLE_CONN_LATENCY,
+                                BLE_SUPERVISION_TIMEOUT, 0, 0);
 
-    // printf("Adv Report: Type %d, Len %d\n", event_type, data_length);
+  if (!any_known) {
+    start_scan();
+    return;
+  }
 
-    int i = 0;
-    while (i < data_length) {
-      uint8_t len = data[i];
-      if (len == 0)
-        break;
-      uint8_t type = data[i + 1];
+  printf("[BLE] Direct connect to known devices (timeout %lu ms)...\n",
+         (unsigned long)BLE_DIRECT_CONNECT_TIMEOUT_MS);
+  connect_path = ConnectPath::DIRECT;
+  uint8_t status = gap_connect_with_whitelist();
+  if (status != ERROR_CODE_SUCCESS) {
+    printf("[BLE] Direct connect failed (0x%02x). Scanning.\n", status);
+    start_scan();
+    return;
+  }
 
-      if (type == 0x09 || type == 0x08) { // Complete or Shortened Local Name
-        char name_str[32] = {0};
-        int name_len = len - 1;
-        if (name_len > 31)
-          name_len = 31;
-        memcpy(name_str, &data[i + 2], name_len);
+  btstack_run_loop_set_timer(&connect_timer,
+                             BLE_DIRECT_CONNECT_TIMEOUT_MS);
+  btstack_run_loop_add_timer(&connect_timer);
+}
 
-        bd_addr_t address;
-        gap_event_advertising_report_get_address(packet, address);
-        const char *mac_str = bd_addr_to_str(address);
+// Passive when the address of every missing link is known, active (for the
+// names in scan responses) otherwise
+void BLEClient::start_scan() {
+  scan_passive = BLE_SCAN_PASSIVE && !passive_missed;
+  for (const Link &link : links) {
+    if (link.enabled && !link.connected && !link.have_known_device &&
+        !link.have_seen_addr)
+      scan_passive = false;
+  }
+  printf("BLE Scanning for %s%s%s (%s, window %d/%d)...\n",
+         BLE_TARGET_NAME.c_str(), links[BLE_LINK_STANDBY].enabled ? " / " : "",
+         BLE_STANDBY_NAME.c_str(), scan_passive ? "passive" : "active",
+         BLE_SCAN_WINDOW, BLE_SCAN_INTERVAL);
+  connect_path = ConnectPath::SCAN;
+  scan_connect_link = -1;
+  memset(power_adv_addr, 0, sizeof(power_adv_addr));
+  gap_set_scan_parameters(scan_passive ? 0 : 1, BLE_SCAN_INTERVAL,
+                          BLE_SCAN_WINDOW);
+  gap_start_scan();
+  if (scan_passive) {
+    btstack_run_loop_remove_timer(&connect_timer);
+    btstack_run_loop_set_timer(&connect_timer, BLE_PASSIVE_SCAN_TIMEOUT_MS);
+    btstack_run_loop_add_timer(&connect_timer);
+  }
+}
 
-        // printf("  Found Name: %s (MAC: %s)\n", name_str, mac_str);
+bool BLEClient::is_link_address(const Link &link, const bd_addr_t addr) {
+  return (link.have_known_device &&
+          memcmp(link.known_addr, addr, sizeof(bd_addr_t)) == 0) ||
+         (link.have_seen_addr &&
+          memcmp(link.seen_addr, addr, sizeof(bd_addr_t)) == 0);
+}
 
-        if (instance && instance->scan_callback) {
-          instance->scan_callback(mac_str, name_str);
-        }
+// Stops the scan and connects to the advertiser of the report, if it is
+// connectable
+void BLEClient::connect_scanned(Link &link, uint8_t *packet) {
+  uint8_t event_type =
+      gap_event_advertising_report_get_advertising_event_type(packet);
+  if (event_type != 0 && event_type != 1 && event_type != 4)
+    return; // Not connectable
+
+  bd_addr_t address;
+  gap_event_advertising_report_get_address(packet, address);
+  printf("Found Target %s! Connecting...\n", link.target_name->c_str());
+  gap_stop_scan();
+  scan_connect_link = (int)link_index(link);
+  gap_connect(address, (bd_addr_type_t)
+                           gap_event_advertising_report_get_address_type(
+                               packet));
+  btstack_run_loop_remove_timer(&connect_timer);
+  btstack_run_loop_set_timer(&connect_timer, BLE_SCAN_CONNECT_TIMEOUT_MS);
+  btstack_run_loop_add_timer(&connect_timer);
+}
 
-        if (len - 1 == BLE_TARGET_NAME.length()) {
-          if (memcmp(&data[i + 2], BLE_TARGET_NAME.c_str(), len - 1) == 0) {
-            if (event_type == 0 || event_type == 1 || event_type == 4) {
-              printf("Found Target! Connecting...\n");
-              gap_stop_scan();
-              bd_addr_t addr;
-              gap_event_advertising_report_get_address(packet, addr);
-              gap_connect(
-                  addr,
-                  (bd_addr_type_t)gap_event_advertising_report_get_address_type(
-                      packet));
-              break;
-            } else {
-              // Not connectable
-            }
-          }
-        }
+// Single pass over the AD structures. Names are only extracted for
+// advertisers that list the Cycling Power (0x1818) or Fitness Machine
+// (0x1826) service, or for the scan response that follows such an
+// advertisement (the UUID list and the name are often split between them).
+void BLEClient::handle_advertising_report(uint8_t *packet) {
+  uint8_t event_type =
+      gap_event_advertising_report_get_advertising_event_type(packet);
+  uint8_t data_length = gap_event_advertising_report_get_data_length(packet);
+  const uint8_t *data = gap_event_advertising_report_get_data(packet);
+
+  bd_addr_t address;
+  gap_event_advertising_report_get_address(packet, address);
+
+  // A passive scan has no scan responses to take the name from
+  if (scan_passive && connect_path == ConnectPath::SCAN &&
+      scan_connect_link < 0) {
+    for (Link &link : links) {
+      if (link.enabled && !link.connected && is_link_address(link, address)) {
+        connect_scanned(link, packet);
+        return;
+      }
+    }
+  }
+
+  const uint8_t *name = nullptr;
+  uint8_t name_len = 0;
+  bool power_service = false;
+
+  int i = 0;
+  while (i + 1 < data_length) {
+    uint8_t len = data[i];
+    if (len == 0 || i + 1 + len > data_length)
+      break;
+    uint8_t type = data[i + 1];
+
+    if (type == 0x02 || type == 0x03) { // Incomplete or Complete 16-bit UUIDs
+      for (int j = i + 2; j + 1 < i + 1 + len; j += 2) {
+        uint16_t uuid = data[j] | (data[j + 1] << 8);
+        if (uuid == 0x1818 || uuid == 0x1826)
+          power_service = true;
       }
-      i += len + 1;
+    } else if (type == 0x09 || type == 0x08) { // Complete or Shortened Name
+      name = &data[i + 2];
+      name_len = len - 1;
     }
+    i += len + 1;
+  }
+
+  if (power_service) {
+    memcpy(power_adv_addr, address, sizeof(power_adv_addr));
+  } else if (BLE_SCAN_FILTER_POWER_SERVICE &&
+             !(event_type == 4 &&
+               memcmp(power_adv_addr, address, sizeof(power_adv_addr)) == 0)) {
+    return;
+  }
+
+  if (!name)
+    return;
+
+  char name_str[32] = {0};
+  memcpy(name_str, name, name_len > 31 ? 31 : name_len);
+
+  int8_t rssi = gap_event_advertising_report_get_rssi(packet);
+  if (scan_callback &&
+      scan_cache.update(address, rssi, to_ms_since_boot(get_absolute_time())) !=
+          ScanCache::Result::SEEN) {
+    scan_callback(bd_addr_to_str(address), name_str, rssi);
+  }
+
+  if (connect_path != ConnectPath::SCAN || scan_connect_link >= 0)
+    return;
+
+  for (Link &link : links) {
+    if (!link.enabled || link.connected)
+      continue;
+    if (name_len != link.target_name->length() ||
+        memcmp(name, link.target_name->c_str(), name_len) != 0)
+      continue;
+
+    // Later scans for this link can be passive
+    memcpy(link.seen_addr, address, sizeof(link.seen_addr));
+    link.have_seen_addr = true;
+    connect_scanned(link, packet);
     break;
   }
+}
 
-  case HCI_EVENT_LE_META:
-    if (hci_event_le_meta_get_subevent_code(packet) ==
-        HCI_SUBEVENT_LE_CONNECTION_COMPLETE) {
-      connection_handle =
-          hci_subevent_le_connection_complete_get_connection_handle(packet);
-      printf("Connected! Handle: 0x%04x. Starting Service Discovery...\n",
-             connection_handle);
-      connected = true;
-      last_notification_ms = to_ms_since_boot(get_absolute_time());
-
-      // Update UI immediately
-      if (instance && instance->power_callback) {
-        instance->power_callback(0);
+void BLEClient::on_connect_timeout() {
+  if (connect_path == ConnectPath::SCAN && scan_connect_link >= 0) {
+    // The failed connection complete event for the cancel restarts the scan
+    printf("[BLE] Connect to scanned %s timed out.\n",
+           links[scan_connect_link].target_name->c_str());
+    gap_connect_cancel();
+    return;
+  }
+  if (connect_path == ConnectPath::SCAN && scan_passive) {
+    // The address may have changed (or the trainer be new): names again
+    printf("[BLE] Passive scan timed out. Scanning actively.\n");
+    passive_missed = true;
+    gap_stop_scan();
+    start_scan();
+    return;
+  }
+  if (connect_path != ConnectPath::DIRECT)
+    return;
+  printf("[BLE] Direct connect timed out. Falling back to name scan.\n");
+  // The controller reports the cancel as a failed connection complete event,
+  // which arrives once the scan has started
+  cancel_pending = true;
+  gap_connect_cancel();
+  start_scan();
+}
+
+void BLEClient::report_connect_time(Link &link) {
+  uint32_t elapsed =
+      to_ms_since_boot(get_absolute_time()) - link.connect_start_ms;
+  ConnectStats &stats =
+      (connect_path == ConnectPath::DIRECT) ? direct_stats : scan_stats;
+  stats.count++;
+  stats.total_ms += elapsed;
+  stats.last_ms = elapsed;
+
+  printf("[BLE] Connected via %s in %lu ms (direct: n=%lu avg=%lu ms, scan: "
+         "n=%lu avg=%lu ms)\n",
+         connect_path == ConnectPath::DIRECT ? "direct" : "scan",
+         (unsigned long)elapsed, (unsigned long)direct_stats.count,
+         (unsigned long)(direct_stats.count
+                             ? direct_stats.total_ms / direct_stats.count
+                             : 0),
+         (unsigned long)scan_stats.count,
+         (unsigned long)(scan_stats.count ? scan_stats.total_ms / scan_stats.count
+                                          : 0));
+}
+
+void BLEClient::handle_connection_complete(uint8_t *packet) {
+  uint8_t conn_status = hci_subevent_le_connection_complete_get_status(packet);
+  if (conn_status != ERROR_CODE_SUCCESS) {
+    printf("Connection attempt ended. Status: 0x%02x\n", conn_status);
+    if (cancel_pending) {
+      // The direct connect cancelled on timeout; the scan already runs
+      cancel_pending = false;
+      return;
+    }
+    // Failed or timed out: start over with the direct connect or the scan
+    btstack_run_loop_remove_timer(&connect_timer);
+    connect_path = ConnectPath::NONE;
+    scan_connect_link = -1;
+    start_connecting();
+    return;
+  }
+  if (hci_subevent_le_connection_complete_get_role(packet) != 0) {
+    // Peripheral role: a client of the power relay, not a power source
+    return;
+  }
+
+  bd_addr_t peer_addr;
+  hci_subevent_le_connection_complete_get_peer_address(packet, peer_addr);
+
+  // Work out which link this is: the scan target, or the known device whose
+  // address matches (whitelist connect), else the first missing link
+  Link *link = nullptr;
+  if (connect_path == ConnectPath::SCAN && scan_connect_link >= 0) {
+    link = &links[scan_connect_link];
+  } else {
+    for (Link &candidate : links) {
+      if (candidate.enabled && !candidate.connected &&
+          candidate.have_known_device &&
+          memcmp(candidate.known_addr, peer_addr, sizeof(bd_addr_t)) == 0) {
+        link = &candidate;
+        break;
+      }
+    }
+  }
+  if (!link) {
+    for (Link &candidate : links) {
+      if (candidate.enabled && !candidate.connected) {
+        link = &candidate;
+        break;
       }
+    }
+  }
 
-      // LOG BEFORE CALLING
-      printf("Calling gatt_client_discover_primary_services...\n");
+  // A direct connect may complete after the scan fallback has started
+  btstack_run_loop_remove_timer(&connect_timer);
+  cancel_pending = false;
+  passive_missed = false;
+  gap_stop_scan();
+
+  hci_con_handle_t handle =
+      hci_subevent_le_connection_complete_get_connection_handle(packet);
+  if (!link) {
+    printf("Unexpected connection 0x%04x. Disconnecting.\n", handle);
+    gap_disconnect(handle);
+    connect_path = ConnectPath::NONE;
+    return;
+  }
 
-      discovery_state = DiscoveryState::DISCOVERING_SERVICES;
-      // Discover ALL services
-      uint8_t status = gatt_client_discover_primary_services(
-          static_packet_handler, connection_handle);
+  link->handle = handle;
+  printf("Connected %s! Handle: 0x%04x. Starting Service Discovery...\n",
+         link->target_name->c_str(), link->handle);
+  link->connected = true;
+  report_connect_time(*link);
+  connect_path = ConnectPath::NONE;
+  scan_connect_link = -1;
+
+  memset(&link->link_info, 0, sizeof(link->link_info));
+  link->stats.reset();
+  link->link_info.conn_interval =
+      hci_subevent_le_connection_complete_get_conn_interval(packet);
+  link->link_info.conn_latency =
+      hci_subevent_le_connection_complete_get_conn_latency(packet);
+  link->link_info.supervision_timeout =
+      hci_subevent_le_connection_complete_get_supervision_timeout(packet);
+  link->link_info.tx_phy = 1;
+  link->link_info.rx_phy = 1;
+  link->notification_anchor_us = 0;
+  printf("Connection interval %d (x1.25ms), latency %d\n",
+         link->link_info.conn_interval, link->link_info.conn_latency);
+
+  store_known_device(
+      *link, peer_addr,
+      (bd_addr_type_t)hci_subevent_le_connection_complete_get_peer_address_type(
+          packet));
+  link->last_notification_ms = to_ms_since_boot(get_absolute_time());
+  link->cadence_ms = 0;
+  link->stalled = false;
+  link->healthy_streak = 0;
+
+  // Update UI immediately
+  if (link_index(*link) == active_link && power_callback) {
+    power_callback(0);
+  }
 
-      // FLUSH STDOUT? Use fflush(stdout);
-      // Pico SDK stdio might not support it, but worth a try or just rely on \n
-      printf("Discovery Request Sent. Status: 0x%02x\n", status);
+  // LOG BEFORE CALLING
+  printf("Calling gatt_client_discover_primary_services...\n");
+
+  link->discovery_state = DiscoveryState::DISCOVERING_SERVICES;
+  // Discover ALL services
+  uint8_t status = gatt_client_discover_primary_services(static_packet_handler,
+                                                         link->handle);
+
+  // FLUSH STDOUT? Use fflush(stdout);
+  // Pico SDK stdio might not support it, but worth a try or just rely on \n
+  printf("Discovery Request Sent. Status: 0x%02x\n", status);
+
+  // Bring up the other link, if any is still missing
+  start_connecting();
+}
+
+void BLEClient::handle_disconnection(Link &link) {
+  size_t index = link_index(link);
+  printf("Disconnected %s.\n", link.target_name->c_str());
+  btstack_run_loop_remove_timer(&link.stall_timer);
+  link.connected = false;
+  link.handle = HCI_CON_HANDLE_INVALID;
+  link.discovery_state = DiscoveryState::IDLE;
+  link.connect_start_ms = to_ms_since_boot(get_absolute_time());
+  memset(&link.service, 0, sizeof(link.service));
+  memset(&link.characteristic, 0, sizeof(link.characteristic));
+
+  if (index == active_link) {
+    size_t other = (index == BLE_LINK_PRIMARY) ? BLE_LINK_STANDBY
+                                               : BLE_LINK_PRIMARY;
+    if (links[other].connected &&
+        links[other].discovery_state == DiscoveryState::SUBSCRIBED) {
+      switch_active(other, true);
     }
+  }
+  start_connecting();
+}
+
+// Trainers may ignore the initial parameters, so ask again once discovery has
+// finished, together with the 2M PHY. Data length extension is requested by
+// BTstack itself (ENABLE_LE_DATA_LENGTH_EXTENSION).
+void BLEClient::request_low_latency_link(Link &link) {
+  if (link.link_info.conn_interval > BLE_CONN_INTERVAL_MAX) {
+    printf("[BLE] Requesting interval %d-%d (current %d)\n",
+           BLE_CONN_INTERVAL_MIN, BLE_CONN_INTERVAL_MAX,
+           link.link_info.conn_interval);
+    gap_update_connection_parameters(link.handle, BLE_CONN_INTERVAL_MIN,
+                                     BLE_CONN_INTERVAL_MAX, BLE_CONN_LATENCY,
+                                     BLE_SUPERVISION_TIMEOUT);
+  }
+
+  if (BLE_PREFER_2M_PHY && link.link_info.tx_phy != 2) {
+    // all_phys = 0 (both preferences given), tx/rx bit 1 = LE 2M
+    uint8_t status = gap_le_set_phy(link.handle, 0, 0x02, 0x02, 0);
+    printf("[BLE] Requesting 2M PHY. Status: 0x%02x\n", status);
+  }
+}
+
+void BLEClient::handle_le_meta(uint8_t *packet) {
+  Link *link;
+  switch (hci_event_le_meta_get_subevent_code(packet)) {
+  case HCI_SUBEVENT_LE_CONNECTION_COMPLETE:
+    handle_connection_complete(packet);
+    break;
+
+  case HCI_SUBEVENT_LE_CONNECTION_UPDATE_COMPLETE:
+    link = find_link(
+        hci_subevent_le_connection_update_complete_get_connection_handle(
+            packet));
+    if (!link || hci_subevent_le_connection_update_complete_get_status(
+                     packet) != ERROR_CODE_SUCCESS)
+      break;
+    link->link_info.conn_interval =
+        hci_subevent_le_connection_update_complete_get_conn_interval(packet);
+    link->link_info.conn_latency =
+        hci_subevent_le_connection_update_complete_get_conn_latency(packet);
+    link->link_info.supervision_timeout =
+        hci_subevent_le_connection_update_complete_get_supervision_timeout(
+            packet);
+    // The event grid moved: re-anchor on the next notification and measure
+    // gaps and jitter against the new interval only
+    link->notification_anchor_us = 0;
+    link->link_info.last_gap_events = 0;
+    link->link_info.max_gap_events = 0;
+    link->link_info.max_phase_jitter_us = 0;
+    printf("[BLE] Connection updated: interval %d (x1.25ms) latency %d "
+           "timeout %d\n",
+           link->link_info.conn_interval, link->link_info.conn_latency,
+           link->link_info.supervision_timeout);
+    break;
+
+  case HCI_SUBEVENT_LE_DATA_LENGTH_CHANGE:
+    link = find_link(
+        hci_subevent_le_data_length_change_get_connection_handle(packet));
+    if (!link)
+      break;
+    link->link_info.max_tx_octets =
+        hci_subevent_le_data_length_change_get_max_tx_octets(packet);
+    link->link_info.max_rx_octets =
+        hci_subevent_le_data_length_change_get_max_rx_octets(packet);
+    printf("[BLE] Data length: tx %d rx %d octets\n",
+           link->link_info.max_tx_octets, link->link_info.max_rx_octets);
+    break;
+
+  case HCI_SUBEVENT_LE_PHY_UPDATE_COMPLETE:
+    link = find_link(
+        hci_subevent_le_phy_update_complete_get_connection_handle(packet));
+    if (!link || hci_subevent_le_phy_update_complete_get_status(packet) !=
+                     ERROR_CODE_SUCCESS)
+      break;
+    link->link_info.tx_phy =
+        hci_subevent_le_phy_update_complete_get_tx_phy(packet);
+    link->link_info.rx_phy =
+        hci_subevent_le_phy_update_complete_get_rx_phy(packet);
+    printf("[BLE] PHY: tx %d rx %d\n", link->link_info.tx_phy,
+           link->link_info.rx_phy);
+    break;
+
+  default:
+    break;
+  }
+}
+
+// Track where notifications land relative to the connection event grid. The
+// first notification after (re)connect or a connection update is taken as the
+// grid anchor.
+void BLEClient::update_notification_timing(Link &link, uint64_t now_us) {
+  BLELinkInfo &info = link.link_info;
+  info.notification_count++;
+  if (info.conn_interval == 0)
+    return;
+
+  uint32_t interval_us = info.conn_interval * 1250;
+  if (link.notification_anchor_us == 0) {
+    link.notification_anchor_us = now_us;
+  } else {
+    uint32_t gap_us = (uint32_t)(now_us - link.last_notification_us);
+    info.last_gap_events = (gap_us + interval_us / 2) / interval_us;
+    if (info.last_gap_events > info.max_gap_events)
+      info.max_gap_events = info.last_gap_events;
+
+    uint32_t phase_us =
+        (uint32_t)((now_us - link.notification_anchor_us) % interval_us);
+    uint32_t jitter_us =
+        (phase_us > interval_us / 2) ? interval_us - phase_us : phase_us;
+    if (jitter_us > info.max_phase_jitter_us)
+      info.max_phase_jitter_us = jitter_us;
+  }
+  link.last_notification_us = now_us;
+}
+
+// Stall threshold follows the measured notification cadence of the link
+uint32_t BLEClient::stall_threshold_ms(const Link &link) const {
+  if (link.cadence_ms == 0)
+    return BLE_STALL_DEFAULT_MS;
+  uint32_t threshold = link.cadence_ms * BLE_STALL_FACTOR_PCT / 100;
+  return threshold < BLE_STALL_MIN_MS ? BLE_STALL_MIN_MS : threshold;
+}
+
+void BLEClient::arm_stall_timer(Link &link) {
+  btstack_run_loop_remove_timer(&link.stall_timer);
+  btstack_run_loop_set_timer(&link.stall_timer, stall_threshold_ms(link));
+  btstack_run_loop_add_timer(&link.stall_timer);
+}
+
+void BLEClient::on_stall_timeout(size_t index) {
+  Link &link = links[index];
+  if (!link.connected)
+    return;
+  link.stalled = true;
+  link.healthy_streak = 0;
+  LOG_WARN("[BLE] Link %d stalled (cadence %lu ms)\n", (int)index,
+           link.cadence_ms);
+
+  // Switch over right away; the standby's next notification is delivered
+  size_t other =
+      (index == BLE_LINK_PRIMARY) ? BLE_LINK_STANDBY : BLE_LINK_PRIMARY;
+  if (index == active_link && links[other].connected &&
+      links[other].discovery_state == DiscoveryState::SUBSCRIBED &&
+      !links[other].stalled) {
+    switch_active(other, true);
+  }
+}
+
+// A switch to the standby is a failover, one back to the primary a failback.
+// If the link given up on failed, the time until the new one delivers counts
+// as an outage.
+void BLEClient::switch_active(size_t index, bool failure) {
+  Link &old_link = links[active_link];
+  bool failback = (index == BLE_LINK_PRIMARY);
+  if (failback)
+    failover_stats.failbacks++;
+  else
+    failover_stats.failovers++;
+  if (failure)
+    outage_start_ms = old_link.last_notification_ms;
+  LOG_WARN("[BLE] %s to link %d\n", failback ? "Failback" : "Failover",
+           (int)index);
+  active_link = index;
+}
+
+void BLEClient::handle_query_complete(Link &link, uint8_t att_status) {
+  printf("GATT Query Complete. Status: 0x%02x. State: %d\n", att_status,
+         (int)link.discovery_state);
+
+  if (att_status != 0) {
+    printf("Query failed or finished with error.\n");
+    if (att_status == 0x7F) {
+      printf("Error 0x7F might mean Attribute Not Found.\n");
+    }
+  }
+
+  switch (link.discovery_state) {
+  case DiscoveryState::DISCOVERING_SERVICES:
+    if (link.service.start_group_handle != 0) {
+      printf("Service Found! Discovering Characteristics...\n");
+      link.discovery_state = DiscoveryState::DISCOVERING_CHARS;
+      // Discover ALL characteristics to ensure we see 2A63
+      gatt_client_discover_characteristics_for_service(
+          static_packet_handler, link.handle, &link.service);
+    } else {
+      printf("FATAL: Service 0x1818 was not found. STALLING.\n");
+      // discovery_state = DiscoveryState::IDLE;
+    }
+    break;
+
+  case DiscoveryState::DISCOVERING_CHARS:
+    if (link.characteristic.value_handle != 0) {
+      printf("Characteristic 2A63 Found (Handle 0x%04x). Subscribing...\n",
+             link.characteristic.value_handle);
+      link.discovery_state = DiscoveryState::SUBSCRIBING;
+
+      // 1. Register Notification Listener
+      gatt_client_listen_for_characteristic_value_updates(
+          &link.notification_registration, static_packet_handler, link.handle,
+          &link.characteristic);
+
+      // 2. Enable Notifications via CCCD
+      gatt_client_write_client_characteristic_configuration(
+          static_packet_handler, link.handle, &link.characteristic,
+          GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION);
+    } else {
+      printf("FATAL: Characteristic 0x2A63 not found.\n");
+      link.discovery_state = DiscoveryState::IDLE;
+    }
+    break;
+
+  case DiscoveryState::SUBSCRIBING:
+    printf("Subscription Complete (Notifications Enabled). State -> "
+           "SUBSCRIBED.\n");
+    link.discovery_state = DiscoveryState::SUBSCRIBED;
+    request_low_latency_link(link);
+    arm_stall_timer(link);
+    break;
+
+  default:
+    break;
+  }
+}
+
+void BLEClient::handle_notification(Link &link, uint8_t *packet) {
+  uint64_t rx_time_us = time_us_64();
+  uint32_t now_ms = to_ms_since_boot(get_absolute_time());
+  size_t index = link_index(link);
+  uint16_t value_len = gatt_event_notification_get_value_length(packet);
+  const uint8_t *value = gatt_event_notification_get_value(packet);
+
+  // Cadence (EMA, 1/8 weight) and stall bookkeeping for this link
+  if (link.link_info.notification_count > 0) {
+    uint32_t dt = now_ms - link.last_notification_ms;
+    link.cadence_ms =
+        link.cadence_ms ? (link.cadence_ms * 7 + dt) / 8 : dt;
+  }
+  link.last_notification_ms = now_ms;
+  link.stalled = false;
+  if (link.healthy_streak < 255)
+    link.healthy_streak++;
+  update_notification_timing(link, rx_time_us);
+  link.stats.on_notification(value, value_len, now_ms);
+  arm_stall_timer(link);
+
+  if (index != active_link) {
+    Link &active = links[active_link];
+    if (!active.connected || active.stalled) {
+      switch_active(index, true);
+    } else if (index == BLE_LINK_PRIMARY &&
+               link.healthy_streak >= BLE_FAILBACK_NOTIFICATIONS) {
+      // Primary is healthy again: hand back from the standby source
+      switch_active(index, false);
+    } else {
+      return; // Standby stays warm but silent
+    }
+  }
+
+  if (outage_start_ms) {
+    uint32_t outage = now_ms - outage_start_ms;
+    failover_stats.last_outage_ms = outage;
+    failover_stats.total_outage_ms += outage;
+    if (outage > failover_stats.max_outage_ms)
+      failover_stats.max_outage_ms = outage;
+    outage_start_ms = 0;
+  }
+
+  // Forward raw value first so relaying is not delayed by the UI work done
+  // in the power callback
+  if (notification_callback) {
+    notification_callback(value, value_len, rx_time_us);
+  }
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+  {
+    // First 8 bytes packed big-endian so the record stays binary
+    uint32_t words[2] = {0, 0};
+    for (int i = 0; i < value_len && i < 8; i++)
+      words[i / 4] |= (uint32_t)value[i] << (24 - 8 * (i % 4));
+    LOG_DEBUG("Notification! Len: %d. Data: %08lx %08lx\n", value_len,
+              words[0], words[1]);
+  }
+#endif
+
+  if (value_len >= 4) {
+    int16_t power = (int16_t)(value[2] | (value[3] << 8));
+    // printf("Parsed Power: %d\n", power);
+    if (power_callback) {
+      power_callback((uint16_t)power);
+    }
+  }
+}
+
+void BLEClient::print_link_info() {
+  for (size_t i = 0; i < BLE_MAX_LINKS; i++) {
+    const Link &link = links[i];
+    if (!link.connected)
+      continue;
+    const BLELinkInfo &info = link.link_info;
+    LOG_TELEMETRY("[BLE %d] Link: interval %d x1.25ms, latency %d, timeout %d "
+                  "x10ms\n",
+                  (int)i, info.conn_interval, info.conn_latency,
+                  info.supervision_timeout);
+    LOG_TELEMETRY("[BLE %d] Link: DLE tx %d rx %d, PHY tx %d\n", (int)i,
+                  info.max_tx_octets, info.max_rx_octets, info.tx_phy);
+    LOG_TELEMETRY("[BLE %d] Notifications: %lu, gap %lu events (max %lu)\n",
+                  (int)i, info.notification_count, info.last_gap_events,
+                  info.max_gap_events);
+    LOG_TELEMETRY("[BLE %d] Cadence %lu ms, max jitter %lu us\n", (int)i,
+                  link.cadence_ms, info.max_phase_jitter_us);
+    link.stats.print((int)i);
+  }
+  if (links[BLE_LINK_STANDBY].enabled) {
+    LOG_TELEMETRY("[BLE] Active %d, failovers %lu, failbacks %lu\n",
+                  (int)active_link, failover_stats.failovers,
+                  failover_stats.failbacks);
+    LOG_TELEMETRY("[BLE] Outage last %lu ms, max %lu ms, total %lu ms\n",
+                  failover_stats.last_outage_ms, failover_stats.max_outage_ms,
+                  failover_stats.total_outage_ms);
+  }
+}
+
+void BLEClient::packet_handler(uint8_t packet_type, uint16_t channel,
+                               uint8_t *packet, uint16_t size) {
+  if (packet_type != HCI_EVENT_PACKET)
+    return;
+
+  uint8_t event = hci_event_packet_get_type(packet);
+  LOG_DEBUG("HCI Event: 0x%02x\n", event);
+  Link *link;
+
+  switch (event) {
+  case BTSTACK_EVENT_STATE:
+    if (btstack_event_state_get_state(packet) == HCI_STATE_WORKING) {
+      printf("BLE Enabled.\n");
+      uint32_t now = to_ms_since_boot(get_absolute_time());
+      for (Link &l : links) {
+        if (l.enabled) {
+          load_known_device(l);
+          l.connect_start_ms = now;
+        }
+      }
+      start_connecting();
+    }
+    break;
+
+  case GAP_EVENT_ADVERTISING_REPORT:
+    handle_advertising_report(packet);
+    break;
+
+  case HCI_EVENT_LE_META:
+    handle_le_meta(packet);
     break;
 
     // Removed GATT_EVENT_MTU case entirely
 
   case HCI_EVENT_DISCONNECTION_COMPLETE:
-    printf("Disconnected.\n");
-    connected = false;
-    connection_handle = HCI_CON_HANDLE_INVALID;
-    discovery_state = DiscoveryState::IDLE;
-    memset(&service, 0, sizeof(service));
-    memset(&characteristic, 0, sizeof(characteristic));
-    gap_start_scan();
+    link = find_link(
+        hci_event_disconnection_complete_get_connection_handle(packet));
+    if (link) // Otherwise a relay client link
+      handle_disconnection(*link);
     break;
 
   case GATT_EVENT_SERVICE_QUERY_RESULT: {
+    link = find_link(gatt_event_service_query_result_get_handle(packet));
+    if (!link)
+      break;
     gatt_client_service_t found_service;
     gatt_event_service_query_result_get_service(packet, &found_service);
 
@@ -162,7 +880,7 @@ void BLEClient::packet_handler(uint8_t packet_type, uint16_t channel,
     // Check for 0x1818 (Cycling Power) - Big Endian check for bytes 2,3
     if (found_service.uuid128[2] == 0x18 && found_service.uuid128[3] == 0x18) {
       printf("CHECK MATCH: Found 0x1818!\n");
-      service = found_service;
+      link->service = found_service;
     }
     // Also Check for 0x1800 (Generic Access) for validation
     if (found_service.uuid128[2] == 0x18 && found_service.uuid128[3] == 0x00) {
@@ -172,6 +890,10 @@ void BLEClient::packet_handler(uint8_t packet_type, uint16_t channel,
   }
 
   case GATT_EVENT_CHARACTERISTIC_QUERY_RESULT: {
+    link =
+        find_link(gatt_event_characteristic_query_result_get_handle(packet));
+    if (!link)
+      break;
     gatt_client_characteristic_t temp_char;
     gatt_event_characteristic_query_result_get_characteristic(packet,
                                                               &temp_char);
@@ -185,101 +907,37 @@ void BLEClient::packet_handler(uint8_t packet_type, uint16_t channel,
     // Based on logs: 00002a63... -> Index 2=0x2a, Index 3=0x63
     if (temp_char.uuid128[2] == 0x2a && temp_char.uuid128[3] == 0x63) {
       printf("CHECK MATCH: Found Cycling Power (0x2A63)!\n");
-      characteristic = temp_char;
+      link->characteristic = temp_char;
     }
     break;
   }
 
   case GATT_EVENT_QUERY_COMPLETE:
-    printf("GATT Query Complete. Status: 0x%02x. State: %d\n",
-           gatt_event_query_complete_get_att_status(packet),
-           (int)discovery_state);
-
-    if (gatt_event_query_complete_get_att_status(packet) != 0) {
-      printf("Query failed or finished with error.\n");
-      if (gatt_event_query_complete_get_att_status(packet) == 0x7F) {
-        printf("Error 0x7F might mean Attribute Not Found.\n");
-      }
-    }
-
-    switch (discovery_state) {
-    case DiscoveryState::DISCOVERING_SERVICES:
-      if (service.start_group_handle != 0) {
-        printf("Service Found! Discovering Characteristics...\n");
-        discovery_state = DiscoveryState::DISCOVERING_CHARS;
-        // Discover ALL characteristics to ensure we see 2A63
-        gatt_client_discover_characteristics_for_service(
-            static_packet_handler, connection_handle, &service);
-      } else {
-        printf("FATAL: Service 0x1818 was not found. STALLING.\n");
-        // discovery_state = DiscoveryState::IDLE;
-      }
-      break;
-
-    case DiscoveryState::DISCOVERING_CHARS:
-      if (characteristic.value_handle != 0) {
-        printf("Characteristic 2A63 Found (Handle 0x%04x). Subscribing...\n",
-               characteristic.value_handle);
-        discovery_state = DiscoveryState::SUBSCRIBING;
-
-        // 1. Register Notification Listener
-        gatt_client_listen_for_characteristic_value_updates(
-            &notification_registration, static_packet_handler,
-            connection_handle, &characteristic);
-
-        // 2. Enable Notifications via CCCD
-        gatt_client_write_client_characteristic_configuration(
-            static_packet_handler, connection_handle, &characteristic,
-            GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION);
-      } else {
-        printf("FATAL: Characteristic 0x2A63 not found.\n");
-        discovery_state = DiscoveryState::IDLE;
-      }
-      break;
-
-    case DiscoveryState::SUBSCRIBING:
-      printf("Subscription Complete (Notifications Enabled). State -> "
-             "SUBSCRIBED.\n");
-      discovery_state = DiscoveryState::SUBSCRIBED;
-      break;
-
-    default:
-      break;
-    }
+    link = find_link(gatt_event_query_complete_get_handle(packet));
+    if (link)
+      handle_query_complete(*link,
+                            gatt_event_query_complete_get_att_status(packet));
     break;
 
-  case GATT_EVENT_NOTIFICATION: {
-    uint16_t value_len = gatt_event_notification_get_value_length(packet);
-    const uint8_t *value = gatt_event_notification_get_value(packet);
-
-    printf("Notification! Len: %d. Data: ", value_len);
-    for (int i = 0; i < value_len && i < 10; i++)
-      printf("%02x ", value[i]);
-    printf("\n");
-
-    if (value_len >= 4) {
-      int16_t power = (int16_t)(value[2] | (value[3] << 8));
-      // printf("Parsed Power: %d\n", power);
-      if (power_callback) {
-        power_callback((uint16_t)power);
-      }
-    }
-    // Update Watchdog
-    if (instance) {
-      instance->last_notification_ms = to_ms_since_boot(get_absolute_time());
-    }
+  case GATT_EVENT_NOTIFICATION:
+    link = find_link(gatt_event_notification_get_handle(packet));
+    if (link)
+      handle_notification(*link, packet);
     break;
   }
-  }
 }
 
+// Last-resort watchdog: the cadence-based stall detection handles failover,
+// this forces a reconnect of a link that has been silent for too long.
 void BLEClient::check_watchdog() {
-  if (!connected)
-    return;
-
   uint32_t now = to_ms_since_boot(get_absolute_time());
-  if (now - last_notification_ms > 5000) {
-    printf("[Watchdog] No notifications for 5s. Forcing Disconnect!\n");
-    gap_disconnect(connection_handle);
+  for (Link &link : links) {
+    if (!link.connected)
+      continue;
+    if (now - link.last_notification_ms > BLE_LINK_TIMEOUT_MS) {
+      LOG_WARN("[Watchdog] No notifications for %lu ms. Forcing Disconnect!\n",
+               BLE_LINK_TIMEOUT_MS);
+      gap_disconnect(link.handle);
+    }
   }
 }
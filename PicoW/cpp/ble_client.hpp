@@ -2,13 +2,55 @@
 
 #include "btstack.h"
 #include "config.h"
+#include "link_stats.hpp"
+#include "scan_cache.hpp"
 #include "pico/stdlib.h"
 #include <functional>
 
 // Callback type for power updates
 using PowerCallback = std::function<void(uint16_t)>;
-// Callback type for scan results (MAC, Name)
-using ScanCallback = std::function<void(const char *, const char *)>;
+// Callback type for scan results (MAC, Name, RSSI). Only invoked on first
+// sighting of an advertiser or a significant RSSI change.
+using ScanCallback = std::function<void(const char *, const char *, int8_t)>;
+
+// Callback type for raw power measurement notifications (value, length,
+// reception time in us)
+using NotificationCallback =
+    std::function<void(const uint8_t *, uint16_t, uint64_t)>;
+
+// Negotiated link parameters and notification timing relative to the
+// connection event grid
+struct BLELinkInfo {
+  uint16_t conn_interval;       // Units of 1.25 ms
+  uint16_t conn_latency;        // Connection events
+  uint16_t supervision_timeout; // Units of 10 ms
+  uint16_t max_tx_octets;
+  uint16_t max_rx_octets;
+  uint8_t tx_phy; // 1 = 1M, 2 = 2M, 3 = Coded
+  uint8_t rx_phy;
+
+  uint32_t notification_count;
+  uint32_t last_gap_events;  // Connection events between last two notifications
+  uint32_t max_gap_events;
+  uint32_t max_phase_jitter_us; // Deviation from the connection event grid
+};
+
+// Switchovers between the primary and standby power source. An outage runs
+// from the last notification of the failed link to the first notification
+// delivered from the link that took over.
+struct FailoverStats {
+  uint32_t failovers;
+  uint32_t failbacks;
+  uint32_t last_outage_ms;
+  uint32_t max_outage_ms;
+  uint32_t total_outage_ms;
+};
+
+// Power source links: the trainer and an optional hot-standby source
+// (BLE_STANDBY_NAME), e.g. a pedal power meter
+constexpr size_t BLE_LINK_PRIMARY = 0;
+constexpr size_t BLE_LINK_STANDBY = 1;
+constexpr size_t BLE_MAX_LINKS = 2;
 
 class BLEClient {
 public:
@@ -16,26 +58,26 @@ public:
   void init();
   void set_power_callback(PowerCallback cb);
   void set_scan_callback(ScanCallback cb);
+  void set_notification_callback(NotificationCallback cb);
   bool is_connected();
+  size_t get_active_link() const { return active_link; }
+  const BLELinkInfo &get_link_info(size_t link = BLE_LINK_PRIMARY) const {
+    return links[link].link_info;
+  }
+  const LinkStats &get_link_stats(size_t link = BLE_LINK_PRIMARY) const {
+    return links[link].stats;
+  }
+  const FailoverStats &get_failover_stats() const { return failover_stats; }
+  void print_link_info();
 
   // Internal use (public so C-style callbacks can reach them)
   void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet,
                       uint16_t size);
   void check_watchdog();
+  void on_connect_timeout();
+  void on_stall_timeout(size_t index);
 
 private:
-  PowerCallback power_callback;
-  ScanCallback scan_callback;
-  bool connected;
-  hci_con_handle_t connection_handle;
-  uint32_t last_notification_ms;
-
-  // GATT Handles
-  gatt_client_service_t service;
-  gatt_client_characteristic_t characteristic;
-  gatt_client_notification_t notification_registration;
-  btstack_packet_callback_registration_t hci_event_callback_registration;
-
   enum class DiscoveryState {
     IDLE,
     DISCOVERING_SERVICES,
@@ -43,5 +85,92 @@ private:
     SUBSCRIBING,
     SUBSCRIBED
   };
-  DiscoveryState discovery_state = DiscoveryState::IDLE;
+
+  struct Link {
+    const std::string *target_name;
+    uint32_t tlv_tag;
+    bool enabled;
+    bool connected;
+    hci_con_handle_t handle;
+    DiscoveryState discovery_state;
+    uint32_t connect_start_ms;
+
+    // GATT Handles
+    gatt_client_service_t service;
+    gatt_client_characteristic_t characteristic;
+    gatt_client_notification_t notification_registration;
+
+    // Last connected device (persisted in flash via BTstack TLV)
+    bool have_known_device;
+    bd_addr_t known_addr;
+    bd_addr_type_t known_addr_type;
+    // Address last seen advertising the target name while scanning
+    bool have_seen_addr;
+    bd_addr_t seen_addr;
+
+    // Notification cadence and stall detection
+    uint32_t last_notification_ms;
+    uint32_t cadence_ms; // Smoothed notification inter-arrival time
+    bool stalled;
+    uint8_t healthy_streak;
+    btstack_timer_source_t stall_timer;
+
+    BLELinkInfo link_info;
+    LinkStats stats;
+    uint64_t last_notification_us;
+    uint64_t notification_anchor_us;
+  };
+
+  void start_connecting();
+  void start_scan();
+  void load_known_device(Link &link);
+  void store_known_device(Link &link, const bd_addr_t addr,
+                          bd_addr_type_t addr_type);
+  void report_connect_time(Link &link);
+  static bool is_link_address(const Link &link, const bd_addr_t addr);
+  void connect_scanned(Link &link, uint8_t *packet);
+  void handle_advertising_report(uint8_t *packet);
+  void handle_connection_complete(uint8_t *packet);
+  void handle_disconnection(Link &link);
+  void handle_le_meta(uint8_t *packet);
+  void handle_query_complete(Link &link, uint8_t att_status);
+  void handle_notification(Link &link, uint8_t *packet);
+  void request_low_latency_link(Link &link);
+  void update_notification_timing(Link &link, uint64_t now_us);
+  void arm_stall_timer(Link &link);
+  uint32_t stall_threshold_ms(const Link &link) const;
+  void switch_active(size_t index, bool failure);
+  Link *find_link(hci_con_handle_t handle);
+  size_t link_index(const Link &link) const { return &link - links; }
+
+  PowerCallback power_callback;
+  ScanCallback scan_callback;
+  NotificationCallback notification_callback;
+  btstack_packet_callback_registration_t hci_event_callback_registration;
+
+  Link links[BLE_MAX_LINKS];
+  size_t active_link;
+  FailoverStats failover_stats;
+  uint32_t outage_start_ms; // Non-zero while an outage is being measured
+
+  // Reconnect path tracking
+  enum class ConnectPath { NONE, DIRECT, SCAN };
+  ConnectPath connect_path;
+  int scan_connect_link; // Link targeted by a gap_connect from the scan
+  bool cancel_pending; // Direct connect cancelled, its failure not yet seen
+  bool scan_passive;   // Running scan matches links by address
+  bool passive_missed; // A passive scan timed out: active until connected
+  // Direct connect, scan gap_connect or passive scan
+  btstack_timer_source_t connect_timer;
+
+  struct ConnectStats {
+    uint32_t count;
+    uint32_t total_ms;
+    uint32_t last_ms;
+  };
+  ConnectStats direct_stats;
+  ConnectStats scan_stats;
+
+  ScanCache scan_cache;
+  bd_addr_t power_adv_addr; // Last advertiser listing a power service
 };
@@ -5,6 +5,7 @@
 #define PROVISIONING_DATA_CODELIST_SUPPORT
 #define ENABLE_LE_PERIPHERAL
 #define ENABLE_LE_CENTRAL
+#define ENABLE_LE_DATA_LENGTH_EXTENSION
 #define ENABLE_LOG_INFO
 #define ENABLE_LOG_ERROR
 #define ENABLE_PRINTF_HEXDUMP
@@ -17,9 +18,9 @@
 
 // Memory configuration
 #define HCI_ACL_PAYLOAD_SIZE (255 + 4)
-#define MAX_NR_HCI_CONNECTIONS 1
-#define MAX_NR_GATT_CLIENTS 1
-#define MAX_NR_WHITELIST_ENTRIES 1
+#define MAX_NR_HCI_CONNECTIONS 3 // Trainer + standby source + relay client
+#define MAX_NR_GATT_CLIENTS 2
+#define MAX_NR_WHITELIST_ENTRIES 2
 #define MAX_NR_SM_LOOKUP_ENTRIES 3
 #define MAX_NR_L2CAP_SERVICES 0
 #define MAX_NR_L2CAP_CHANNELS 0
@@ -29,7 +30,7 @@
 #define MAX_NR_BNEP_SERVICES 0
 #define MAX_NR_BNEP_CHANNELS 0
 #define MAX_NR_HFP_CONNECTIONS 0
-#define MAX_NR_LE_DEVICE_DB_ENTRIES 1
+#define MAX_NR_LE_DEVICE_DB_ENTRIES 2
 #define NVM_NUM_DEVICE_DB_ENTRIES 16
 
 #endif // BTSTACK_CONFIG_H
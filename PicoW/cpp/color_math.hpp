@@ -0,0 +1,66 @@
+#pragma once
+
+#include "config.h"
+#include <cstdint>
+
+// Per-sample arithmetic in integers only. The RP2040's Cortex-M0+ has no FPU,
+// so every float operation is a soft-float library call.
+
+// Power as a whole percentage of FTP, rounded down. The zone bounds are whole
+// percentages, so comparing this against them is exact.
+constexpr uint32_t ftp_percent(uint16_t power, uint16_t ftp) {
+  return ftp ? (uint32_t)power * 100 / ftp : 0;
+}
+
+// Hue API colour: hue 0-65535, sat 0-254, bri 0-254
+struct HueHsb {
+  uint16_t hue;
+  uint8_t sat;
+  uint8_t bri;
+};
+
+// RGB to HSV scaled to the Hue API ranges. Within one unit of the float
+// formula it replaces for every RGB value, since that one's rounding errors
+// are gone; identical for the zone colours (checked below, and against the
+// float code in host/tests/test_color_math.cpp).
+constexpr HueHsb rgb_to_hsb(Color color) {
+  uint32_t r = color.r, g = color.g, b = color.b;
+  uint32_t max = r > g ? (r > b ? r : b) : (g > b ? g : b);
+  uint32_t min = r < g ? (r < b ? r : b) : (g < b ? g : b);
+  uint32_t delta = max - min;
+
+  // Hue in units of delta / 6 of a full turn, in [0, 6 * delta)
+  uint32_t hue = 0;
+  if (delta == 0)
+    hue = 0;
+  else if (max == r)
+    hue = (g >= b) ? g - b : 6 * delta - (b - g);
+  else if (max == g)
+    hue = 2 * delta + b - r;
+  else
+    hue = 4 * delta + r - g;
+
+  HueHsb out = {0, 0, 0};
+  out.hue = delta ? (uint16_t)(hue * 65535 / (6 * delta)) : 0;
+  out.sat = max ? (uint8_t)(delta * 254 / max) : 0;
+  out.bri = (uint8_t)(max * 254 / 255);
+  return out;
+}
+
+// Zone colours, with the results of the float code
+constexpr bool same_hsb(HueHsb a, HueHsb b) {
+  return a.hue == b.hue && a.sat == b.sat && a.bri == b.bri;
+}
+static_assert(same_hsb(rgb_to_hsb({255, 255, 255}), {0, 0, 254}), "white");
+static_assert(same_hsb(rgb_to_hsb({0, 0, 255}), {43690, 254, 254}), "blue");
+static_assert(same_hsb(rgb_to_hsb({0, 255, 0}), {21845, 254, 254}), "green");
+static_assert(same_hsb(rgb_to_hsb({255, 255, 0}), {10922, 254, 254}),
+              "yellow");
+static_assert(same_hsb(rgb_to_hsb({255, 165, 0}), {7067, 254, 254}),
+              "orange");
+static_assert(same_hsb(rgb_to_hsb({255, 0, 0}), {0, 254, 254}), "red");
+static_assert(same_hsb(rgb_to_hsb({0, 0, 0}), {0, 0, 0}), "black");
+static_assert(same_hsb(rgb_to_hsb({255, 0, 128}), {60052, 254, 254}),
+              "negative hue wraps");
+static_assert(ftp_percent(136, 227) == 59 && ftp_percent(137, 227) == 60,
+              "zone 1/2 bound at FTP 227");
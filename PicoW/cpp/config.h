@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <string>
 #include <vector>
@@ -32,6 +33,91 @@ constexpr uint PIN_LED_B = 8;
 
 // Bluetooth Configuration
 const std::string BLE_TARGET_NAME = "KICKR CORE 5D21";
+// Optional hot-standby power source (e.g. pedal power meter or second
+// trainer) kept connected for failover. Empty to disable.
+const std::string BLE_STANDBY_NAME = "";
+
+// Stall detection: a link is stalled when no notification arrived within
+// BLE_STALL_FACTOR_PCT of its measured cadence (never below BLE_STALL_MIN_MS)
+constexpr uint32_t BLE_STALL_FACTOR_PCT = 250;
+constexpr uint32_t BLE_STALL_MIN_MS = 500;
+constexpr uint32_t BLE_STALL_DEFAULT_MS = 2000; // Until the cadence is known
+// Healthy notifications needed before handing back to the primary source
+constexpr uint8_t BLE_FAILBACK_NOTIFICATIONS = 3;
+// A link silent for this long is disconnected and reconnected
+constexpr uint32_t BLE_LINK_TIMEOUT_MS = 5000;
+
+// Notification statistics: an inter-arrival above this share of the nominal
+// period counts as a gap. Shorter intervals are not used for the period.
+constexpr uint32_t LINK_STATS_GAP_FACTOR_PCT = 150;
+constexpr uint32_t LINK_STATS_MIN_PERIOD_MS = 20;
+
+// Direct (whitelist) connect to the last known trainer before falling back to
+// a name scan
+constexpr uint32_t BLE_DIRECT_CONNECT_TIMEOUT_MS = 3000;
+// A connect to a device found by the scan is cancelled and the scan restarted
+// after this long
+constexpr uint32_t BLE_SCAN_CONNECT_TIMEOUT_MS = 5000;
+
+// Connection parameters requested for the power link (units of 1.25 ms for
+// intervals, 10 ms for supervision timeout). A short interval cuts the delay
+// between a trainer notification being ready and it reaching us.
+constexpr uint16_t BLE_CONN_INTERVAL_MIN = 12; // 15 ms
+constexpr uint16_t BLE_CONN_INTERVAL_MAX = 24; // 30 ms
+constexpr uint16_t BLE_CONN_LATENCY = 0;
+constexpr uint16_t BLE_SUPERVISION_TIMEOUT = 400; // 4 s
+constexpr bool BLE_PREFER_2M_PHY = true;
+
+// Scan duty cycle (units of 0.625 ms). Keeping the window below the interval
+// leaves radio time for Wi-Fi on the shared CYW43.
+constexpr uint16_t BLE_SCAN_INTERVAL = 0x0060; // 60 ms
+constexpr uint16_t BLE_SCAN_WINDOW = 0x0030;   // 30 ms (50 % duty)
+// Only consider advertisers listing Cycling Power (0x1818) or Fitness Machine
+// (0x1826) in their advertising data
+constexpr bool BLE_SCAN_FILTER_POWER_SERVICE = true;
+// Passive scanning skips scan requests. It is used once the address of every
+// missing trainer is known (stored from the last connection, or seen with its
+// name in an earlier scan), matching by address, since names often only come
+// in the scan response. If a passive scan finds nothing within the timeout,
+// scanning is active again until the next connection.
+constexpr bool BLE_SCAN_PASSIVE = true;
+constexpr uint32_t BLE_PASSIVE_SCAN_TIMEOUT_MS = 30000;
+
+// Re-expose the trainer's Cycling Power service as a GATT server so Zwift can
+// connect to the Pico instead of the trainer
+constexpr bool BLE_RELAY_ENABLED = true;
+// Added latency budget for forwarding a notification to the relay client
+constexpr uint32_t BLE_RELAY_LATENCY_TARGET_US = 2000;
+
+// Scan result reporting: an advertiser already seen is only reported again if
+// its RSSI moved by this much or it disappeared for a while
+constexpr int SCAN_RSSI_REPORT_DELTA = 10;      // dB
+constexpr uint32_t SCAN_REAPPEAR_MS = 30000;
+
+// Power smoothing (Smoother), switched at runtime with 'f' over USB
+enum class SmoothingMode : uint8_t { WINDOW, EMA, MEDIAN, COUNT };
+constexpr SmoothingMode SMOOTHING_MODE = SmoothingMode::WINDOW;
+constexpr uint32_t SMOOTHING_WINDOW_MS = 3000; // Zwift-style 3 s average
+constexpr uint32_t SMOOTHING_EMA_TAU_MS = 1000;
+constexpr size_t SMOOTHING_MEDIAN_N = 5;
+
+// Zone change prediction for the Hue lights, which react well after the
+// strip: a crossing the recent power trend reaches within the lead time is
+// sent early. 0 disables.
+constexpr uint32_t ZONE_PREDICT_LEAD_MS = 700;
+// Only trends at least this steep (W/s) and this straight (R^2 of the fit)
+constexpr int32_t ZONE_PREDICT_MIN_SLOPE_WPS = 15;
+constexpr uint32_t ZONE_PREDICT_MIN_R2_PCT = 80;
+// Fits over samples spread further than this are skipped
+constexpr uint32_t ZONE_PREDICT_MAX_SPAN_MS = 10000;
+// A predicted zone not reached within this many lead times is a false
+// positive and the lights fall back to the current zone
+constexpr uint32_t ZONE_PREDICT_HOLD_FACTOR = 2;
+
+// Presentation delay: hold back the strip and onboard LED by the Hue lights'
+// measured lag so the whole room changes together (toggle with 'a' over USB)
+constexpr bool OUTPUT_ALIGN_ENABLED = false;
+constexpr uint32_t OUTPUT_ALIGN_MAX_DELAY_MS = 1500;
 
 // Rider Configuration
 constexpr uint16_t DEFAULT_FTP = 227;
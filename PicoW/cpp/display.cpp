@@ -472,12 +472,26 @@ void Display::update_status(bool connected, bool wifi_connected, uint16_t power,
   update(); // <--- FLUSH TO SCREEN
 }
 
+// Lines are only copied into the ring here; drawing and the SPI flush are
+// rate limited by render_logs_if_due()
 void Display::add_log_line(const char *msg) {
-  if (log_lines.size() >= MAX_LOG_LINES) {
-    log_lines.erase(log_lines.begin());
+  size_t slot = (log_head + log_count) % MAX_LOG_LINES;
+  if (log_count == MAX_LOG_LINES) {
+    log_head = (log_head + 1) % MAX_LOG_LINES;
+  } else {
+    log_count++;
   }
-  log_lines.push_back(std::string(msg));
+  snprintf(log_lines[slot], LOG_LINE_LEN, "%s", msg);
+  logs_dirty = true;
+}
+
+void Display::render_logs_if_due(uint32_t now_ms) {
+  if (!logs_dirty || now_ms - last_log_render_ms < LOG_RENDER_INTERVAL_MS)
+    return;
+  last_log_render_ms = now_ms;
+  logs_dirty = false;
   draw_logs();
+  update();
 }
 
 void Display::draw_logs() {
@@ -485,8 +499,9 @@ void Display::draw_logs() {
   // clear log area (y=55 to bottom)
   fill_rect(0, start_y, DISPLAY_WIDTH, DISPLAY_HEIGHT - start_y, {0, 0, 0});
 
-  for (size_t i = 0; i < log_lines.size(); i++) {
-    text(log_lines[i].c_str(), 5, start_y + (i * 10), {200, 200, 200}, 1);
+  for (size_t i = 0; i < log_count; i++) {
+    text(log_lines[(log_head + i) % MAX_LOG_LINES], 5, start_y + (i * 10),
+         {200, 200, 200}, 1);
   }
   // Note: draw_logs is usually called inside update_status when !connected,
   // so update() will be called there. If called linearly (e.g. init),
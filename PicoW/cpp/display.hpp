@@ -5,8 +5,6 @@
 #include "pico/stdlib.h"
 
 #include <deque>
-#include <string>
-#include <vector>
 
 class Display {
 public:
@@ -20,6 +18,7 @@ public:
                      bool hue_enabled, bool hue_reachable);
   void add_log_line(const char *msg);
   void draw_logs();
+  void render_logs_if_due(uint32_t now_ms);
   void set_led(Color color);
 
   // Basic drawing primitives
@@ -40,8 +39,15 @@ private:
   void draw_icon(const uint8_t *bitmap, uint8_t width, uint8_t height,
                  uint16_t x, uint16_t y, Color color, uint8_t scale);
 
-  std::vector<std::string> log_lines;
-  const size_t MAX_LOG_LINES = 5;
+  // Fixed-size ring of log lines (oldest at log_head)
+  static constexpr size_t MAX_LOG_LINES = 5;
+  static constexpr size_t LOG_LINE_LEN = 40; // 240px / 6px per char
+  static constexpr uint32_t LOG_RENDER_INTERVAL_MS = 500;
+  char log_lines[MAX_LOG_LINES][LOG_LINE_LEN];
+  size_t log_head = 0;
+  size_t log_count = 0;
+  bool logs_dirty = false;
+  uint32_t last_log_render_ms = 0;
   std::deque<uint16_t> power_history;
 
   uint16_t *framebuffer;
@@ -0,0 +1,136 @@
+#include "hci_capture.hpp"
+#include "btstack.h"
+#include "pico/stdlib.h"
+#include <cstdio>
+#include <cstring>
+
+#if HCI_CAPTURE
+
+// btsnoop record header: original length, included length, flags, cumulative
+// drops, timestamp (all big endian)
+static const size_t RECORD_HEADER_SIZE = 24;
+// Datalink 1002 = HCI UART (H4), i.e. each record starts with the packet type
+static const uint32_t BTSNOOP_DATALINK_H4 = 1002;
+// Microseconds between 0000-01-01 and 1970-01-01 as used by btsnoop
+static const uint64_t BTSNOOP_EPOCH_DELTA_US = 0x00dcddb30f2f8000ULL;
+
+static uint8_t ring[HCI_CAPTURE_SIZE];
+static size_t ring_tail = 0; // Oldest record
+static size_t ring_used = 0;
+static uint32_t dropped_records = 0;
+
+static void ring_write(const uint8_t *data, size_t len) {
+  size_t head = (ring_tail + ring_used) % HCI_CAPTURE_SIZE;
+  for (size_t i = 0; i < len; i++) {
+    ring[head] = data[i];
+    head = (head + 1) % HCI_CAPTURE_SIZE;
+  }
+  ring_used += len;
+}
+
+static uint32_t ring_read_be32(size_t offset) {
+  uint32_t value = 0;
+  for (size_t i = 0; i < 4; i++) {
+    value = (value << 8) | ring[(ring_tail + offset + i) % HCI_CAPTURE_SIZE];
+  }
+  return value;
+}
+
+static void drop_oldest_record() {
+  // Included length lives at offset 4 of the record header
+  size_t record_size = RECORD_HEADER_SIZE + ring_read_be32(4);
+  ring_tail = (ring_tail + record_size) % HCI_CAPTURE_SIZE;
+  ring_used -= record_size;
+  dropped_records++;
+}
+
+static void capture_reset(void) {
+  ring_tail = 0;
+  ring_used = 0;
+  dropped_records = 0;
+}
+
+static void capture_log_packet(uint8_t packet_type, uint8_t in,
+                               uint8_t *packet, uint16_t len) {
+  uint32_t record_len = len + 1; // H4 packet type byte
+  size_t record_size = RECORD_HEADER_SIZE + record_len;
+  if (record_size > HCI_CAPTURE_SIZE)
+    return;
+  while (ring_used + record_size > HCI_CAPTURE_SIZE)
+    drop_oldest_record();
+
+  // Flags: bit 0 = received, bit 1 = command/event (vs. data)
+  uint32_t flags = in ? 1 : 0;
+  if (packet_type == HCI_COMMAND_DATA_PACKET ||
+      packet_type == HCI_EVENT_PACKET)
+    flags |= 2;
+
+  uint64_t ts = time_us_64() + BTSNOOP_EPOCH_DELTA_US;
+  uint8_t header[RECORD_HEADER_SIZE];
+  big_endian_store_32(header, 0, record_len);
+  big_endian_store_32(header, 4, record_len);
+  big_endian_store_32(header, 8, flags);
+  big_endian_store_32(header, 12, dropped_records);
+  big_endian_store_32(header, 16, (uint32_t)(ts >> 32));
+  big_endian_store_32(header, 20, (uint32_t)ts);
+
+  ring_write(header, sizeof(header));
+  ring_write(&packet_type, 1);
+  ring_write(packet, len);
+}
+
+static void capture_log_message(int log_level, const char *format,
+                                va_list argptr) {
+  // BTstack log messages are not part of the packet capture
+  (void)log_level;
+  (void)format;
+  (void)argptr;
+}
+
+static const hci_dump_t capture_impl = {
+    &capture_reset,
+    &capture_log_packet,
+    &capture_log_message,
+};
+
+static void export_bytes(const uint8_t *data, size_t len, size_t &column) {
+  for (size_t i = 0; i < len; i++) {
+    printf("%02x", data[i]);
+    if (++column == 32) {
+      printf("\n");
+      column = 0;
+    }
+  }
+}
+
+void hci_capture_init() {
+  hci_dump_init(&capture_impl);
+  printf("[Capture] HCI capture enabled (%u bytes)\n",
+         (unsigned)HCI_CAPTURE_SIZE);
+}
+
+void hci_capture_export() {
+  uint8_t file_header[16];
+  memcpy(file_header, "btsnoop\0", 8);
+  big_endian_store_32(file_header, 8, 1); // Version
+  big_endian_store_32(file_header, 12, BTSNOOP_DATALINK_H4);
+
+  printf("----- BEGIN BTSNOOP (%u bytes, %lu dropped) -----\n",
+         (unsigned)(sizeof(file_header) + ring_used),
+         (unsigned long)dropped_records);
+  size_t column = 0;
+  export_bytes(file_header, sizeof(file_header), column);
+  for (size_t i = 0; i < ring_used; i++) {
+    export_bytes(&ring[(ring_tail + i) % HCI_CAPTURE_SIZE], 1, column);
+  }
+  if (column)
+    printf("\n");
+  printf("----- END BTSNOOP -----\n");
+}
+
+#else
+
+void hci_capture_init() {}
+void hci_capture_export() { printf("[Capture] Built without HCI_CAPTURE\n"); }
+
+#endif
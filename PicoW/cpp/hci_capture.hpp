@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// On-device HCI capture in btsnoop format (enable with -DHCI_CAPTURE=ON).
+// Packets are recorded through BTstack's hci_dump hook into a RAM ring; the
+// oldest records are dropped when it fills. hci_capture_export() writes the
+// capture as a hex-encoded btsnoop file over USB stdio, which can be turned
+// back into a file with:
+//   sed -n '/BEGIN BTSNOOP/,/END BTSNOOP/p' log.txt | sed '1d;$d' |
+//     xxd -r -p > capture.btsnoop
+#ifndef HCI_CAPTURE
+#define HCI_CAPTURE 0
+#endif
+
+constexpr size_t HCI_CAPTURE_SIZE = 16 * 1024;
+
+void hci_capture_init();
+void hci_capture_export();
@@ -0,0 +1,89 @@
+#include "ble_replay.hpp"
+#include "btstack.h"
+#include "host_btstack.hpp"
+#include "host_platform.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+static const uint32_t BTSNOOP_DATALINK_H4 = 1002;
+static const size_t FILE_HEADER_SIZE = 16;
+static const size_t RECORD_HEADER_SIZE = 24;
+
+static uint32_t read_be32(const uint8_t *p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 |
+         p[3];
+}
+
+bool btsnoop_read(const char *path, std::vector<BtsnoopRecord> &records) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    printf("[Replay] Cannot open %s\n", path);
+    return false;
+  }
+  uint8_t header[RECORD_HEADER_SIZE];
+  bool ok = fread(header, 1, FILE_HEADER_SIZE, f) == FILE_HEADER_SIZE &&
+            memcmp(header, "btsnoop\0", 8) == 0 &&
+            read_be32(&header[12]) == BTSNOOP_DATALINK_H4;
+  if (!ok)
+    printf("[Replay] %s is not an H4 btsnoop file\n", path);
+
+  uint64_t first_ts = 0;
+  while (ok && fread(header, 1, RECORD_HEADER_SIZE, f) == RECORD_HEADER_SIZE) {
+    uint32_t len = read_be32(&header[4]);
+    uint32_t flags = read_be32(&header[8]);
+    uint64_t ts = (uint64_t)read_be32(&header[16]) << 32 | read_be32(&header[20]);
+    std::vector<uint8_t> data(len);
+    if (len == 0 || len > 0x10000 || fread(data.data(), 1, len, f) != len) {
+      printf("[Replay] Truncated record %d\n", (int)records.size());
+      ok = false;
+      break;
+    }
+    if (records.empty())
+      first_ts = ts;
+    BtsnoopRecord record;
+    record.us = ts - first_ts;
+    record.packet_type = data[0];
+    record.received = flags & 1;
+    record.packet.assign(data.begin() + 1, data.end());
+    records.push_back(std::move(record));
+  }
+  fclose(f);
+  return ok;
+}
+
+ReplayStats ble_replay(const std::vector<BtsnoopRecord> &records,
+                       double speed) {
+  ReplayStats stats;
+  memset(&stats, 0, sizeof(stats));
+  auto wall_start = std::chrono::steady_clock::now();
+  for (const BtsnoopRecord &record : records) {
+    if (speed > 0)
+      std::this_thread::sleep_until(
+          wall_start + std::chrono::microseconds((uint64_t)(record.us / speed)));
+    host_clock_advance_to(REPLAY_START_US + record.us);
+    if (!record.received)
+      continue;
+
+    auto start = std::chrono::steady_clock::now();
+    host_btstack_receive(record.packet_type, record.packet.data(),
+                         (uint16_t)record.packet.size());
+    uint64_t ns = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+    stats.packets++;
+    if (record.packet_type == HCI_EVENT_PACKET) {
+      stats.events++;
+      stats.event_ns_total += ns;
+      if (ns > stats.event_ns_max)
+        stats.event_ns_max = ns;
+    } else if (record.packet_type == HCI_ACL_DATA_PACKET) {
+      stats.acl++;
+      stats.acl_ns_total += ns;
+      if (ns > stats.acl_ns_max)
+        stats.acl_ns_max = ns;
+    }
+  }
+  return stats;
+}
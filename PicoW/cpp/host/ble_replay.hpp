@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Replays a btsnoop capture (H4 datalink, as exported by hci_capture) into
+// the firmware's BLEClient through the host BTstack stand-in. Packets the
+// controller sent are passed up the stack; packets the host sent are only
+// part of the timeline. The manual clock follows the capture timestamps, so
+// the firmware sees the original timing whatever the replay speed.
+struct BtsnoopRecord {
+  uint64_t us; // Since the first record
+  uint8_t packet_type;
+  bool received;
+  std::vector<uint8_t> packet; // Without the H4 type byte
+};
+
+bool btsnoop_read(const char *path, std::vector<BtsnoopRecord> &records);
+
+// CPU time spent in the stack and BLEClient per received packet
+struct ReplayStats {
+  uint32_t packets;
+  uint32_t events;
+  uint32_t acl;
+  uint64_t event_ns_total;
+  uint64_t event_ns_max;
+  uint64_t acl_ns_total;
+  uint64_t acl_ns_max;
+};
+
+// Clock time of the first record
+constexpr uint64_t REPLAY_START_US = 1000000;
+
+// speed 1 waits as long as the capture did between packets, N waits 1/N of
+// it, 0 does not wait at all
+ReplayStats ble_replay(const std::vector<BtsnoopRecord> &records,
+                       double speed);
@@ -0,0 +1,63 @@
+#include "ble_client.hpp"
+#include "ble_replay.hpp"
+#include "host_platform.hpp"
+#include "log.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Replays a capture taken on the device (see hci_capture.hpp) into BLEClient
+// and reports the CPU time per packet and the link telemetry:
+//   ble_replay [--speed N] capture.btsnoop
+// --speed 1 keeps the original timing, the default 0 does not wait.
+
+static void usage() { printf("Usage: ble_replay [--speed N] capture.btsnoop\n"); }
+
+static unsigned long average(uint64_t total, uint32_t count) {
+  return (unsigned long)(count ? total / count : 0);
+}
+
+int main(int argc, char **argv) {
+  double speed = 0;
+  const char *path = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--speed") && i + 1 < argc) {
+      speed = atof(argv[++i]);
+    } else if (argv[i][0] != '-' && !path) {
+      path = argv[i];
+    } else {
+      usage();
+      return 2;
+    }
+  }
+  if (!path) {
+    usage();
+    return 2;
+  }
+
+  std::vector<BtsnoopRecord> records;
+  if (!btsnoop_read(path, records))
+    return 1;
+  printf("[Replay] %d records, %lu ms\n", (int)records.size(),
+         records.empty() ? 0ul : (unsigned long)(records.back().us / 1000));
+
+  host_clock_set_manual(REPLAY_START_US);
+  BLEClient client;
+  uint32_t power_updates = 0;
+  client.set_power_callback([&](uint16_t) { power_updates++; });
+  client.init();
+  ReplayStats stats = ble_replay(records, speed);
+  client.print_link_info();
+  log_drain(LOG_RING_SIZE);
+
+  printf("[Replay] %lu packets, %lu power updates\n",
+         (unsigned long)stats.packets, (unsigned long)power_updates);
+  printf("[Replay] Events: %lu, avg %lu ns, max %lu ns\n",
+         (unsigned long)stats.events,
+         average(stats.event_ns_total, stats.events),
+         (unsigned long)stats.event_ns_max);
+  printf("[Replay] ACL: %lu, avg %lu ns, max %lu ns\n",
+         (unsigned long)stats.acl, average(stats.acl_ns_total, stats.acl),
+         (unsigned long)stats.acl_ns_max);
+  return 0;
+}
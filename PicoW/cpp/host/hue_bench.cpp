@@ -0,0 +1,333 @@
+#include "color_math.hpp"
+#include "host_platform.hpp"
+#include "hue_client.hpp"
+#include "log.hpp"
+#include "mock_hue_bridge.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// Latency, throughput and recovery of the firmware's Hue client against the
+// mock bridge. Each scenario runs in its own process, with a fresh client
+// and bridge:
+//   hue_bench [--quick] [latency|throughput|faults|recovery ...]
+// The firmware's own telemetry (print_stats) follows each scenario.
+
+static bool quick = false;
+
+static const char USER[] = "benchuser";
+
+struct Update {
+  uint64_t us;
+  Color color;
+};
+
+static bool matches(const std::string &body, Color color) {
+  HueHsb hsb = rgb_to_hsb(color);
+  if (hsb.bri == 0)
+    return body.find("\"on\":false") != std::string::npos;
+  return MockHueBridge::json_int(body, "hue", -1) == hsb.hue &&
+         MockHueBridge::json_int(body, "sat", -1) == hsb.sat &&
+         MockHueBridge::json_int(body, "bri", -1) == hsb.bri;
+}
+
+static bool applied(const MockHueBridge &bridge, const std::string &path,
+                    Color color) {
+  MockHueBridge::LightState state;
+  if (!bridge.get_state(path, state))
+    return false;
+  HueHsb hsb = rgb_to_hsb(color);
+  if (hsb.bri == 0)
+    return !state.on;
+  return state.on && state.hue == hsb.hue && state.sat == hsb.sat &&
+         state.bri == hsb.bri;
+}
+
+static uint32_t percentile(std::vector<uint32_t> v, uint32_t pct) {
+  if (v.empty())
+    return 0;
+  std::sort(v.begin(), v.end());
+  return v[(v.size() - 1) * pct / 100];
+}
+
+// Colours through the zones, one every interval_ms, for duration_ms
+static std::vector<Update> drive(HueClient &client, uint32_t duration_ms,
+                                 uint32_t interval_ms,
+                                 const std::function<void(uint32_t)> &at =
+                                     nullptr) {
+  std::vector<Update> updates;
+  size_t zone = 0;
+  for (uint32_t t = 0; t < duration_ms; t += interval_ms) {
+    if (at)
+      at(t);
+    Color color = POWER_ZONES[zone].color;
+    zone = (zone + 1) % POWER_ZONES.size();
+    updates.push_back({MockHueBridge::now_us(), color});
+    client.update(color);
+    host_run_loop_run_for(interval_ms);
+  }
+  return updates;
+}
+
+// How long colours took to reach the bridge (arrival of the PUT carrying
+// them) and to be acknowledged. A colour replaced before it was sent counts
+// as superseded.
+static void report(const char *name, const MockHueBridge &bridge,
+                   const std::vector<std::string> &paths,
+                   const std::vector<Update> &updates, uint32_t duration_ms) {
+  std::vector<MockHueBridge::Request> requests = bridge.get_requests();
+  std::vector<uint32_t> to_bridge, to_answer;
+  uint32_t superseded = 0, puts = 0, answered = 0, busy = 0, resets = 0;
+  for (const auto &r : requests) {
+    if (r.method != "PUT")
+      continue;
+    puts++;
+    if (r.status == 200)
+      answered++;
+    else if (r.status == 503)
+      busy++;
+    else
+      resets++;
+  }
+  for (const std::string &path : paths) {
+    for (size_t i = 0; i < updates.size(); i++) {
+      uint64_t next_us = i + 1 < updates.size() ? updates[i + 1].us : ~0ull;
+      bool found = false;
+      for (const auto &r : requests) {
+        if (r.path != path || r.arrival_us < updates[i].us ||
+            r.arrival_us >= next_us || !matches(r.body, updates[i].color))
+          continue;
+        found = true;
+        to_bridge.push_back((uint32_t)((r.arrival_us - updates[i].us) / 1000));
+        if (r.status == 200)
+          to_answer.push_back(
+              (uint32_t)((r.answer_us - updates[i].us) / 1000));
+        break;
+      }
+      if (!found)
+        superseded++;
+    }
+  }
+  printf("[Bench] %s: %d colours x %d targets, %lu sent, %lu superseded\n",
+         name, (int)updates.size(), (int)paths.size(),
+         (unsigned long)to_bridge.size(), (unsigned long)superseded);
+  printf("[Bench] %s: to bridge p50 %u ms p95 %u ms max %u ms\n", name,
+         percentile(to_bridge, 50), percentile(to_bridge, 95),
+         percentile(to_bridge, 100));
+  printf("[Bench] %s: acknowledged p50 %u ms p95 %u ms max %u ms\n", name,
+         percentile(to_answer, 50), percentile(to_answer, 95),
+         percentile(to_answer, 100));
+  printf("[Bench] %s: %u PUTs (%u ok, %u busy, %u reset), %u.%u/s\n", name,
+         puts, answered, busy, resets, answered * 1000 / duration_ms,
+         answered * 10000 / duration_ms % 10);
+}
+
+// Runs until the last colour shows on every path. Returns false if it
+// does not within 10 s.
+static bool settle(const char *name, const MockHueBridge &bridge,
+                   const std::vector<std::string> &paths, Color last) {
+  uint64_t start = MockHueBridge::now_us();
+  bool ok = host_run_loop_run_until(
+      [&]() {
+        for (const std::string &path : paths) {
+          if (!applied(bridge, path, last))
+            return false;
+        }
+        return true;
+      },
+      10000);
+  printf("[Bench] %s: %s %u ms after the last colour\n", name,
+         ok ? "settled" : "NOT settled",
+         (unsigned)((MockHueBridge::now_us() - start) / 1000));
+  return ok;
+}
+
+struct Setup {
+  MockHueBridge bridge;
+  HueClient client;
+  std::vector<std::string> paths;
+};
+
+static bool setup(Setup &s, const MockHueBridge::Config &config,
+                  const char *groups, const char *lights) {
+  s.bridge.set_config(config);
+  if (!s.bridge.start())
+    return false;
+  host_tcp_map_port(80, s.bridge.get_port());
+  log_init();
+  HueBridgeConfig bridge = {"127.0.0.1", USER, groups, lights, "", "", ""};
+  s.client.init(bridge);
+  const char *p = lights[0] ? lights : groups;
+  while (*p) {
+    char *end;
+    long id = strtol(p, &end, 10);
+    char path[64];
+    snprintf(path, sizeof(path), lights[0] ? "/api/%s/lights/%ld/state"
+                                           : "/api/%s/groups/%ld/action",
+             USER, id);
+    s.paths.push_back(path);
+    p = (*end == ',') ? end + 1 : end;
+  }
+  // Connected and the probe answered
+  return host_run_loop_run_until([&]() { return s.client.hub_reachable; },
+                                 2000);
+}
+
+// Colours slower than the group rate limit: each is sent at once, so this
+// is the request latency
+static bool bench_latency() {
+  static Setup s;
+  MockHueBridge::Config config;
+  config.latency_ms = 30;
+  config.jitter_ms = 20;
+  if (!setup(s, config, "1", ""))
+    return false;
+  uint32_t duration = quick ? 3300 : 11000;
+  std::vector<Update> updates = drive(s.client, duration, 1100);
+  report("latency", s.bridge, s.paths, updates, duration);
+  bool ok = settle("latency", s.bridge, s.paths, updates.back().color);
+  s.client.print_stats();
+  return ok;
+}
+
+// Three lights and a colour every 50 ms: the rate limiter decides how much
+// gets through, and the latest colour should win
+static bool bench_throughput() {
+  static Setup s;
+  MockHueBridge::Config config;
+  config.latency_ms = 15;
+  config.jitter_ms = 10;
+  if (!setup(s, config, "", "1,2,3"))
+    return false;
+  uint32_t duration = quick ? 3000 : 10000;
+  std::vector<Update> updates = drive(s.client, duration, 50);
+  report("throughput", s.bridge, s.paths, updates, duration);
+  bool ok = settle("throughput", s.bridge, s.paths, updates.back().color);
+  s.client.print_stats();
+  return ok;
+}
+
+// Busy answers and connection resets: retries, backoff and rate adaptation
+static bool bench_faults() {
+  static Setup s;
+  MockHueBridge::Config config;
+  config.latency_ms = 30;
+  config.jitter_ms = 20;
+  config.busy_pct = 10;
+  config.reset_pct = 10;
+  if (!setup(s, config, "", "1,2,3"))
+    return false;
+  uint32_t duration = quick ? 4000 : 15000;
+  std::vector<Update> updates = drive(s.client, duration, 200);
+  report("faults", s.bridge, s.paths, updates, duration);
+  config.busy_pct = 0;
+  config.reset_pct = 0;
+  s.bridge.set_config(config);
+  bool ok = settle("faults", s.bridge, s.paths, updates.back().color);
+  s.client.print_stats();
+  return ok;
+}
+
+// The bridge goes away for a while; time from it coming back to the
+// current colour showing
+static bool bench_recovery() {
+  static Setup s;
+  MockHueBridge::Config config;
+  config.latency_ms = 30;
+  if (!setup(s, config, "1", ""))
+    return false;
+  uint32_t outage_ms = quick ? 2000 : 5000;
+  uint32_t duration = outage_ms + 3000;
+  uint64_t up_us = 0;
+  std::vector<Update> updates =
+      drive(s.client, duration, 500, [&](uint32_t t) {
+        if (t == 1000) {
+          printf("[Bench] recovery: bridge down for %u ms\n", outage_ms);
+          s.bridge.set_down(true);
+        } else if (t == 1000 + outage_ms) {
+          s.bridge.set_down(false);
+          up_us = MockHueBridge::now_us();
+        }
+      });
+  report("recovery", s.bridge, s.paths, updates, duration);
+  bool ok = settle("recovery", s.bridge, s.paths, updates.back().color);
+
+  uint64_t first_us = 0;
+  for (const auto &r : s.bridge.get_requests()) {
+    if (r.status == 200 && r.method == "PUT" && r.arrival_us >= up_us) {
+      first_us = r.answer_us;
+      break;
+    }
+  }
+  if (first_us)
+    printf("[Bench] recovery: first colour acknowledged %u ms after the "
+           "bridge came back\n",
+           (unsigned)((first_us - up_us) / 1000));
+  else
+    ok = false;
+  s.client.print_stats();
+  return ok;
+}
+
+struct Scenario {
+  const char *name;
+  bool (*run)();
+};
+
+static const Scenario SCENARIOS[] = {
+    {"latency", bench_latency},
+    {"throughput", bench_throughput},
+    {"faults", bench_faults},
+    {"recovery", bench_recovery},
+};
+
+static bool run_isolated(const Scenario &scenario) {
+  printf("[Bench] === %s ===\n", scenario.name);
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    bool ok = scenario.run();
+    log_drain(LOG_RING_SIZE);
+    fflush(stdout);
+    _exit(ok ? 0 : 1);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  if (!ok)
+    printf("[Bench] %s FAILED\n", scenario.name);
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  std::vector<const Scenario *> selected;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--quick")) {
+      quick = true;
+      continue;
+    }
+    const Scenario *found = nullptr;
+    for (const Scenario &s : SCENARIOS) {
+      if (!strcmp(argv[i], s.name))
+        found = &s;
+    }
+    if (!found) {
+      printf("Usage: hue_bench [--quick] [latency|throughput|faults|"
+             "recovery ...]\n");
+      return 2;
+    }
+    selected.push_back(found);
+  }
+  if (selected.empty()) {
+    for (const Scenario &s : SCENARIOS)
+      selected.push_back(&s);
+  }
+
+  bool ok = true;
+  for (const Scenario *s : selected)
+    ok = run_isolated(*s) && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,126 @@
+#include "host_platform.hpp"
+#include "hue_client.hpp"
+#include "log.hpp"
+#include "mock_hue_bridge.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// CPU cost of the firmware's update() for a colour that is sent, through the
+// public API against the mock bridge: zone colours (precomputed templates)
+// against colours outside the zone table (formatted per request). The clock
+// is manual and moves on a second before each update, so the rate limiter
+// always has a token and every update sends; socket writes are left to the
+// run loop and the bridge's answer is awaited outside the timed section, so
+// no target is still in flight.
+//   hue_request_bench [--quick]
+// Sanitizer builds (the default) inflate both; configure with
+// -DHOST_SANITIZE=OFF for representative numbers.
+
+static const char USER[] = "benchuser";
+static const uint64_t STEP_US = 1100000; // Above the group rate at start
+
+struct Run {
+  uint64_t ns_per_update; // Median
+  size_t sent;
+};
+
+// One update per colour, each timed on its own. The run loop in between
+// leaves the caches cold, as on the device, and the median keeps scheduling
+// noise out.
+template <typename F>
+static Run run(HueClient &client, MockHueBridge &bridge, uint64_t &clock_us,
+               uint32_t updates, F &&color_of) {
+  bridge.clear();
+  std::vector<uint64_t> ns;
+  for (uint32_t i = 0; i < updates; i++) {
+    clock_us += STEP_US;
+    host_clock_advance_to(clock_us);
+    Color color = color_of(i);
+    auto start = std::chrono::steady_clock::now();
+    client.update(color);
+    ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::steady_clock::now() - start)
+                     .count());
+
+    // Answered, and the answer read, before the next colour. The manual
+    // clock does not move while waiting, so this is bounded by steps.
+    int steps = 0;
+    host_run_loop_run_until(
+        [&]() {
+          std::vector<MockHueBridge::Request> r = bridge.get_requests();
+          return (r.size() > i && r[i].answer_us && ++steps > 2) ||
+                 ++steps > 1000;
+        },
+        1000);
+  }
+  std::sort(ns.begin(), ns.end());
+  return {ns.empty() ? 0 : ns[ns.size() / 2], bridge.get_requests().size()};
+}
+
+int main(int argc, char **argv) {
+  bool quick = argc > 1 && !strcmp(argv[1], "--quick");
+  if (argc > 2 || (argc == 2 && !quick)) {
+    printf("Usage: hue_request_bench [--quick]\n");
+    return 2;
+  }
+  uint32_t updates = quick ? 200 : 5000;
+
+  MockHueBridge bridge;
+  MockHueBridge::Config config;
+  config.latency_ms = 0;
+  bridge.set_config(config);
+  if (!bridge.start()) {
+    printf("[Bench] Mock bridge failed to start\n");
+    return 1;
+  }
+  host_tcp_map_port(80, bridge.get_port());
+  log_init();
+  static HueClient client;
+  HueBridgeConfig hue = {"127.0.0.1", USER, "1", "", "", "", ""};
+  client.init(hue);
+  if (!host_run_loop_run_until([&]() { return client.hub_reachable; },
+                               2000)) {
+    printf("[Bench] Mock bridge not reachable\n");
+    return 1;
+  }
+  uint64_t clock_us = (uint64_t)to_ms_since_boot(get_absolute_time()) * 1000;
+  host_clock_set_manual(clock_us);
+  host_tcp_defer_output(true);
+
+  // The same zones either way; one bit off is no longer a zone colour
+  size_t zones = POWER_ZONES.size();
+  auto zone = [&](uint32_t i) { return POWER_ZONES[i % zones].color; };
+  auto other = [&](uint32_t i) {
+    Color c = POWER_ZONES[i % zones].color;
+    c.r ^= 1;
+    return c;
+  };
+
+  // Warm up, then measure each path over the same zones
+  run(client, bridge, clock_us, updates / 10, zone);
+  run(client, bridge, clock_us, updates / 10, other);
+  Run templated = run(client, bridge, clock_us, updates, zone);
+  Run formatted = run(client, bridge, clock_us, updates, other);
+  log_drain(LOG_RING_SIZE);
+  bridge.stop();
+
+  printf("[Bench] %lu updates over %d zones\n", (unsigned long)updates,
+         (int)zones);
+  printf("[Bench] Formatted per request: %lu ns/update (%lu sent)\n",
+         (unsigned long)formatted.ns_per_update,
+         (unsigned long)formatted.sent);
+  printf("[Bench] Zone templates:        %lu ns/update (%lu sent, %.1fx)\n",
+         (unsigned long)templated.ns_per_update,
+         (unsigned long)templated.sent,
+         templated.ns_per_update
+             ? (double)formatted.ns_per_update / templated.ns_per_update
+             : 0.0);
+  if (formatted.sent != updates || templated.sent != updates) {
+    printf("[Bench] Not every update was sent\n");
+    return 1;
+  }
+  return 0;
+}
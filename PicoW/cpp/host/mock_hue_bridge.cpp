@@ -0,0 +1,385 @@
+#include "mock_hue_bridge.hpp"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+uint64_t MockHueBridge::now_us() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+int MockHueBridge::json_int(const std::string &body, const char *key,
+                            int fallback) {
+  std::string token = std::string("\"") + key + "\":";
+  size_t pos = body.find(token);
+  if (pos == std::string::npos)
+    return fallback;
+  return atoi(body.c_str() + pos + token.size());
+}
+
+static std::string json_string(const std::string &body, const char *key) {
+  std::string token = std::string("\"") + key + "\":\"";
+  size_t pos = body.find(token);
+  if (pos == std::string::npos)
+    return "";
+  size_t start = pos + token.size();
+  size_t end = body.find('"', start);
+  return end == std::string::npos ? "" : body.substr(start, end - start);
+}
+
+static bool ends_with(const std::string &s, const char *suffix) {
+  size_t n = strlen(suffix);
+  return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+bool MockHueBridge::listen_socket() {
+  listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (listen_fd < 0)
+    return false;
+  int one = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  inet_aton(ip.c_str(), &sa.sin_addr);
+  if (bind(listen_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 ||
+      listen(listen_fd, 8) < 0) {
+    printf("[Mock] Cannot listen on %s:%d: %s\n", ip.c_str(), port,
+           strerror(errno));
+    close(listen_fd);
+    listen_fd = -1;
+    return false;
+  }
+  socklen_t len = sizeof(sa);
+  getsockname(listen_fd, (struct sockaddr *)&sa, &len);
+  port = ntohs(sa.sin_port);
+  return true;
+}
+
+bool MockHueBridge::start(const char *ip, uint16_t port) {
+  this->ip = ip;
+  this->port = port;
+  if (!listen_socket())
+    return false;
+  running = true;
+  acceptor = std::thread(&MockHueBridge::accept_loop, this);
+  return true;
+}
+
+void MockHueBridge::stop() {
+  if (!running)
+    return;
+  running = false;
+  acceptor.join();
+  if (listen_fd >= 0)
+    close(listen_fd);
+  listen_fd = -1;
+  std::vector<Connection *> open;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    open.swap(connections);
+  }
+  for (Connection *conn : open) {
+    conn->thread.join(); // Each ends within a poll interval
+    delete conn;
+  }
+}
+
+void MockHueBridge::set_config(const Config &config) {
+  std::lock_guard<std::mutex> lock(mutex);
+  this->config = config;
+}
+
+// Connections notice within one poll interval and reset themselves. The
+// listening socket is closed so connects are refused, as from a bridge that
+// is off.
+void MockHueBridge::set_down(bool down) {
+  this->down = down;
+  std::lock_guard<std::mutex> lock(mutex);
+  if (down && listen_fd >= 0) {
+    close(listen_fd);
+    listen_fd = -1;
+  } else if (!down && listen_fd < 0) {
+    listen_socket();
+  }
+}
+
+std::vector<MockHueBridge::Request> MockHueBridge::get_requests() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return requests;
+}
+
+bool MockHueBridge::get_state(const std::string &path,
+                              LightState &state) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = states.find(path);
+  if (it == states.end())
+    return false;
+  state = it->second;
+  return true;
+}
+
+void MockHueBridge::clear() {
+  std::lock_guard<std::mutex> lock(mutex);
+  requests.clear();
+  states.clear();
+}
+
+void MockHueBridge::accept_loop() {
+  while (running) {
+    int fd;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      fd = listen_fd;
+      // Reap finished connections
+      for (size_t i = 0; i < connections.size();) {
+        if (connections[i]->done) {
+          connections[i]->thread.join();
+          delete connections[i];
+          connections.erase(connections.begin() + i);
+        } else {
+          i++;
+        }
+      }
+    }
+    if (fd < 0) {
+      usleep(10000); // Down
+      continue;
+    }
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, 10) <= 0 || down)
+      continue;
+    int client = accept(fd, nullptr, nullptr);
+    if (client < 0)
+      continue;
+    int one = 1;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    Connection *conn = new Connection();
+    conn->fd = client;
+    std::lock_guard<std::mutex> lock(mutex);
+    connections.push_back(conn);
+    conn->thread = std::thread(&MockHueBridge::serve, this, conn);
+  }
+}
+
+static void reset_socket(int fd) {
+  struct linger lg = {1, 0};
+  setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+  close(fd);
+}
+
+// Bytes received on a connection, with the time each read completed so a
+// pipelined request gets the time it arrived, not the time it was taken up
+struct InputBuffer {
+  std::string data;
+  uint64_t consumed = 0; // Stream offset of data[0]
+  std::vector<std::pair<uint64_t, uint64_t>> reads; // End offset, time
+
+  // False once the peer closed or the read failed
+  bool read(int fd, int timeout_ms) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, timeout_ms) <= 0)
+      return true;
+    char buf[2048];
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n <= 0)
+      return false;
+    data.append(buf, n);
+    reads.push_back({consumed + data.size(), MockHueBridge::now_us()});
+    return true;
+  }
+
+  // Time the first len bytes were all in, then drops them
+  uint64_t take(size_t len) {
+    uint64_t end = consumed + len;
+    uint64_t at = 0;
+    for (const auto &r : reads) {
+      if (r.first >= end) {
+        at = r.second;
+        break;
+      }
+    }
+    data.erase(0, len);
+    consumed = end;
+    while (!reads.empty() && reads.front().first <= consumed)
+      reads.erase(reads.begin());
+    return at;
+  }
+};
+
+// One connection: requests are read and answered strictly in order
+void MockHueBridge::serve(Connection *conn) {
+  InputBuffer in;
+  uint64_t last_activity_us = now_us();
+  bool open = true;
+  while (open && running) {
+    Config cfg;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      cfg = config;
+    }
+    if (down) {
+      reset_socket(conn->fd);
+      conn->done = true;
+      return;
+    }
+
+    // A complete request in the buffer?
+    size_t header_end = in.data.find("\r\n\r\n");
+    size_t length = 0;
+    if (header_end != std::string::npos) {
+      const char *head = in.data.c_str();
+      for (size_t pos = in.data.find("\r\n"); pos < header_end;
+           pos = in.data.find("\r\n", pos + 2)) {
+        if (strncasecmp(head + pos + 2, "content-length:", 15) == 0)
+          length = strtoul(head + pos + 17, nullptr, 10);
+      }
+    }
+    if (header_end == std::string::npos ||
+        in.data.size() < header_end + 4 + length) {
+      if (in.data.empty() && cfg.idle_timeout_ms &&
+          now_us() - last_activity_us > cfg.idle_timeout_ms * 1000ull)
+        break; // Idle: close as the bridge does
+      open = in.read(conn->fd, 10);
+      continue;
+    }
+
+    Request req;
+    std::string head = in.data.substr(0, header_end);
+    size_t sp1 = head.find(' ');
+    size_t sp2 = head.find(' ', sp1 + 1);
+    req.method = head.substr(0, sp1);
+    req.path = head.substr(sp1 + 1, sp2 - sp1 - 1);
+    req.body = in.data.substr(header_end + 4, length);
+    req.arrival_us = in.take(header_end + 4 + length);
+    req.answer_us = 0;
+    if (cfg.log)
+      printf("[Mock] %s %s %s\n", req.method.c_str(), req.path.c_str(),
+             req.body.c_str());
+
+    uint32_t delay_ms = cfg.latency_ms;
+    int roll;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      random_state ^= random_state << 13;
+      random_state ^= random_state >> 17;
+      random_state ^= random_state << 5;
+      if (cfg.jitter_ms)
+        delay_ms += random_state % (cfg.jitter_ms + 1);
+      roll = (int)((random_state >> 8) % 100);
+    }
+    // Processed one at a time: a pipelined request waits for the one before
+    // it, then for its own latency. Later requests keep arriving meanwhile.
+    uint64_t start_us = now_us();
+    if (start_us < req.arrival_us)
+      start_us = req.arrival_us;
+    uint64_t answer_at = start_us + delay_ms * 1000ull;
+    while (running && !down && now_us() < answer_at) {
+      if (!open || !in.read(conn->fd, 1)) {
+        open = false;
+        usleep(1000);
+      }
+    }
+
+    std::string response;
+    if (roll < cfg.reset_pct) {
+      req.status = 0;
+    } else if (roll < cfg.reset_pct + cfg.busy_pct) {
+      req.status = 503;
+      response = "HTTP/1.1 503 Service Unavailable\r\n"
+                 "Content-Length: 0\r\n\r\n";
+    } else {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::string body = answer(req.method, req.path, req.body, req.status);
+      response = "HTTP/1.1 200 OK\r\n"
+                 "Content-Type: application/json\r\n"
+                 "Content-Length: " +
+                 std::to_string(body.size()) + "\r\n\r\n" + body;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      req.answer_us = req.status ? now_us() : 0;
+      requests.push_back(req);
+    }
+    if (req.status == 0) {
+      if (cfg.log)
+        printf("[Mock] Resetting connection\n");
+      reset_socket(conn->fd);
+      conn->done = true;
+      return;
+    }
+    if (send(conn->fd, response.data(), response.size(), MSG_NOSIGNAL) < 0)
+      break;
+    last_activity_us = now_us();
+  }
+  close(conn->fd);
+  conn->done = true;
+}
+
+// Called with the mutex held
+std::string MockHueBridge::answer(const std::string &method,
+                                  const std::string &path,
+                                  const std::string &body, int &status) {
+  status = 200;
+  if (method == "GET" && path == "/api/config")
+    return "{\"name\":\"Mock Hue\",\"swversion\":\"1\",\"apiversion\":"
+           "\"1.0.0\"}";
+
+  // /api/<user>/groups/<id>
+  size_t groups = path.find("/groups/");
+  if (method == "GET" && groups != std::string::npos &&
+      path.find('/', groups + 8) == std::string::npos)
+    return "{\"name\":\"Group " + path.substr(groups + 8) +
+           "\",\"lights\":[\"1\",\"2\",\"3\"],\"type\":\"Room\"}";
+
+  if (method == "POST" && ends_with(path, "/scenes")) {
+    char id[17];
+    snprintf(id, sizeof(id), "mockscene%07u", ++scenes_created);
+    states["scene:" + std::string(id)] = {
+        true, json_int(body, "hue", 0), json_int(body, "sat", 0),
+        json_int(body, "bri", 0), id, 0};
+    return std::string("[{\"success\":{\"id\":\"") + id + "\"}}]";
+  }
+
+  if (method == "PUT" &&
+      (ends_with(path, "/action") || ends_with(path, "/state"))) {
+    LightState &state = states[path];
+    std::string scene = json_string(body, "scene");
+    if (!scene.empty()) {
+      auto it = states.find("scene:" + scene);
+      if (it == states.end())
+        return "[{\"error\":{\"type\":3,\"address\":\"" + path +
+               "/scene\",\"description\":\"resource, " + scene +
+               ", not available\"}}]";
+      uint32_t puts = state.puts;
+      state = it->second;
+      state.puts = puts;
+    } else {
+      state.on = body.find("\"on\":false") == std::string::npos;
+      state.hue = json_int(body, "hue", state.hue);
+      state.sat = json_int(body, "sat", state.sat);
+      state.bri = json_int(body, "bri", state.bri);
+      state.scene.clear();
+    }
+    state.puts++;
+    return "[{\"success\":{\"" + path + "/on\":" +
+           (state.on ? "true" : "false") + "}}]";
+  }
+
+  // Stream activation and anything else the firmware might send
+  if (method == "PUT" && groups != std::string::npos)
+    return "[{\"success\":{\"" + path + "\":true}}]";
+  return "[{\"error\":{\"type\":3,\"address\":\"" + path +
+         "\",\"description\":\"resource not available\"}}]";
+}
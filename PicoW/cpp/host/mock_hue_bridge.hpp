@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Hue bridge stand-in for Linux: a keep-alive HTTP/1.1 server that answers
+// the v1 REST calls the firmware makes, in order per connection (so
+// pipelined requests queue behind each other, as on the bridge). Latency,
+// busy answers, connection resets and outages are configurable. Every
+// request is recorded with its arrival time for benchmarks and tests.
+class MockHueBridge {
+public:
+  struct Config {
+    uint32_t latency_ms = 20; // Before each answer
+    uint32_t jitter_ms = 0;   // Up to this much on top, random
+    uint8_t busy_pct = 0;     // Answered 503
+    uint8_t reset_pct = 0;    // Connection reset instead of an answer
+    uint32_t idle_timeout_ms = 0; // Drop idle connections, 0 never
+    bool log = false;             // Print every request
+  };
+
+  struct Request {
+    uint64_t arrival_us; // steady_clock
+    uint64_t answer_us;  // 0 if reset
+    std::string method;
+    std::string path;
+    std::string body;
+    int status; // 0 if the connection was reset instead
+  };
+
+  // Last light or group state PUT to a path
+  struct LightState {
+    bool on;
+    int hue;
+    int sat;
+    int bri;
+    std::string scene;
+    uint32_t puts;
+  };
+
+  MockHueBridge() = default;
+  ~MockHueBridge() { stop(); }
+
+  // Listens on ip:port (port 0 picks a free one). False if it cannot.
+  bool start(const char *ip = "127.0.0.1", uint16_t port = 0);
+  void stop();
+  uint16_t get_port() const { return port; }
+
+  void set_config(const Config &config);
+  // Down: existing connections are reset and new ones refused
+  void set_down(bool down);
+
+  std::vector<Request> get_requests() const;
+  bool get_state(const std::string &path, LightState &state) const;
+  void clear();
+
+  static uint64_t now_us();
+  // Integer after "key": in a JSON body, or fallback
+  static int json_int(const std::string &body, const char *key,
+                      int fallback);
+
+private:
+  struct Connection {
+    int fd;
+    std::thread thread;
+    std::atomic<bool> done{false};
+  };
+
+  bool listen_socket();
+  void accept_loop();
+  void serve(Connection *conn);
+  // The answer to one request; status 0 resets the connection
+  std::string answer(const std::string &method, const std::string &path,
+                     const std::string &body, int &status);
+
+  std::string ip;
+  uint16_t port = 0;
+  int listen_fd = -1;
+  std::atomic<bool> running{false};
+  std::atomic<bool> down{false};
+  std::thread acceptor;
+
+  mutable std::mutex mutex; // Everything below
+  Config config;
+  std::vector<Connection *> connections;
+  std::vector<Request> requests;
+  std::map<std::string, LightState> states;
+  uint32_t scenes_created = 0;
+  uint32_t random_state = 0x2545f491;
+};
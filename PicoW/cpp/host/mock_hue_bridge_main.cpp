@@ -0,0 +1,73 @@
+#include "mock_hue_bridge.hpp"
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+// Standalone mock bridge, e.g. to point the firmware at a Linux machine:
+//   mock_hue_bridge --port 80 --latency 40 --jitter 20 --busy 5 --reset 2
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int) { stop_requested = 1; }
+
+static void usage() {
+  printf("Usage: mock_hue_bridge [--ip A.B.C.D] [--port N] [--latency MS]\n"
+         "         [--jitter MS] [--busy PCT] [--reset PCT] [--idle MS]"
+         " [--quiet]\n");
+}
+
+int main(int argc, char **argv) {
+  const char *ip = "0.0.0.0";
+  uint16_t port = 80;
+  MockHueBridge::Config config;
+  config.log = true;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!strcmp(arg, "--quiet")) {
+      config.log = false;
+      continue;
+    }
+    if (!value) {
+      usage();
+      return 2;
+    }
+    i++;
+    if (!strcmp(arg, "--ip"))
+      ip = value;
+    else if (!strcmp(arg, "--port"))
+      port = (uint16_t)atoi(value);
+    else if (!strcmp(arg, "--latency"))
+      config.latency_ms = (uint32_t)atoi(value);
+    else if (!strcmp(arg, "--jitter"))
+      config.jitter_ms = (uint32_t)atoi(value);
+    else if (!strcmp(arg, "--busy"))
+      config.busy_pct = (uint8_t)atoi(value);
+    else if (!strcmp(arg, "--reset"))
+      config.reset_pct = (uint8_t)atoi(value);
+    else if (!strcmp(arg, "--idle"))
+      config.idle_timeout_ms = (uint32_t)atoi(value);
+    else {
+      usage();
+      return 2;
+    }
+  }
+
+  setvbuf(stdout, nullptr, _IOLBF, 0); // Log lines as they happen
+  MockHueBridge bridge;
+  bridge.set_config(config);
+  if (!bridge.start(ip, port))
+    return 1;
+  printf("[Mock] Hue bridge on %s:%d (latency %u+%u ms, busy %d%%, reset "
+         "%d%%)\n",
+         ip, bridge.get_port(), config.latency_ms, config.jitter_ms,
+         config.busy_pct, config.reset_pct);
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  while (!stop_requested)
+    usleep(100000);
+  bridge.stop();
+  printf("[Mock] %d requests\n", (int)bridge.get_requests().size());
+  return 0;
+}
@@ -0,0 +1,337 @@
+#pragma once
+
+// Host stand-in for the parts of BTstack the firmware sources use: the run
+// loop, TLV storage (kept in memory) and, for BLEClient, the HCI/GAP/GATT
+// client API. The BLE calls are recorded (host_btstack.hpp); events come from
+// a replayed capture.
+#include "btstack_run_loop.h"
+#include <cstdint>
+
+#define BTSTACK_TAG32(A, B, C, D)                                              \
+  ((uint32_t)(((A) << 24) | ((B) << 16) | ((C) << 8) | (D)))
+
+typedef struct {
+  int (*get_tag)(void *context, uint32_t tag, uint8_t *buffer,
+                 uint32_t buffer_size);
+  int (*store_tag)(void *context, uint32_t tag, const uint8_t *data,
+                   uint32_t data_size);
+  void (*delete_tag)(void *context, uint32_t tag);
+} btstack_tlv_t;
+
+void btstack_tlv_get_instance(const btstack_tlv_t **tlv_impl,
+                              void **tlv_context);
+
+// Packet types (H4) and the event codes BLEClient handles
+
+#define HCI_COMMAND_DATA_PACKET 0x01
+#define HCI_ACL_DATA_PACKET 0x02
+#define HCI_EVENT_PACKET 0x04
+
+#define HCI_EVENT_DISCONNECTION_COMPLETE 0x05
+#define HCI_EVENT_LE_META 0x3e
+#define HCI_SUBEVENT_LE_CONNECTION_COMPLETE 0x01
+#define HCI_SUBEVENT_LE_ADVERTISING_REPORT 0x02
+#define HCI_SUBEVENT_LE_CONNECTION_UPDATE_COMPLETE 0x03
+#define HCI_SUBEVENT_LE_DATA_LENGTH_CHANGE 0x07
+#define HCI_SUBEVENT_LE_PHY_UPDATE_COMPLETE 0x0c
+
+#define BTSTACK_EVENT_STATE 0x60
+#define GATT_EVENT_QUERY_COMPLETE 0xa0
+#define GATT_EVENT_SERVICE_QUERY_RESULT 0xa1
+#define GATT_EVENT_CHARACTERISTIC_QUERY_RESULT 0xa2
+#define GATT_EVENT_NOTIFICATION 0xa7
+#define GAP_EVENT_ADVERTISING_REPORT 0xda
+
+#define HCI_STATE_OFF 0
+#define HCI_STATE_WORKING 2
+#define HCI_POWER_OFF 0
+#define HCI_POWER_ON 1
+
+#define ERROR_CODE_SUCCESS 0x00
+#define ERROR_CODE_COMMAND_DISALLOWED 0x0c
+
+#define HCI_CON_HANDLE_INVALID 0xffff
+#define GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION 1
+
+typedef uint16_t hci_con_handle_t;
+typedef uint8_t bd_addr_t[6];
+typedef enum {
+  BD_ADDR_TYPE_LE_PUBLIC = 0,
+  BD_ADDR_TYPE_LE_RANDOM = 1,
+} bd_addr_type_t;
+
+typedef void (*btstack_packet_handler_t)(uint8_t packet_type, uint16_t channel,
+                                         uint8_t *packet, uint16_t size);
+
+typedef struct btstack_packet_callback_registration {
+  struct btstack_packet_callback_registration *next;
+  btstack_packet_handler_t callback;
+} btstack_packet_callback_registration_t;
+
+typedef struct {
+  uint16_t start_group_handle;
+  uint16_t end_group_handle;
+  uint16_t uuid16;
+  uint8_t uuid128[16];
+} gatt_client_service_t;
+
+typedef struct {
+  uint16_t start_handle;
+  uint16_t value_handle;
+  uint16_t end_handle;
+  uint16_t properties;
+  uint16_t uuid16;
+  uint8_t uuid128[16];
+} gatt_client_characteristic_t;
+
+typedef struct gatt_client_notification {
+  struct gatt_client_notification *next;
+  btstack_packet_handler_t callback;
+  hci_con_handle_t con_handle;
+  uint16_t attribute_handle;
+} gatt_client_notification_t;
+
+// Little endian access and address conversion
+
+inline uint16_t little_endian_read_16(const uint8_t *buffer, int pos) {
+  return (uint16_t)(buffer[pos] | (buffer[pos + 1] << 8));
+}
+inline void little_endian_store_16(uint8_t *buffer, uint16_t pos,
+                                   uint16_t value) {
+  buffer[pos] = (uint8_t)value;
+  buffer[pos + 1] = (uint8_t)(value >> 8);
+}
+// HCI carries addresses and UUIDs least significant byte first
+inline void reverse_bytes(const uint8_t *src, uint8_t *dest, int len) {
+  for (int i = 0; i < len; i++)
+    dest[len - 1 - i] = src[i];
+}
+const char *bd_addr_to_str(const bd_addr_t addr);
+
+// Event accessors, for the layouts BTstack uses
+
+inline uint8_t hci_event_packet_get_type(const uint8_t *event) {
+  return event[0];
+}
+inline uint8_t btstack_event_state_get_state(const uint8_t *event) {
+  return event[2];
+}
+inline uint8_t hci_event_le_meta_get_subevent_code(const uint8_t *event) {
+  return event[2];
+}
+inline hci_con_handle_t
+hci_event_disconnection_complete_get_connection_handle(const uint8_t *event) {
+  return little_endian_read_16(event, 3);
+}
+
+inline uint8_t
+hci_subevent_le_connection_complete_get_status(const uint8_t *event) {
+  return event[3];
+}
+inline hci_con_handle_t
+hci_subevent_le_connection_complete_get_connection_handle(
+    const uint8_t *event) {
+  return little_endian_read_16(event, 4);
+}
+inline uint8_t
+hci_subevent_le_connection_complete_get_role(const uint8_t *event) {
+  return event[6];
+}
+inline uint8_t
+hci_subevent_le_connection_complete_get_peer_address_type(
+    const uint8_t *event) {
+  return event[7];
+}
+inline void
+hci_subevent_le_connection_complete_get_peer_address(const uint8_t *event,
+                                                     bd_addr_t address) {
+  reverse_bytes(&event[8], address, 6);
+}
+inline uint16_t
+hci_subevent_le_connection_complete_get_conn_interval(const uint8_t *event) {
+  return little_endian_read_16(event, 14);
+}
+inline uint16_t
+hci_subevent_le_connection_complete_get_conn_latency(const uint8_t *event) {
+  return little_endian_read_16(event, 16);
+}
+inline uint16_t hci_subevent_le_connection_complete_get_supervision_timeout(
+    const uint8_t *event) {
+  return little_endian_read_16(event, 18);
+}
+
+inline uint8_t
+hci_subevent_le_connection_update_complete_get_status(const uint8_t *event) {
+  return event[3];
+}
+inline hci_con_handle_t
+hci_subevent_le_connection_update_complete_get_connection_handle(
+    const uint8_t *event) {
+  return little_endian_read_16(event, 4);
+}
+inline uint16_t hci_subevent_le_connection_update_complete_get_conn_interval(
+    const uint8_t *event) {
+  return little_endian_read_16(event, 6);
+}
+inline uint16_t hci_subevent_le_connection_update_complete_get_conn_latency(
+    const uint8_t *event) {
+  return little_endian_read_16(event, 8);
+}
+inline uint16_t
+hci_subevent_le_connection_update_complete_get_supervision_timeout(
+    const uint8_t *event) {
+  return little_endian_read_16(event, 10);
+}
+
+inline hci_con_handle_t
+hci_subevent_le_data_length_change_get_connection_handle(
+    const uint8_t *event) {
+  return little_endian_read_16(event, 3);
+}
+inline uint16_t
+hci_subevent_le_data_length_change_get_max_tx_octets(const uint8_t *event) {
+  return little_endian_read_16(event, 5);
+}
+inline uint16_t
+hci_subevent_le_data_length_change_get_max_rx_octets(const uint8_t *event) {
+  return little_endian_read_16(event, 9);
+}
+
+inline uint8_t
+hci_subevent_le_phy_update_complete_get_status(const uint8_t *event) {
+  return event[3];
+}
+inline hci_con_handle_t
+hci_subevent_le_phy_update_complete_get_connection_handle(
+    const uint8_t *event) {
+  return little_endian_read_16(event, 4);
+}
+inline uint8_t
+hci_subevent_le_phy_update_complete_get_tx_phy(const uint8_t *event) {
+  return event[6];
+}
+inline uint8_t
+hci_subevent_le_phy_update_complete_get_rx_phy(const uint8_t *event) {
+  return event[7];
+}
+
+inline uint8_t
+gap_event_advertising_report_get_advertising_event_type(const uint8_t *event) {
+  return event[2];
+}
+inline uint8_t
+gap_event_advertising_report_get_address_type(const uint8_t *event) {
+  return event[3];
+}
+inline void gap_event_advertising_report_get_address(const uint8_t *event,
+                                                     bd_addr_t address) {
+  reverse_bytes(&event[4], address, 6);
+}
+inline int8_t gap_event_advertising_report_get_rssi(const uint8_t *event) {
+  return (int8_t)event[10];
+}
+inline uint8_t
+gap_event_advertising_report_get_data_length(const uint8_t *event) {
+  return event[11];
+}
+inline const uint8_t *
+gap_event_advertising_report_get_data(const uint8_t *event) {
+  return &event[12];
+}
+
+inline hci_con_handle_t
+gatt_event_query_complete_get_handle(const uint8_t *event) {
+  return little_endian_read_16(event, 2);
+}
+inline uint8_t gatt_event_query_complete_get_att_status(const uint8_t *event) {
+  return event[4];
+}
+inline hci_con_handle_t
+gatt_event_service_query_result_get_handle(const uint8_t *event) {
+  return little_endian_read_16(event, 2);
+}
+inline void
+gatt_event_service_query_result_get_service(const uint8_t *event,
+                                            gatt_client_service_t *service) {
+  service->start_group_handle = little_endian_read_16(event, 4);
+  service->end_group_handle = little_endian_read_16(event, 6);
+  reverse_bytes(&event[8], service->uuid128, 16);
+  service->uuid16 = (uint16_t)(service->uuid128[2] << 8 | service->uuid128[3]);
+}
+inline hci_con_handle_t
+gatt_event_characteristic_query_result_get_handle(const uint8_t *event) {
+  return little_endian_read_16(event, 2);
+}
+inline void gatt_event_characteristic_query_result_get_characteristic(
+    const uint8_t *event, gatt_client_characteristic_t *characteristic) {
+  characteristic->start_handle = little_endian_read_16(event, 4);
+  characteristic->value_handle = little_endian_read_16(event, 6);
+  characteristic->end_handle = little_endian_read_16(event, 8);
+  characteristic->properties = little_endian_read_16(event, 10);
+  reverse_bytes(&event[12], characteristic->uuid128, 16);
+  characteristic->uuid16 = (uint16_t)(characteristic->uuid128[2] << 8 |
+                                      characteristic->uuid128[3]);
+}
+inline hci_con_handle_t
+gatt_event_notification_get_handle(const uint8_t *event) {
+  return little_endian_read_16(event, 2);
+}
+inline uint16_t
+gatt_event_notification_get_value_handle(const uint8_t *event) {
+  return little_endian_read_16(event, 4);
+}
+inline uint16_t
+gatt_event_notification_get_value_length(const uint8_t *event) {
+  return little_endian_read_16(event, 6);
+}
+inline const uint8_t *gatt_event_notification_get_value(const uint8_t *event) {
+  return &event[8];
+}
+
+// Stack, GAP and GATT client calls
+
+void l2cap_init(void);
+void sm_init(void);
+void gatt_client_init(void);
+void hci_add_event_handler(
+    btstack_packet_callback_registration_t *callback_handler);
+int hci_power_control(int power_mode);
+
+void gap_set_scan_parameters(uint8_t scan_type, uint16_t scan_interval,
+                             uint16_t scan_window);
+void gap_start_scan(void);
+void gap_stop_scan(void);
+void gap_set_connection_parameters(uint16_t conn_scan_interval,
+                                   uint16_t conn_scan_window,
+                                   uint16_t conn_interval_min,
+                                   uint16_t conn_interval_max,
+                                   uint16_t conn_latency,
+                                   uint16_t supervision_timeout,
+                                   uint16_t min_ce_length,
+                                   uint16_t max_ce_length);
+uint8_t gap_whitelist_clear(void);
+uint8_t gap_whitelist_add(bd_addr_type_t address_type, const bd_addr_t address);
+uint8_t gap_connect_with_whitelist(void);
+uint8_t gap_connect(const bd_addr_t addr, bd_addr_type_t addr_type);
+uint8_t gap_connect_cancel(void);
+uint8_t gap_disconnect(hci_con_handle_t handle);
+int gap_update_connection_parameters(hci_con_handle_t con_handle,
+                                     uint16_t conn_interval_min,
+                                     uint16_t conn_interval_max,
+                                     uint16_t conn_latency,
+                                     uint16_t supervision_timeout);
+uint8_t gap_le_set_phy(hci_con_handle_t con_handle, uint8_t all_phys,
+                       uint8_t tx_phys, uint8_t rx_phys, uint8_t phy_options);
+
+uint8_t gatt_client_discover_primary_services(btstack_packet_handler_t callback,
+                                              hci_con_handle_t con_handle);
+uint8_t gatt_client_discover_characteristics_for_service(
+    btstack_packet_handler_t callback, hci_con_handle_t con_handle,
+    gatt_client_service_t *service);
+void gatt_client_listen_for_characteristic_value_updates(
+    gatt_client_notification_t *notification,
+    btstack_packet_handler_t callback, hci_con_handle_t con_handle,
+    gatt_client_characteristic_t *characteristic);
+uint8_t gatt_client_write_client_characteristic_configuration(
+    btstack_packet_handler_t callback, hci_con_handle_t con_handle,
+    gatt_client_characteristic_t *characteristic, uint16_t configuration);
@@ -0,0 +1,23 @@
+#pragma once
+
+// Host stand-in for the BTstack run loop: timers only, driven by
+// host_run_loop_*() in host_platform.hpp
+#include <cstdint>
+
+typedef struct btstack_timer_source {
+  void (*process)(struct btstack_timer_source *ts);
+  void *context;
+  uint32_t timeout; // Absolute, in ms since start
+  struct btstack_timer_source *next;
+} btstack_timer_source_t;
+
+void btstack_run_loop_set_timer(btstack_timer_source_t *ts,
+                                uint32_t timeout_in_ms);
+void btstack_run_loop_add_timer(btstack_timer_source_t *ts);
+int btstack_run_loop_remove_timer(btstack_timer_source_t *ts);
+void btstack_run_loop_set_timer_handler(
+    btstack_timer_source_t *ts, void (*process)(btstack_timer_source_t *ts));
+void btstack_run_loop_set_timer_context(btstack_timer_source_t *ts,
+                                        void *context);
+void *btstack_run_loop_get_timer_context(btstack_timer_source_t *ts);
+uint32_t btstack_run_loop_get_time_ms(void);
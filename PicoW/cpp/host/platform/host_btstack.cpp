@@ -0,0 +1,375 @@
+#include "host_btstack.hpp"
+#include "btstack.h"
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+static HostBtstackCalls calls;
+static btstack_packet_callback_registration_t *event_handlers = nullptr;
+static gatt_client_notification_t *listeners = nullptr;
+
+// The GATT query running on a connection; BTstack runs one at a time
+enum class Query { NONE, SERVICES, CHARACTERISTICS, WRITE };
+struct GattQuery {
+  Query type;
+  btstack_packet_handler_t callback;
+  uint16_t end_handle; // Characteristics: end of the service
+};
+static std::map<hci_con_handle_t, GattQuery> queries;
+
+static const uint8_t ATT_ERROR_RESPONSE = 0x01;
+static const uint8_t ATT_READ_BY_TYPE_RESPONSE = 0x09;
+static const uint8_t ATT_READ_BY_GROUP_TYPE_RESPONSE = 0x11;
+static const uint8_t ATT_WRITE_RESPONSE = 0x13;
+static const uint8_t ATT_HANDLE_VALUE_NOTIFICATION = 0x1b;
+static const uint8_t ATT_ERROR_ATTRIBUTE_NOT_FOUND = 0x0a;
+static const uint16_t L2CAP_CID_ATT = 0x0004;
+
+const HostBtstackCalls &host_btstack_calls() { return calls; }
+
+const char *bd_addr_to_str(const bd_addr_t addr) {
+  static char buffer[18];
+  snprintf(buffer, sizeof(buffer), "%02X:%02X:%02X:%02X:%02X:%02X", addr[0],
+           addr[1], addr[2], addr[3], addr[4], addr[5]);
+  return buffer;
+}
+
+static void emit_event(uint8_t *event, uint16_t len) {
+  for (btstack_packet_callback_registration_t *it = event_handlers; it;
+       it = it->next)
+    it->callback(HCI_EVENT_PACKET, 0, event, len);
+}
+
+static void emit_to(btstack_packet_handler_t callback, uint8_t *event,
+                    uint16_t len) {
+  if (callback)
+    callback(HCI_EVENT_PACKET, 0, event, len);
+}
+
+// 16-bit UUIDs on the Bluetooth base UUID, least significant byte first
+static void uuid128_from_att(const uint8_t *uuid, uint8_t uuid_len,
+                             uint8_t *uuid128) {
+  static const uint8_t BASE[16] = {0xfb, 0x34, 0x9b, 0x5f, 0x80, 0x00,
+                                   0x00, 0x80, 0x00, 0x10, 0x00, 0x00,
+                                   0x00, 0x00, 0x00, 0x00};
+  if (uuid_len == 16) {
+    memcpy(uuid128, uuid, 16);
+    return;
+  }
+  memcpy(uuid128, BASE, 16);
+  uuid128[12] = uuid[0];
+  uuid128[13] = uuid[1];
+}
+
+static void complete_query(hci_con_handle_t handle, uint8_t att_status) {
+  auto it = queries.find(handle);
+  if (it == queries.end())
+    return;
+  btstack_packet_handler_t callback = it->second.callback;
+  queries.erase(it);
+  uint8_t event[5] = {GATT_EVENT_QUERY_COMPLETE, 3};
+  little_endian_store_16(event, 2, handle);
+  event[4] = att_status;
+  emit_to(callback, event, sizeof(event));
+}
+
+// LE Advertising Report: one GAP event per report, as BTstack does
+static void emit_advertising_reports(const uint8_t *packet, uint16_t len) {
+  uint8_t count = packet[3];
+  uint16_t offset = 4;
+  for (uint8_t i = 0; i < count; i++) {
+    if (offset + 9 > len)
+      return;
+    uint8_t data_len = packet[offset + 8];
+    if (offset + 9 + data_len + 1 > len)
+      return;
+    uint8_t event[12 + 31];
+    if (data_len > 31)
+      return;
+    event[0] = GAP_EVENT_ADVERTISING_REPORT;
+    event[1] = (uint8_t)(10 + data_len);
+    event[2] = packet[offset];     // Event type
+    event[3] = packet[offset + 1]; // Address type
+    memcpy(&event[4], &packet[offset + 2], 6);
+    event[10] = packet[offset + 9 + data_len]; // RSSI
+    event[11] = data_len;
+    memcpy(&event[12], &packet[offset + 9], data_len);
+    emit_event(event, (uint16_t)(12 + data_len));
+    offset += 9 + data_len + 1;
+  }
+}
+
+static void receive_event(const uint8_t *packet, uint16_t len) {
+  uint8_t event[257]; // Largest HCI event
+  if (len < 2 || len > sizeof(event))
+    return;
+  memcpy(event, packet, len);
+  if (event[0] == HCI_EVENT_LE_META && len > 3 &&
+      event[2] == HCI_SUBEVENT_LE_ADVERTISING_REPORT) {
+    emit_event(event, len);
+    emit_advertising_reports(packet, len);
+    return;
+  }
+  if (event[0] == HCI_EVENT_DISCONNECTION_COMPLETE && len >= 5)
+    queries.erase(hci_event_disconnection_complete_get_connection_handle(event));
+  emit_event(event, len);
+}
+
+static void receive_att(hci_con_handle_t handle, const uint8_t *pdu,
+                        uint16_t len) {
+  auto it = queries.find(handle);
+  GattQuery *query = it == queries.end() ? nullptr : &it->second;
+  uint8_t event[64];
+
+  switch (pdu[0]) {
+  case ATT_ERROR_RESPONSE:
+    // Attribute Not Found ends a discovery, anything else fails the query
+    if (query && len >= 5)
+      complete_query(handle, pdu[4] == ATT_ERROR_ATTRIBUTE_NOT_FOUND
+                                 ? ERROR_CODE_SUCCESS
+                                 : pdu[4]);
+    break;
+
+  case ATT_READ_BY_GROUP_TYPE_RESPONSE: {
+    if (!query || query->type != Query::SERVICES || len < 2)
+      break;
+    uint8_t entry_len = pdu[1];
+    if (entry_len != 6 && entry_len != 20)
+      break;
+    uint16_t last_end = 0;
+    for (uint16_t i = 2; i + entry_len <= len; i += entry_len) {
+      event[0] = GATT_EVENT_SERVICE_QUERY_RESULT;
+      event[1] = 22;
+      little_endian_store_16(event, 2, handle);
+      memcpy(&event[4], &pdu[i], 4); // Start and end group handle
+      uuid128_from_att(&pdu[i + 4], entry_len - 4, &event[8]);
+      last_end = little_endian_read_16(pdu, i + 2);
+      emit_to(query->callback, event, 24);
+    }
+    if (last_end == 0xffff)
+      complete_query(handle, ERROR_CODE_SUCCESS);
+    break;
+  }
+
+  case ATT_READ_BY_TYPE_RESPONSE: {
+    if (!query || query->type != Query::CHARACTERISTICS || len < 2)
+      break;
+    uint8_t entry_len = pdu[1];
+    if (entry_len != 7 && entry_len != 21)
+      break;
+    uint16_t last_handle = 0;
+    for (uint16_t i = 2; i + entry_len <= len; i += entry_len) {
+      event[0] = GATT_EVENT_CHARACTERISTIC_QUERY_RESULT;
+      event[1] = 26;
+      little_endian_store_16(event, 2, handle);
+      last_handle = little_endian_read_16(pdu, i);
+      little_endian_store_16(event, 4, last_handle);
+      little_endian_store_16(event, 6, little_endian_read_16(pdu, i + 3));
+      little_endian_store_16(event, 8, 0); // End handle, unknown here
+      little_endian_store_16(event, 10, pdu[i + 2]);
+      uuid128_from_att(&pdu[i + 5], entry_len - 5, &event[12]);
+      emit_to(query->callback, event, 28);
+    }
+    if (last_handle >= query->end_handle)
+      complete_query(handle, ERROR_CODE_SUCCESS);
+    break;
+  }
+
+  case ATT_WRITE_RESPONSE:
+    if (query && query->type == Query::WRITE)
+      complete_query(handle, ERROR_CODE_SUCCESS);
+    break;
+
+  case ATT_HANDLE_VALUE_NOTIFICATION: {
+    if (len < 3)
+      break;
+    uint16_t value_handle = little_endian_read_16(pdu, 1);
+    uint16_t value_len = len - 3;
+    if (8 + value_len > (int)sizeof(event))
+      break;
+    event[0] = GATT_EVENT_NOTIFICATION;
+    event[1] = (uint8_t)(6 + value_len);
+    little_endian_store_16(event, 2, handle);
+    little_endian_store_16(event, 4, value_handle);
+    little_endian_store_16(event, 6, value_len);
+    memcpy(&event[8], &pdu[3], value_len);
+    for (gatt_client_notification_t *l = listeners; l; l = l->next) {
+      if (l->con_handle == handle && l->attribute_handle == value_handle)
+        emit_to(l->callback, event, (uint16_t)(8 + value_len));
+    }
+    break;
+  }
+
+  default:
+    break;
+  }
+}
+
+// ACL: handle and flags, length, then L2CAP length and channel. Only
+// unfragmented ATT PDUs are handled, which is all a power link carries.
+static void receive_acl(const uint8_t *packet, uint16_t len) {
+  if (len < 9)
+    return;
+  hci_con_handle_t handle = little_endian_read_16(packet, 0) & 0x0fff;
+  uint16_t l2cap_len = little_endian_read_16(packet, 4);
+  if (little_endian_read_16(packet, 6) != L2CAP_CID_ATT || 8 + l2cap_len > len)
+    return;
+  receive_att(handle, &packet[8], l2cap_len);
+}
+
+void host_btstack_receive(uint8_t packet_type, const uint8_t *packet,
+                          uint16_t len) {
+  if (packet_type == HCI_EVENT_PACKET)
+    receive_event(packet, len);
+  else if (packet_type == HCI_ACL_DATA_PACKET)
+    receive_acl(packet, len);
+}
+
+// Stack
+
+void l2cap_init(void) {}
+void sm_init(void) {}
+void gatt_client_init(void) {}
+
+void hci_add_event_handler(
+    btstack_packet_callback_registration_t *callback_handler) {
+  callback_handler->next = event_handlers;
+  event_handlers = callback_handler;
+}
+
+// The stack is up at once
+int hci_power_control(int power_mode) {
+  uint8_t event[3] = {BTSTACK_EVENT_STATE, 1,
+                      (uint8_t)(power_mode == HCI_POWER_ON ? HCI_STATE_WORKING
+                                                           : HCI_STATE_OFF)};
+  emit_event(event, sizeof(event));
+  return 0;
+}
+
+// GAP
+
+void gap_set_scan_parameters(uint8_t scan_type, uint16_t scan_interval,
+                             uint16_t scan_window) {
+  if (scan_type == 0)
+    calls.passive_scan++;
+  (void)scan_interval;
+  (void)scan_window;
+}
+void gap_start_scan(void) { calls.start_scan++; }
+void gap_stop_scan(void) { calls.stop_scan++; }
+void gap_set_connection_parameters(uint16_t conn_scan_interval,
+                                   uint16_t conn_scan_window,
+                                   uint16_t conn_interval_min,
+                                   uint16_t conn_interval_max,
+                                   uint16_t conn_latency,
+                                   uint16_t supervision_timeout,
+                                   uint16_t min_ce_length,
+                                   uint16_t max_ce_length) {
+  (void)conn_scan_interval;
+  (void)conn_scan_window;
+  (void)conn_interval_min;
+  (void)conn_interval_max;
+  (void)conn_latency;
+  (void)supervision_timeout;
+  (void)min_ce_length;
+  (void)max_ce_length;
+}
+uint8_t gap_whitelist_clear(void) { return ERROR_CODE_SUCCESS; }
+uint8_t gap_whitelist_add(bd_addr_type_t address_type,
+                          const bd_addr_t address) {
+  (void)address_type;
+  (void)address;
+  return ERROR_CODE_SUCCESS;
+}
+uint8_t gap_connect_with_whitelist(void) {
+  calls.connect_with_whitelist++;
+  return ERROR_CODE_SUCCESS;
+}
+uint8_t gap_connect(const bd_addr_t addr, bd_addr_type_t addr_type) {
+  (void)addr;
+  (void)addr_type;
+  calls.connect++;
+  return ERROR_CODE_SUCCESS;
+}
+uint8_t gap_connect_cancel(void) {
+  calls.connect_cancel++;
+  return ERROR_CODE_SUCCESS;
+}
+uint8_t gap_disconnect(hci_con_handle_t handle) {
+  (void)handle;
+  calls.disconnect++;
+  return ERROR_CODE_SUCCESS;
+}
+int gap_update_connection_parameters(hci_con_handle_t con_handle,
+                                     uint16_t conn_interval_min,
+                                     uint16_t conn_interval_max,
+                                     uint16_t conn_latency,
+                                     uint16_t supervision_timeout) {
+  (void)con_handle;
+  (void)conn_interval_min;
+  (void)conn_interval_max;
+  (void)conn_latency;
+  (void)supervision_timeout;
+  calls.update_connection_parameters++;
+  return 0;
+}
+uint8_t gap_le_set_phy(hci_con_handle_t con_handle, uint8_t all_phys,
+                       uint8_t tx_phys, uint8_t rx_phys, uint8_t phy_options) {
+  (void)con_handle;
+  (void)all_phys;
+  (void)tx_phys;
+  (void)rx_phys;
+  (void)phy_options;
+  calls.set_phy++;
+  return ERROR_CODE_SUCCESS;
+}
+
+// GATT client: the query is answered by the captured ATT responses
+
+static uint8_t start_query(hci_con_handle_t con_handle, Query type,
+                           btstack_packet_handler_t callback,
+                           uint16_t end_handle) {
+  if (queries.count(con_handle))
+    return ERROR_CODE_COMMAND_DISALLOWED;
+  queries[con_handle] = {type, callback, end_handle};
+  return ERROR_CODE_SUCCESS;
+}
+
+uint8_t gatt_client_discover_primary_services(btstack_packet_handler_t callback,
+                                              hci_con_handle_t con_handle) {
+  calls.discover_services++;
+  return start_query(con_handle, Query::SERVICES, callback, 0xffff);
+}
+
+uint8_t gatt_client_discover_characteristics_for_service(
+    btstack_packet_handler_t callback, hci_con_handle_t con_handle,
+    gatt_client_service_t *service) {
+  calls.discover_characteristics++;
+  return start_query(con_handle, Query::CHARACTERISTICS, callback,
+                     service->end_group_handle);
+}
+
+void gatt_client_listen_for_characteristic_value_updates(
+    gatt_client_notification_t *notification,
+    btstack_packet_handler_t callback, hci_con_handle_t con_handle,
+    gatt_client_characteristic_t *characteristic) {
+  bool listed = false;
+  for (gatt_client_notification_t *l = listeners; l; l = l->next)
+    listed = listed || l == notification;
+  notification->callback = callback;
+  notification->con_handle = con_handle;
+  notification->attribute_handle = characteristic->value_handle;
+  if (!listed) {
+    notification->next = listeners;
+    listeners = notification;
+  }
+}
+
+uint8_t gatt_client_write_client_characteristic_configuration(
+    btstack_packet_handler_t callback, hci_con_handle_t con_handle,
+    gatt_client_characteristic_t *characteristic, uint16_t configuration) {
+  (void)characteristic;
+  (void)configuration;
+  calls.write_client_configuration++;
+  return start_query(con_handle, Query::WRITE, callback, 0);
+}
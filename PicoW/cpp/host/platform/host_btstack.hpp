@@ -0,0 +1,30 @@
+#pragma once
+
+// Drives the host stand-in for the BTstack HCI/GAP/GATT client API. There is
+// no controller: packets from a capture are passed up as BTstack would, and
+// the calls the firmware makes are counted.
+#include <cstdint>
+
+struct HostBtstackCalls {
+  uint32_t start_scan;
+  uint32_t passive_scan; // Scan parameters set to passive
+  uint32_t stop_scan;
+  uint32_t connect; // gap_connect() to a scanned device
+  uint32_t connect_with_whitelist;
+  uint32_t connect_cancel;
+  uint32_t disconnect;
+  uint32_t discover_services;
+  uint32_t discover_characteristics;
+  uint32_t write_client_configuration;
+  uint32_t update_connection_parameters;
+  uint32_t set_phy;
+};
+
+const HostBtstackCalls &host_btstack_calls();
+
+// One packet received from the controller (H4 type, without the type byte).
+// Events go to the registered handlers, with advertising reports also as GAP
+// events; ATT PDUs in ACL data answer the running GATT query or are
+// notifications for the registered listeners.
+void host_btstack_receive(uint8_t packet_type, const uint8_t *packet,
+                          uint16_t len);
@@ -0,0 +1,472 @@
+#include "host_platform.hpp"
+#include "btstack.h"
+#include "lwip/tcp.h"
+#include "pico/stdlib.h"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <map>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+// Time
+
+static uint64_t monotonic_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static bool manual_clock = false;
+static uint64_t manual_us = 0;
+
+absolute_time_t get_absolute_time(void) {
+  static const uint64_t start_us = monotonic_us();
+  return manual_clock ? manual_us : monotonic_us() - start_us;
+}
+
+void host_clock_set_manual(uint64_t us) {
+  manual_clock = true;
+  manual_us = us;
+}
+
+void sleep_ms(uint32_t ms) {
+  struct timespec ts = {(time_t)(ms / 1000), (long)(ms % 1000) * 1000000};
+  nanosleep(&ts, nullptr);
+}
+
+static uint32_t now_ms() { return to_ms_since_boot(get_absolute_time()); }
+
+// Run loop timers, an unsorted list
+
+static btstack_timer_source_t *timers = nullptr;
+
+void btstack_run_loop_set_timer(btstack_timer_source_t *ts,
+                                uint32_t timeout_in_ms) {
+  ts->timeout = now_ms() + timeout_in_ms;
+}
+
+void btstack_run_loop_add_timer(btstack_timer_source_t *ts) {
+  btstack_run_loop_remove_timer(ts);
+  ts->next = timers;
+  timers = ts;
+}
+
+int btstack_run_loop_remove_timer(btstack_timer_source_t *ts) {
+  for (btstack_timer_source_t **it = &timers; *it; it = &(*it)->next) {
+    if (*it == ts) {
+      *it = ts->next;
+      ts->next = nullptr;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void btstack_run_loop_set_timer_handler(
+    btstack_timer_source_t *ts, void (*process)(btstack_timer_source_t *ts)) {
+  ts->process = process;
+}
+
+void btstack_run_loop_set_timer_context(btstack_timer_source_t *ts,
+                                        void *context) {
+  ts->context = context;
+}
+
+void *btstack_run_loop_get_timer_context(btstack_timer_source_t *ts) {
+  return ts->context;
+}
+
+uint32_t btstack_run_loop_get_time_ms(void) { return now_ms(); }
+
+// Earliest timer, or nullptr
+static btstack_timer_source_t *next_timer() {
+  btstack_timer_source_t *best = nullptr;
+  for (btstack_timer_source_t *t = timers; t; t = t->next) {
+    if (!best || (int32_t)(t->timeout - best->timeout) < 0)
+      best = t;
+  }
+  return best;
+}
+
+static void run_timers() {
+  // Bounded, so a timer re-adding itself with 0 ms cannot spin forever
+  for (int n = 0; n < 100; n++) {
+    btstack_timer_source_t *t = next_timer();
+    if (!t || (int32_t)(t->timeout - now_ms()) > 0)
+      return;
+    btstack_run_loop_remove_timer(t);
+    t->process(t);
+  }
+}
+
+void host_clock_advance_to(uint64_t us) {
+  uint32_t target_ms = (uint32_t)(us / 1000);
+  // Bounded like run_timers(), against timers that keep re-arming at 0 ms
+  for (int n = 0; n < 10000; n++) {
+    btstack_timer_source_t *t = next_timer();
+    if (!t || (int32_t)(t->timeout - target_ms) > 0)
+      break;
+    if ((int32_t)(t->timeout - now_ms()) > 0)
+      manual_us = (uint64_t)t->timeout * 1000;
+    run_timers();
+  }
+  if (us > manual_us)
+    manual_us = us;
+  run_timers();
+}
+
+// TLV, in memory
+
+static std::map<uint32_t, std::vector<uint8_t>> tlv_store;
+
+static int tlv_get_tag(void *context, uint32_t tag, uint8_t *buffer,
+                       uint32_t buffer_size) {
+  (void)context;
+  auto it = tlv_store.find(tag);
+  if (it == tlv_store.end())
+    return 0;
+  uint32_t len = (uint32_t)it->second.size();
+  if (len > buffer_size)
+    len = buffer_size;
+  memcpy(buffer, it->second.data(), len);
+  return (int)len;
+}
+
+static int tlv_store_tag(void *context, uint32_t tag, const uint8_t *data,
+                         uint32_t data_size) {
+  (void)context;
+  tlv_store[tag].assign(data, data + data_size);
+  return 0;
+}
+
+static void tlv_delete_tag(void *context, uint32_t tag) {
+  (void)context;
+  tlv_store.erase(tag);
+}
+
+static const btstack_tlv_t tlv_impl = {tlv_get_tag, tlv_store_tag,
+                                       tlv_delete_tag};
+
+void btstack_tlv_get_instance(const btstack_tlv_t **impl, void **context) {
+  *impl = &tlv_impl;
+  *context = nullptr;
+}
+
+// lwIP raw TCP over non-blocking sockets
+
+struct tcp_pcb {
+  uint64_t id; // pcbs are looked up by id, their addresses get reused
+  int fd;
+  void *arg;
+  tcp_connected_fn connected;
+  tcp_recv_fn recv;
+  tcp_sent_fn sent;
+  tcp_err_fn err;
+  tcp_poll_fn poll;
+  u8_t poll_interval; // In 500 ms ticks, as lwIP's coarse timer
+  uint32_t next_poll_ms;
+  bool connecting;
+  bool remote_closed;
+  err_t pending_error; // Reported from the run loop, as lwIP does
+  std::vector<uint8_t> unsent;
+  u16_t unsent_writes;
+  uint32_t unacked; // Taken by the socket, not yet reported as sent
+};
+
+static std::vector<tcp_pcb *> pcbs;
+static uint64_t next_pcb_id = 1;
+static std::map<uint16_t, uint16_t> port_map;
+
+void host_tcp_map_port(uint16_t port, uint16_t host_port) {
+  port_map[port] = host_port;
+}
+
+static tcp_pcb *find_pcb(uint64_t id) {
+  for (tcp_pcb *pcb : pcbs) {
+    if (pcb->id == id)
+      return pcb;
+  }
+  return nullptr;
+}
+
+static void free_pcb(tcp_pcb *pcb, bool reset) {
+  if (pcb->fd >= 0) {
+    if (reset) {
+      struct linger lg = {1, 0}; // Close with RST, like an abort
+      setsockopt(pcb->fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    }
+    close(pcb->fd);
+  }
+  for (size_t i = 0; i < pcbs.size(); i++) {
+    if (pcbs[i] == pcb) {
+      pcbs.erase(pcbs.begin() + i);
+      break;
+    }
+  }
+  delete pcb;
+}
+
+// The connection died: free the pcb, then tell the owner
+static void fail_pcb(tcp_pcb *pcb, err_t err) {
+  tcp_err_fn errf = pcb->err;
+  void *arg = pcb->arg;
+  free_pcb(pcb, true);
+  if (errf)
+    errf(arg, err);
+}
+
+size_t host_tcp_pcb_count() { return pcbs.size(); }
+
+int ipaddr_aton(const char *cp, ip_addr_t *addr) {
+  struct in_addr in;
+  if (!inet_aton(cp, &in))
+    return 0;
+  addr->addr = in.s_addr;
+  return 1;
+}
+
+uint8_t pbuf_free(struct pbuf *p) {
+  uint8_t count = 0;
+  while (p) {
+    struct pbuf *next = p->next;
+    free(p);
+    p = next;
+    count++;
+  }
+  return count;
+}
+
+struct tcp_pcb *tcp_new(void) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (fd < 0)
+    return nullptr;
+  tcp_pcb *pcb = new tcp_pcb();
+  pcb->id = next_pcb_id++;
+  pcb->fd = fd;
+  pcb->pending_error = ERR_OK;
+  pcbs.push_back(pcb);
+  return pcb;
+}
+
+void tcp_arg(struct tcp_pcb *pcb, void *arg) { pcb->arg = arg; }
+void tcp_err(struct tcp_pcb *pcb, tcp_err_fn err) { pcb->err = err; }
+void tcp_recv(struct tcp_pcb *pcb, tcp_recv_fn recv) { pcb->recv = recv; }
+void tcp_sent(struct tcp_pcb *pcb, tcp_sent_fn sent) { pcb->sent = sent; }
+
+void tcp_poll(struct tcp_pcb *pcb, tcp_poll_fn poll, u8_t interval) {
+  pcb->poll = poll;
+  pcb->poll_interval = interval;
+  pcb->next_poll_ms = now_ms() + interval * 500u;
+}
+
+err_t tcp_connect(struct tcp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port,
+                  tcp_connected_fn connected) {
+  struct sockaddr_in sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = ipaddr->addr;
+  auto mapped = port_map.find(port);
+  sa.sin_port = htons(mapped != port_map.end() ? mapped->second : port);
+  pcb->connected = connected;
+  pcb->connecting = true;
+  if (connect(pcb->fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 &&
+      errno != EINPROGRESS)
+    pcb->pending_error = ERR_RST; // Refused: reported later, like lwIP
+  return ERR_OK;
+}
+
+u16_t tcp_sndbuf(const struct tcp_pcb *pcb) {
+  size_t used = pcb->unsent.size();
+  return used >= TCP_SND_BUF ? 0 : (u16_t)(TCP_SND_BUF - used);
+}
+
+u16_t tcp_sndqueuelen(const struct tcp_pcb *pcb) {
+  return pcb->unsent_writes;
+}
+
+err_t tcp_write(struct tcp_pcb *pcb, const void *dataptr, u16_t len,
+                u8_t apiflags) {
+  (void)apiflags; // Always copied
+  if (pcb->connecting || pcb->pending_error != ERR_OK)
+    return ERR_CONN;
+  if (len > tcp_sndbuf(pcb) || pcb->unsent_writes >= TCP_SND_QUEUELEN)
+    return ERR_MEM;
+  const uint8_t *data = (const uint8_t *)dataptr;
+  pcb->unsent.insert(pcb->unsent.end(), data, data + len);
+  pcb->unsent_writes++;
+  return ERR_OK;
+}
+
+static bool defer_output = false;
+
+void host_tcp_defer_output(bool defer) { defer_output = defer; }
+
+static void flush_pcb(struct tcp_pcb *pcb) {
+  while (!pcb->unsent.empty()) {
+    ssize_t n = send(pcb->fd, pcb->unsent.data(), pcb->unsent.size(),
+                     MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        pcb->pending_error = ERR_RST;
+      break;
+    }
+    pcb->unsent.erase(pcb->unsent.begin(), pcb->unsent.begin() + n);
+    pcb->unacked += (uint32_t)n;
+  }
+  if (pcb->unsent.empty())
+    pcb->unsent_writes = 0;
+}
+
+err_t tcp_output(struct tcp_pcb *pcb) {
+  if (!defer_output)
+    flush_pcb(pcb);
+  return ERR_OK;
+}
+
+err_t tcp_close(struct tcp_pcb *pcb) {
+  flush_pcb(pcb);
+  free_pcb(pcb, false);
+  return ERR_OK;
+}
+
+void tcp_abort(struct tcp_pcb *pcb) { fail_pcb(pcb, ERR_ABRT); }
+
+void tcp_recved(struct tcp_pcb *pcb, u16_t len) {
+  (void)pcb;
+  (void)len;
+}
+
+void tcp_nagle_disable(struct tcp_pcb *pcb) {
+  int one = 1;
+  setsockopt(pcb->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+// Socket events for one pcb. Every callback may free the pcb, so it is
+// looked up again after each.
+static void service_pcb(uint64_t id, short revents) {
+  tcp_pcb *pcb = find_pcb(id);
+  if (!pcb)
+    return;
+  if (pcb->pending_error != ERR_OK) {
+    fail_pcb(pcb, pcb->pending_error);
+    return;
+  }
+
+  if (pcb->connecting) {
+    if (!(revents & (POLLOUT | POLLERR | POLLHUP)))
+      return;
+    int so_error = 0;
+    socklen_t len = sizeof(so_error);
+    getsockopt(pcb->fd, SOL_SOCKET, SO_ERROR, &so_error, &len);
+    if (so_error != 0) {
+      fail_pcb(pcb, ERR_RST);
+      return;
+    }
+    pcb->connecting = false;
+    if (pcb->connected)
+      pcb->connected(pcb->arg, pcb, ERR_OK);
+    return; // Anything else on the next step
+  }
+
+  if ((revents & POLLOUT) && !pcb->unsent.empty())
+    flush_pcb(pcb);
+
+  if (!pcb->remote_closed && (revents & (POLLIN | POLLHUP | POLLERR))) {
+    uint8_t buf[2048];
+    ssize_t n = recv(pcb->fd, buf, sizeof(buf), 0);
+    if (n > 0) {
+      struct pbuf *p = (struct pbuf *)malloc(sizeof(struct pbuf) + n);
+      p->next = nullptr;
+      p->payload = p + 1;
+      p->tot_len = p->len = (uint16_t)n;
+      memcpy(p->payload, buf, n);
+      if (pcb->recv)
+        pcb->recv(pcb->arg, pcb, p, ERR_OK);
+      else
+        pbuf_free(p);
+    } else if (n == 0) {
+      pcb->remote_closed = true;
+      if (pcb->recv)
+        pcb->recv(pcb->arg, pcb, nullptr, ERR_OK);
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      fail_pcb(pcb, ERR_RST);
+      return;
+    }
+    if (!(pcb = find_pcb(id)))
+      return;
+  }
+
+  if (pcb->unacked && pcb->sent) {
+    u16_t len = (u16_t)(pcb->unacked > 0xffff ? 0xffff : pcb->unacked);
+    pcb->unacked = 0;
+    pcb->sent(pcb->arg, pcb, len);
+    if (!(pcb = find_pcb(id)))
+      return;
+  }
+
+  if (pcb->poll && (int32_t)(now_ms() - pcb->next_poll_ms) >= 0) {
+    pcb->next_poll_ms = now_ms() + pcb->poll_interval * 500u;
+    pcb->poll(pcb->arg, pcb);
+  }
+}
+
+void host_run_loop_step(uint32_t max_wait_ms) {
+  uint32_t now = now_ms();
+  uint32_t wait = max_wait_ms;
+  btstack_timer_source_t *t = next_timer();
+  if (t) {
+    int32_t due = (int32_t)(t->timeout - now);
+    if (due < (int32_t)wait)
+      wait = due < 0 ? 0 : (uint32_t)due;
+  }
+
+  std::vector<struct pollfd> fds;
+  std::vector<uint64_t> ids;
+  for (tcp_pcb *pcb : pcbs) {
+    if (pcb->pending_error != ERR_OK)
+      wait = 0;
+    if (pcb->poll) {
+      int32_t due = (int32_t)(pcb->next_poll_ms - now);
+      if (due < (int32_t)wait)
+        wait = due < 0 ? 0 : (uint32_t)due;
+    }
+    if (pcb->unacked)
+      wait = 0;
+    short events = 0;
+    if (!pcb->remote_closed)
+      events |= POLLIN;
+    if (pcb->connecting || !pcb->unsent.empty())
+      events |= POLLOUT;
+    fds.push_back({pcb->fd, events, 0});
+    ids.push_back(pcb->id);
+  }
+
+  poll(fds.data(), fds.size(), (int)wait);
+  for (size_t i = 0; i < fds.size(); i++)
+    service_pcb(ids[i], fds[i].revents);
+  run_timers();
+}
+
+void host_run_loop_run_for(uint32_t ms) {
+  uint32_t end = now_ms() + ms;
+  int32_t left;
+  while ((left = (int32_t)(end - now_ms())) > 0)
+    host_run_loop_step((uint32_t)left);
+}
+
+bool host_run_loop_run_until(const std::function<bool()> &done,
+                             uint32_t timeout_ms) {
+  uint32_t end = now_ms() + timeout_ms;
+  int32_t left;
+  while (!done() && (left = (int32_t)(end - now_ms())) > 0)
+    host_run_loop_step((uint32_t)(left < 10 ? left : 10));
+  return done();
+}
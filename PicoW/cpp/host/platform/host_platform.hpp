@@ -0,0 +1,31 @@
+#pragma once
+
+// Drives the host stand-ins for the BTstack run loop and lwIP: everything
+// runs on the calling thread, as on the Pico where BTstack and lwIP share
+// the async context.
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// Runs due timers and socket callbacks, waiting up to max_wait_ms for one
+void host_run_loop_step(uint32_t max_wait_ms);
+void host_run_loop_run_for(uint32_t ms);
+// Runs until done() returns true or timeout_ms passed. Returns done().
+bool host_run_loop_run_until(const std::function<bool()> &done,
+                             uint32_t timeout_ms);
+
+// Replaces the monotonic clock with one that only moves when told to, so a
+// capture replays against its own timestamps at any speed
+void host_clock_set_manual(uint64_t us);
+// Moves the manual clock forward to us, running timers at their deadlines
+void host_clock_advance_to(uint64_t us);
+
+// Connections the firmware opens to port go to host_port instead, so a mock
+// server needs no privileged port
+void host_tcp_map_port(uint16_t port, uint16_t host_port);
+// tcp_output() leaves the socket writes to the run loop, as lwIP hands
+// segments to the driver, so the caller's CPU time can be measured without
+// the host's system calls
+void host_tcp_defer_output(bool defer);
+// Open TCP pcbs, for checks that nothing leaked
+size_t host_tcp_pcb_count();
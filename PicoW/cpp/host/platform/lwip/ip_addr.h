@@ -0,0 +1,10 @@
+#pragma once
+
+// Host stand-in for lwIP IPv4 addresses (network byte order)
+#include <cstdint>
+
+typedef struct {
+  uint32_t addr;
+} ip_addr_t;
+
+int ipaddr_aton(const char *cp, ip_addr_t *addr);
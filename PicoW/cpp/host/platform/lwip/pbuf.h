@@ -0,0 +1,13 @@
+#pragma once
+
+// Host stand-in for lwIP pbufs. Received data arrives as one pbuf per read.
+#include <cstdint>
+
+struct pbuf {
+  struct pbuf *next;
+  void *payload;
+  uint16_t tot_len;
+  uint16_t len;
+};
+
+uint8_t pbuf_free(struct pbuf *p);
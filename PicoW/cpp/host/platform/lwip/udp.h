@@ -0,0 +1,6 @@
+#pragma once
+
+// Host stand-in: only the types, streaming is not built for the host
+#include "lwip/tcp.h"
+
+struct udp_pcb;
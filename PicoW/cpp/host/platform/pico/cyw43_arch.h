@@ -0,0 +1,8 @@
+#pragma once
+
+// Host stand-in: lwIP callbacks and the run loop share one thread, so the
+// lwIP lock has nothing to do
+#include "pico/stdlib.h"
+
+inline void cyw43_arch_lwip_begin(void) {}
+inline void cyw43_arch_lwip_end(void) {}
@@ -0,0 +1,17 @@
+#pragma once
+
+// Host stand-in for the Pico SDK time functions, on the monotonic clock
+// (time 0 is the first call)
+#include <cstdint>
+#include <cstdio>
+
+typedef uint64_t absolute_time_t; // us
+
+absolute_time_t get_absolute_time(void);
+inline uint32_t to_ms_since_boot(absolute_time_t t) {
+  return (uint32_t)(t / 1000);
+}
+inline uint64_t to_us_since_boot(absolute_time_t t) { return t; }
+inline uint64_t time_us_64(void) { return get_absolute_time(); }
+inline uint32_t time_us_32(void) { return (uint32_t)get_absolute_time(); }
+void sleep_ms(uint32_t ms);
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdio>
+
+// Minimal assertions for the host tests: failures are reported with their
+// location and counted, and check_result() turns them into the exit code.
+inline int &check_failures() {
+  static int failures = 0;
+  return failures;
+}
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);          \
+      check_failures()++;                                                      \
+    }                                                                          \
+  } while (0)
+
+#define CHECK_EQ(a, b)                                                         \
+  do {                                                                         \
+    long long check_a = (long long)(a), check_b = (long long)(b);              \
+    if (check_a != check_b) {                                                  \
+      printf("%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__,       \
+             __LINE__, #a, #b, check_a, check_b);                              \
+      check_failures()++;                                                      \
+    }                                                                          \
+  } while (0)
+
+inline int check_result(const char *name) {
+  if (check_failures())
+    printf("%s: %d check(s) failed\n", name, check_failures());
+  else
+    printf("%s: OK\n", name);
+  return check_failures() ? 1 : 0;
+}
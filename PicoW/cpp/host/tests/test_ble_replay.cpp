@@ -0,0 +1,66 @@
+#include "ble_client.hpp"
+#include "ble_replay.hpp"
+#include "check.hpp"
+#include "host_btstack.hpp"
+#include "host_platform.hpp"
+#include <vector>
+
+// Replays captures/kickr_connect.btsnoop: a first connect attempt that fails
+// (0x3e), a scan connect, discovery and subscription, a connection and PHY
+// update, 20 notifications with one lost second, and a disconnect.
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    printf("Usage: test_ble_replay capture.btsnoop\n");
+    return 2;
+  }
+  std::vector<BtsnoopRecord> records;
+  CHECK(btsnoop_read(argv[1], records));
+  CHECK_EQ(records.size(), 46);
+
+  host_clock_set_manual(REPLAY_START_US);
+  BLEClient client;
+  std::vector<uint16_t> powers;
+  client.set_power_callback([&](uint16_t power) { powers.push_back(power); });
+  client.init();
+
+  // Up to the last notification, before the disconnect
+  std::vector<BtsnoopRecord> ride(records.begin(), records.end() - 1);
+  ReplayStats stats = ble_replay(ride, 0);
+  CHECK_EQ(stats.packets, 33);
+  const HostBtstackCalls &calls = host_btstack_calls();
+
+  // The failed connection restarted the scan, passive now that the address
+  // was seen, and the second attempt got through
+  CHECK_EQ(calls.start_scan, 2);
+  CHECK_EQ(calls.passive_scan, 1);
+  CHECK_EQ(calls.connect, 2);
+  CHECK_EQ(calls.connect_with_whitelist, 0);
+  CHECK(client.is_connected());
+
+  CHECK_EQ(calls.discover_services, 1);
+  CHECK_EQ(calls.discover_characteristics, 1);
+  CHECK_EQ(calls.write_client_configuration, 1);
+  CHECK_EQ(calls.update_connection_parameters, 1);
+  CHECK_EQ(calls.set_phy, 1);
+
+  const BLELinkInfo &info = client.get_link_info();
+  CHECK_EQ(info.conn_interval, 12);
+  CHECK_EQ(info.tx_phy, 2);
+  CHECK_EQ(info.max_rx_octets, 251);
+  CHECK_EQ(info.notification_count, 20);
+  // 1 s between the tenth and eleventh notification, 15 ms interval
+  CHECK_EQ(info.max_gap_events, 67);
+  CHECK_EQ(client.get_link_stats().get_received(), 20);
+
+  // Zero power is reported on connect, then every notification
+  CHECK_EQ(powers.size(), 21);
+  CHECK_EQ(powers.front(), 0);
+  CHECK_EQ(powers.back(), 290);
+
+  // The disconnect reconnects straight to the device just stored
+  ble_replay(std::vector<BtsnoopRecord>(records.end() - 1, records.end()), 0);
+  CHECK(!client.is_connected());
+  CHECK_EQ(calls.connect_with_whitelist, 1);
+
+  return check_result("ble_replay");
+}
@@ -0,0 +1,114 @@
+#include "check.hpp"
+#include "color_math.hpp"
+#include "config.h"
+#include "zone_predictor.hpp"
+#include <cmath>
+#include <cstdlib>
+
+// The float code color_math.hpp replaced, kept as the reference
+static HueHsb float_rgb_to_hsb(Color color) {
+  float r = color.r / 255.0f;
+  float g = color.g / 255.0f;
+  float b = color.b / 255.0f;
+
+  float max_val = (r > g) ? ((r > b) ? r : b) : ((g > b) ? g : b);
+  float min_val = (r < g) ? ((r < b) ? r : b) : ((g < b) ? g : b);
+  float delta = max_val - min_val;
+
+  float hue_f = 0;
+  if (delta == 0) {
+    hue_f = 0;
+  } else if (max_val == r) {
+    hue_f = 60 * fmod(((g - b) / delta), 6.0f);
+  } else if (max_val == g) {
+    hue_f = 60 * (((b - r) / delta) + 2);
+  } else {
+    hue_f = 60 * (((r - g) / delta) + 4);
+  }
+  if (hue_f < 0)
+    hue_f += 360;
+
+  HueHsb out;
+  out.hue = (uint16_t)((hue_f / 360.0f) * 65535);
+  out.sat = (uint8_t)(((max_val == 0) ? 0 : (delta / max_val)) * 254);
+  out.bri = (uint8_t)(max_val * 254);
+  return out;
+}
+
+static size_t float_zone_of(uint16_t power, uint16_t ftp) {
+  float percentage = ((float)power / (float)ftp) * 100.0f;
+  for (size_t i = 0; i < POWER_ZONES.size(); i++) {
+    if (percentage < POWER_ZONES[i].max_percent)
+      return i;
+  }
+  return POWER_ZONES.size() - 1;
+}
+
+// Exact: power / ftp * 100 < max  <=>  power * 100 < max * ftp
+static size_t exact_zone_of(uint16_t power, uint16_t ftp) {
+  for (size_t i = 0; i < POWER_ZONES.size(); i++) {
+    if ((uint32_t)power * 100 < (uint32_t)POWER_ZONES[i].max_percent * ftp)
+      return i;
+  }
+  return POWER_ZONES.size() - 1;
+}
+
+// Every power from 0 to 2000 W at every FTP from 50 to 600 W. The integer
+// zone must be the exact one; the float one may only differ where the
+// percentage lands exactly on a zone bound and rounds below it.
+static void test_zones() {
+  unsigned float_off = 0;
+  for (uint16_t ftp = 50; ftp <= 600; ftp++) {
+    for (uint16_t power = 0; power <= 2000; power++) {
+      size_t zone = ZonePredictor::zone_of(power, ftp);
+      CHECK_EQ(zone, exact_zone_of(power, ftp));
+      size_t ref = float_zone_of(power, ftp);
+      if (ref != zone) {
+        float_off++;
+        CHECK_EQ((uint32_t)power * 100 % ftp, 0);
+        CHECK_EQ(ref + 1, zone);
+      }
+    }
+  }
+  printf("zones: float reference off by rounding at %u bounds\n", float_off);
+  CHECK_EQ(ZonePredictor::zone_of(500, 0), 0); // No FTP set
+}
+
+// All 16.7M colours: hue, sat and bri within one unit of the float formula
+static void test_rgb_to_hsb() {
+  unsigned differ = 0;
+  for (uint32_t rgb = 0; rgb < (1u << 24); rgb++) {
+    Color c = {(uint8_t)(rgb >> 16), (uint8_t)(rgb >> 8), (uint8_t)rgb};
+    HueHsb a = rgb_to_hsb(c);
+    HueHsb f = float_rgb_to_hsb(c);
+    int dh = abs((int)a.hue - (int)f.hue);
+    if (dh > 32768)
+      dh = 65536 - dh; // Red wraps around
+    int ds = abs((int)a.sat - (int)f.sat);
+    int db = abs((int)a.bri - (int)f.bri);
+    if (dh > 1 || ds > 1 || db > 1) {
+      printf("rgb %u,%u,%u: %u/%u/%u vs float %u/%u/%u\n", c.r, c.g, c.b,
+             a.hue, a.sat, a.bri, f.hue, f.sat, f.bri);
+      check_failures()++;
+    }
+    if (dh || ds || db)
+      differ++;
+  }
+  printf("colours: %u of %u one unit from the float reference\n", differ,
+         1u << 24);
+
+  // The zone colours are what the lights actually show: identical
+  for (const auto &zone : POWER_ZONES) {
+    HueHsb a = rgb_to_hsb(zone.color);
+    HueHsb f = float_rgb_to_hsb(zone.color);
+    CHECK_EQ(a.hue, f.hue);
+    CHECK_EQ(a.sat, f.sat);
+    CHECK_EQ(a.bri, f.bri);
+  }
+}
+
+int main() {
+  test_zones();
+  test_rgb_to_hsb();
+  return check_result("color_math");
+}
@@ -0,0 +1,187 @@
+#include "check.hpp"
+#include "http_response.hpp"
+#include <cstring>
+#include <string>
+#include <vector>
+
+struct Result {
+  int status;
+  bool keep_alive;
+  int successes;
+  int errors;
+  int error_type;
+  std::string capture;
+};
+
+// Feeds text in pieces of step bytes, the way pbufs arrive, and collects
+// every complete response. Returns false if the parser failed.
+static bool parse(const std::string &text, size_t step,
+                  std::vector<Result> &out, const char *capture = nullptr,
+                  char capture_end = '"') {
+  HttpResponseParser p;
+  p.set_capture(capture, capture_end);
+  size_t off = 0;
+  while (off < text.size()) {
+    size_t len = std::min(step, text.size() - off);
+    // Each piece is copied to its own allocation so reads past it are caught
+    std::vector<char> piece(text.begin() + off, text.begin() + off + len);
+    size_t used = 0;
+    while (used < len) {
+      used += p.feed(piece.data() + used, len - used);
+      if (p.is_failed())
+        return false;
+      if (p.is_done()) {
+        const char *cap = p.get_capture();
+        out.push_back({p.get_status(), p.keep_alive(), p.get_successes(),
+                       p.get_errors(), p.get_error_type(), cap ? cap : ""});
+        p.reset();
+        p.set_capture(capture, capture_end);
+      }
+    }
+    off += len;
+  }
+  return true;
+}
+
+static const size_t STEPS[] = {1, 2, 7, 64, 100000};
+
+static void test_content_length() {
+  std::string body = "[{\"success\":{\"/groups/1/action/on\":true}}]";
+  std::string text = "HTTP/1.1 200 OK\r\n"
+                     "Content-Type: application/json\r\n"
+                     "Content-Length: " +
+                     std::to_string(body.size()) + "\r\n\r\n" + body;
+  for (size_t step : STEPS) {
+    std::vector<Result> r;
+    CHECK(parse(text, step, r));
+    CHECK_EQ(r.size(), 1);
+    if (r.size() == 1) {
+      CHECK_EQ(r[0].status, 200);
+      CHECK(r[0].keep_alive);
+      CHECK_EQ(r[0].successes, 1);
+      CHECK_EQ(r[0].errors, 0);
+    }
+  }
+}
+
+// Header names longer than, or sharing a prefix with, the ones the parser
+// knows must not be read past the end of those (caught by ASan)
+static void test_long_header_names() {
+  std::string long_name(300, 'x');
+  std::string text = "HTTP/1.1 200 OK\r\n"
+                     "Content-Type: application/json\r\n"
+                     "Connection-Extra-Long-Header-Name: close\r\n"
+                     "Content-Length-Not: 99\r\n"
+                     "Transfer-Encoding-Whatever: chunked\r\n" +
+                     long_name + ": 1\r\n"
+                                 "Content-Lengt: 5\r\n"
+                                 "Content-Length: 2\r\n\r\n[]";
+  for (size_t step : STEPS) {
+    std::vector<Result> r;
+    CHECK(parse(text, step, r));
+    CHECK_EQ(r.size(), 1);
+    if (r.size() == 1) {
+      CHECK_EQ(r[0].status, 200);
+      CHECK(r[0].keep_alive); // The close above was on another header
+    }
+  }
+}
+
+static void test_pipelined_chunked_and_close() {
+  std::string text =
+      "HTTP/1.1 200 OK\r\n"
+      "transfer-encoding: Chunked\r\n\r\n"
+      "19\r\n[{\"error\":{\"type\": 201,\"a\r\n"
+      "8\r\n\":\"x\"}}]\r\n"
+      "0\r\n\r\n"
+      "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n"
+      "HTTP/1.0 429 Too Many\r\nconnection: CLOSE\r\ncontent-length: 0\r\n\r\n";
+  for (size_t step : STEPS) {
+    std::vector<Result> r;
+    CHECK(parse(text, step, r));
+    CHECK_EQ(r.size(), 3);
+    if (r.size() == 3) {
+      CHECK_EQ(r[0].status, 200);
+      CHECK_EQ(r[0].errors, 1);
+      CHECK_EQ(r[0].error_type, 201);
+      CHECK_EQ(r[1].status, 503);
+      CHECK(r[1].keep_alive);
+      CHECK_EQ(r[2].status, 429);
+      CHECK(!r[2].keep_alive);
+    }
+  }
+}
+
+static void test_capture() {
+  std::string body = "[{\"success\":{\"id\":\"AbCdEf0123456789\"}}]";
+  std::string text = "HTTP/1.1 200 OK\r\nContent-Length: " +
+                     std::to_string(body.size()) + "\r\n\r\n" + body;
+  for (size_t step : STEPS) {
+    std::vector<Result> r;
+    CHECK(parse(text, step, r, "\"id\":\"", '"'));
+    CHECK_EQ(r.size(), 1);
+    if (r.size() == 1)
+      CHECK(r[0].capture == "AbCdEf0123456789");
+  }
+}
+
+static void test_until_close() {
+  HttpResponseParser p;
+  const char text[] = "HTTP/1.1 200 OK\r\n\r\nabc";
+  CHECK_EQ(p.feed(text, strlen(text)), strlen(text));
+  CHECK(p.reads_until_close());
+  CHECK(!p.is_done());
+}
+
+// Lengths past the limit fail instead of overflowing (caught by UBSan)
+static void test_content_length_limit() {
+  std::vector<Result> r;
+  CHECK(!parse("HTTP/1.1 200 OK\r\nContent-Length: 99999999999999999999\r\n"
+               "\r\n",
+               7, r));
+  CHECK(!parse("HTTP/1.1 200 OK\r\nContent-Length: " +
+                   std::to_string(HttpResponseParser::CONTENT_LENGTH_MAX + 1) +
+                   "\r\n\r\n",
+               1, r));
+  CHECK(r.empty());
+
+  HttpResponseParser p;
+  std::string text = "HTTP/1.1 200 OK\r\nContent-Length: " +
+                     std::to_string(HttpResponseParser::CONTENT_LENGTH_MAX) +
+                     "\r\n\r\n";
+  CHECK_EQ(p.feed(text.data(), text.size()), text.size());
+  CHECK(!p.is_failed());
+  CHECK(p.headers_complete());
+}
+
+// Status codes are three digits; longer ones fail instead of overflowing
+static void test_status_limit() {
+  std::vector<Result> r;
+  CHECK(!parse("HTTP/1.1 99999999999999 OK\r\nContent-Length: 0\r\n\r\n", 1,
+               r));
+  CHECK(!parse("HTTP/1.1 2000 OK\r\nContent-Length: 0\r\n\r\n", 5, r));
+  CHECK(r.empty());
+  CHECK(parse("HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n",
+              4, r));
+  CHECK_EQ(r.size(), 1);
+  if (r.size() == 1)
+    CHECK_EQ(r[0].status, 503);
+}
+
+static void test_garbage() {
+  std::vector<Result> r;
+  CHECK(!parse("garbage\r\n", 3, r));
+  CHECK(!parse("HTTP/1.1 abc\r\n\r\n", 1, r));
+}
+
+int main() {
+  test_content_length();
+  test_long_header_names();
+  test_pipelined_chunked_and_close();
+  test_capture();
+  test_until_close();
+  test_content_length_limit();
+  test_status_limit();
+  test_garbage();
+  return check_result("http_response");
+}
@@ -0,0 +1,74 @@
+#include "check.hpp"
+#include "host_platform.hpp"
+#include "hue_client.hpp"
+#include "log.hpp"
+#include "mock_hue_bridge.hpp"
+
+// The firmware's Hue client against the mock bridge, for behaviour that
+// spans several updates
+
+static const char PATH[] = "/api/testuser/groups/1/action";
+
+static bool light_on(const MockHueBridge &bridge) {
+  MockHueBridge::LightState state;
+  return bridge.get_state(PATH, state) && state.on;
+}
+
+static uint32_t puts(const MockHueBridge &bridge) {
+  MockHueBridge::LightState state;
+  return bridge.get_state(PATH, state) ? state.puts : 0;
+}
+
+static bool wait_for(const std::function<bool()> &done) {
+  return host_run_loop_run_until(done, 5000);
+}
+
+// Auto-off: the power, and so the zone, stays the same after turn_off().
+// The lights stay off until the zone changes or they are woken.
+static void test_turn_off_holds(MockHueBridge &bridge, HueClient &client) {
+  Color white = POWER_ZONES[0].color;
+  Color blue = POWER_ZONES[1].color;
+
+  client.update(white);
+  CHECK(wait_for([&]() { return light_on(bridge); }));
+  client.turn_off();
+  CHECK(wait_for([&]() { return !light_on(bridge); }));
+
+  // Same zone: nothing is sent
+  uint32_t sent = puts(bridge);
+  for (int i = 0; i < 5; i++) {
+    client.update(white);
+    host_run_loop_run_for(300);
+  }
+  CHECK(!light_on(bridge));
+  CHECK_EQ(puts(bridge), sent);
+
+  // Another zone turns them back on
+  client.update(blue);
+  CHECK(wait_for([&]() { return light_on(bridge); }));
+
+  // So does waking them, in the zone they were turned off in
+  client.turn_off();
+  CHECK(wait_for([&]() { return !light_on(bridge); }));
+  client.wake();
+  client.update(blue);
+  CHECK(wait_for([&]() { return light_on(bridge); }));
+}
+
+int main() {
+  MockHueBridge bridge;
+  if (!bridge.start()) {
+    printf("Mock bridge failed to start\n");
+    return 1;
+  }
+  host_tcp_map_port(80, bridge.get_port());
+  log_init();
+  static HueClient client;
+  HueBridgeConfig config = {"127.0.0.1", "testuser", "1", "", "", "", ""};
+  client.init(config);
+  CHECK(wait_for([&]() { return client.hub_reachable; }));
+
+  test_turn_off_holds(bridge, client);
+  log_drain(LOG_RING_SIZE);
+  return check_result("test_hue_client");
+}
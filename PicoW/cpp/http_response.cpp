@@ -0,0 +1,277 @@
+#include "http_response.hpp"
+#include <cctype>
+
+// Lower case, matched case-insensitively
+static const char *const HEADER_NAMES[] = {"content-length",
+                                           "transfer-encoding", "connection"};
+static const char CHUNKED_TOKEN[] = "chunked";
+static const char CLOSE_TOKEN[] = "close";
+static const char SUCCESS_TOKEN[] = "\"success\"";
+static const char ERROR_TOKEN[] = "\"error\"";
+static const char TYPE_TOKEN[] = "\"type\":";
+
+// Advances pos through token on c. Returns true once the whole token matched.
+static bool match(const char *token, uint8_t &pos, char c) {
+  c = (char)tolower((unsigned char)c);
+  if (c == token[pos]) {
+    if (token[++pos] == '\0') {
+      pos = 0;
+      return true;
+    }
+    return false;
+  }
+  pos = (c == token[0]) ? 1 : 0;
+  return false;
+}
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  c = (char)tolower((unsigned char)c);
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+void HttpResponseParser::reset() {
+  state = State::STATUS_LINE;
+  pos = 0;
+  field = 0;
+  digits = 0;
+  candidates = 0;
+  header = HEADER_OTHER;
+  value_match = 0;
+  line_empty = true;
+  status = 0;
+  close = false;
+  chunked = false;
+  content_length = -1;
+  remaining = 0;
+  success_match = 0;
+  error_match = 0;
+  type_match = 0;
+  in_error_type = false;
+  successes = 0;
+  errors = 0;
+  error_type = 0;
+  capture_token = nullptr;
+  capture_end = '\0';
+  capture_state = CAPTURE_OFF;
+  capture_match = 0;
+  capture_len = 0;
+  capture[0] = '\0';
+}
+
+void HttpResponseParser::set_capture(const char *token, char end) {
+  capture_token = token;
+  capture_end = end;
+  capture_state = token ? CAPTURE_SEEKING : CAPTURE_OFF;
+  capture_match = 0;
+  capture_len = 0;
+  capture[0] = '\0';
+}
+
+size_t HttpResponseParser::feed(const char *data, size_t len) {
+  size_t i = 0;
+  while (i < len && state != State::DONE && state != State::FAILED)
+    consume(data[i++]);
+  return i;
+}
+
+void HttpResponseParser::consume(char c) {
+  switch (state) {
+  case State::STATUS_LINE:
+    // HTTP/1.x SP code SP reason
+    if (c == '\n') {
+      state = (status >= 100) ? State::HEADER_START : State::FAILED;
+    } else if (pos < 5) {
+      if (c != "HTTP/"[pos++])
+        state = State::FAILED;
+    } else if (c == ' ') {
+      field++;
+    } else if (field == 0) {
+      if (pos++ == 7 && c == '0')
+        close = true; // HTTP/1.0 closes unless told otherwise
+    } else if (field == 1 && isdigit((unsigned char)c)) {
+      if (++digits > 3)
+        state = State::FAILED; // Status codes are three digits
+      else
+        status = status * 10 + (c - '0');
+    }
+    break;
+
+  case State::HEADER_START:
+    if (c == '\r')
+      break;
+    if (c == '\n') {
+      end_of_headers();
+      break;
+    }
+    state = State::HEADER_NAME;
+    pos = 0;
+    candidates = (1 << HEADER_COUNT) - 1;
+    [[fallthrough]];
+  case State::HEADER_NAME:
+    if (c == ':') {
+      header = HEADER_OTHER;
+      for (uint8_t h = 0; h < HEADER_COUNT; h++) {
+        if ((candidates & (1u << h)) && HEADER_NAMES[h][pos] == '\0')
+          header = (Header)h;
+      }
+      if (header == HEADER_CONTENT_LENGTH)
+        content_length = 0;
+      value_match = 0;
+      state = State::HEADER_VALUE;
+    } else if (c == '\n') {
+      state = State::HEADER_START; // No colon, ignore the line
+    } else {
+      // Only names still matching are indexed, and pos never passes the end
+      // of one: a name is dropped once it is complete and more follows
+      char lc = (char)tolower((unsigned char)c);
+      for (uint8_t h = 0; h < HEADER_COUNT; h++) {
+        if ((candidates & (1u << h)) &&
+            (HEADER_NAMES[h][pos] == '\0' || HEADER_NAMES[h][pos] != lc))
+          candidates &= ~(1u << h);
+      }
+      if (pos < 255)
+        pos++;
+    }
+    break;
+
+  case State::HEADER_VALUE:
+    if (c == '\n') {
+      state = State::HEADER_START;
+    } else if (header == HEADER_CONTENT_LENGTH) {
+      if (isdigit((unsigned char)c)) {
+        int32_t digit = c - '0';
+        if (content_length > (CONTENT_LENGTH_MAX - digit) / 10)
+          state = State::FAILED; // Far beyond anything the bridge sends
+        else
+          content_length = content_length * 10 + digit;
+      }
+    } else if (header == HEADER_TRANSFER_ENCODING) {
+      if (match(CHUNKED_TOKEN, value_match, c))
+        chunked = true;
+    } else if (header == HEADER_CONNECTION) {
+      if (match(CLOSE_TOKEN, value_match, c))
+        close = true;
+    }
+    break;
+
+  case State::BODY:
+    body_byte(c);
+    if (--remaining == 0)
+      state = State::DONE;
+    break;
+
+  case State::BODY_UNTIL_CLOSE:
+    body_byte(c);
+    break;
+
+  case State::CHUNK_SIZE: {
+    int v = hex_value(c);
+    if (v >= 0) {
+      if (remaining > 0xffffff)
+        state = State::FAILED; // Far beyond anything the bridge sends
+      else
+        remaining = remaining * 16 + v;
+    } else if (c == '\n') {
+      end_of_chunk_size();
+    } else if (c == ';' || c == ' ' || c == '\t') {
+      state = State::CHUNK_EXT;
+    } else if (c != '\r') {
+      state = State::FAILED;
+    }
+    break;
+  }
+
+  case State::CHUNK_EXT:
+    if (c == '\n')
+      end_of_chunk_size();
+    break;
+
+  case State::CHUNK_DATA:
+    body_byte(c);
+    if (--remaining == 0)
+      state = State::CHUNK_END;
+    break;
+
+  case State::CHUNK_END:
+    if (c == '\n')
+      state = State::CHUNK_SIZE;
+    else if (c != '\r')
+      state = State::FAILED;
+    break;
+
+  case State::TRAILER:
+    if (c == '\n') {
+      if (line_empty)
+        state = State::DONE;
+      line_empty = true;
+    } else if (c != '\r') {
+      line_empty = false;
+    }
+    break;
+
+  case State::DONE:
+  case State::FAILED:
+    break;
+  }
+}
+
+void HttpResponseParser::end_of_headers() {
+  // 1xx, 204 and 304 never have a body
+  if (status < 200 || status == 204 || status == 304) {
+    state = State::DONE;
+  } else if (chunked) {
+    state = State::CHUNK_SIZE;
+    remaining = 0;
+  } else if (content_length > 0) {
+    state = State::BODY;
+    remaining = (uint32_t)content_length;
+  } else if (content_length == 0) {
+    state = State::DONE;
+  } else {
+    state = State::BODY_UNTIL_CLOSE;
+  }
+}
+
+void HttpResponseParser::end_of_chunk_size() {
+  if (remaining == 0) {
+    state = State::TRAILER; // Last chunk
+    line_empty = true;
+  } else {
+    state = State::CHUNK_DATA;
+  }
+}
+
+void HttpResponseParser::body_byte(char c) {
+  if (capture_state == CAPTURE_READING) {
+    if (c == capture_end) {
+      capture[capture_len] = '\0';
+      capture_state = CAPTURE_DONE;
+    } else if (capture_len < CAPTURE_MAX - 1) {
+      capture[capture_len++] = c;
+    }
+  } else if (capture_state == CAPTURE_SEEKING &&
+             match(capture_token, capture_match, c)) {
+    capture_state = CAPTURE_READING;
+  }
+
+  if (in_error_type) {
+    if (isdigit((unsigned char)c)) {
+      error_type = error_type * 10 + (c - '0');
+      return;
+    }
+    if (c != ' ' || error_type != 0)
+      in_error_type = false;
+  }
+  if (match(SUCCESS_TOKEN, success_match, c))
+    successes++;
+  if (match(ERROR_TOKEN, error_match, c))
+    errors++;
+  // Keep the type of the first error, it says what went wrong (e.g. 201:
+  // light is off, 901: bridge internal error)
+  if (match(TYPE_TOKEN, type_match, c) && errors == 1 && error_type == 0)
+    in_error_type = true;
+}
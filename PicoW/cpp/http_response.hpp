@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Incremental HTTP/1.1 response parser. Bytes are fed as they arrive (e.g.
+// straight from each pbuf of a chain) and examined in place: nothing is
+// copied or buffered, so a response may be split anywhere. Handles
+// Content-Length, chunked and read-until-close bodies, and scans the body for
+// the entries of a Hue JSON result array ([{"success":...},{"error":...}]).
+// One short value can be captured from the body, e.g. the id of a new
+// resource.
+class HttpResponseParser {
+public:
+  static constexpr size_t CAPTURE_MAX = 64;
+  // Longer bodies are taken as a malformed response
+  static constexpr int32_t CONTENT_LENGTH_MAX = 1024 * 1024;
+
+  HttpResponseParser() { reset(); }
+  void reset(); // Before each response, also clears the capture
+  // Capture the body text between token and end (exclusive) on the first
+  // occurrence, truncated to CAPTURE_MAX - 1. token must stay valid.
+  void set_capture(const char *token, char end);
+
+  // Consumes up to len bytes, stopping at the end of the response so the
+  // rest (the next pipelined response) can be fed after a reset(). Returns
+  // the number of bytes consumed.
+  size_t feed(const char *data, size_t len);
+
+  bool at_start() const { return state == State::STATUS_LINE && pos == 0; }
+  bool is_done() const { return state == State::DONE; }
+  bool is_failed() const { return state == State::FAILED; }
+  bool headers_complete() const { return state >= State::BODY; }
+  // No length given: the body runs until the connection closes
+  bool reads_until_close() const { return state == State::BODY_UNTIL_CLOSE; }
+
+  int get_status() const { return status; }
+  bool keep_alive() const { return !close; }
+  uint16_t get_successes() const { return successes; }
+  uint16_t get_errors() const { return errors; }
+  uint16_t get_error_type() const { return error_type; } // First error, or 0
+  // Captured text, or nullptr if the token was not seen
+  const char *get_capture() const {
+    return capture_state == CAPTURE_DONE ? capture : nullptr;
+  }
+
+private:
+  // Ordered so that everything from BODY on is past the headers
+  enum class State : uint8_t {
+    STATUS_LINE,
+    HEADER_START,
+    HEADER_NAME,
+    HEADER_VALUE,
+    BODY,
+    BODY_UNTIL_CLOSE,
+    CHUNK_SIZE,
+    CHUNK_EXT,
+    CHUNK_DATA,
+    CHUNK_END,
+    TRAILER,
+    DONE,
+    FAILED,
+  };
+  enum CaptureState : uint8_t {
+    CAPTURE_OFF,
+    CAPTURE_SEEKING,
+    CAPTURE_READING,
+    CAPTURE_DONE,
+  };
+  enum Header : uint8_t {
+    HEADER_CONTENT_LENGTH,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_CONNECTION,
+    HEADER_COUNT,
+    HEADER_OTHER = HEADER_COUNT,
+  };
+
+  void consume(char c);
+  void end_of_headers();
+  void end_of_chunk_size();
+  void body_byte(char c);
+
+  State state;
+  uint8_t pos;        // Within the status line or header name
+  uint8_t field;      // Of the status line: version, code, reason
+  uint8_t digits;     // Of the status code so far
+  uint8_t candidates; // Bit per Header still matching the name so far
+  Header header;
+  uint8_t value_match; // Progress matching "chunked" / "close"
+  bool line_empty;     // Trailer line has no characters yet
+
+  int status;
+  bool close;
+  bool chunked;
+  int32_t content_length; // -1 if not given
+  uint32_t remaining;     // Body or chunk bytes still to come
+
+  // Body scan
+  uint8_t success_match;
+  uint8_t error_match;
+  uint8_t type_match;
+  bool in_error_type; // Reading the digits after "type":
+  uint16_t successes;
+  uint16_t errors;
+  uint16_t error_type;
+
+  const char *capture_token;
+  char capture_end;
+  CaptureState capture_state;
+  uint8_t capture_match;
+  uint8_t capture_len;
+  char capture[CAPTURE_MAX];
+};
@@ -1,311 +1,790 @@
 #include "hue_client.hpp"
-#include "lwip/ip_addr.h"
-#include "lwip/tcp.h"
-#include <cmath>
+#include "color_math.hpp"
+#include "log.hpp"
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 
-// Defined in CMake from .env
-#ifndef HUE_IP
-#define HUE_IP "192.168.1.100"
-#endif
-#ifndef HUE_USER
-#define HUE_USER "user"
-#endif
-#ifndef HUE_GROUP
-#define HUE_GROUP "1"
-#endif
+// Response tags of the stream activation PUT and the reachability probe;
+// colour requests are tagged with their target index
+static const uint32_t STREAM_TAG = 0xffff;
+static const uint32_t PROBE_TAG = 0xfffe;
+static const uint32_t SCENE_TAG = 0xfffd;
+
+// API error "internal error", which the bridge answers when overloaded
+static const uint16_t HUE_ERROR_BRIDGE_BUSY = 901;
+
+// Adaptive rate limits (requests per 1000 s). The bridge handles about one
+// group and ten light commands per second: start there and probe upwards.
+static const TokenBucket::Config RATE_LIMITS[HUE_TARGET_COUNT] = {
+    {1000, 250, 2000, 50, 1, HUE_RTT_TARGET_MS},    // Group
+    {5000, 1000, 10000, 250, 2, HUE_RTT_TARGET_MS}, // Light
+};
+
+// Bodies end in a fixed-width "transitiontime":NNN}, the templates stop
+// before the value so it can be appended per command. Every suffix is built
+// once in build_templates(), indexed by the transition.
+static const size_t TRANSITION_SUFFIX_LEN = 4;
+static char transition_suffixes[HUE_TRANSITION_MAX_DS + 1]
+                               [TRANSITION_SUFFIX_LEN + 1];
+static_assert(HUE_TRANSITION_MAX_DS <= 999, "Transitions are three digits");
+
+static bool same_color(Color a, Color b) {
+  return a.r == b.r && a.g == b.g && a.b == b.b;
+}
 
-// TCP Callback prototypes
-static err_t hue_connected(void *arg, struct tcp_pcb *tpcb, err_t err);
-static void hue_err(void *arg, err_t err);
+static void reconcile_timer_handler(btstack_timer_source_t *ts) {
+  static_cast<HueClient *>(btstack_run_loop_get_timer_context(ts))
+      ->reconcile(to_ms_since_boot(get_absolute_time()));
+}
 
-static HueClient *g_hue_client = nullptr;
+static void probe_timer_handler(btstack_timer_source_t *ts) {
+  static_cast<HueClient *>(btstack_run_loop_get_timer_context(ts))
+      ->probe(to_ms_since_boot(get_absolute_time()));
+  btstack_run_loop_set_timer(ts, HUE_PROBE_TICK_MS);
+  btstack_run_loop_add_timer(ts);
+}
 
 HueClient::HueClient()
-    : last_update_ms(0), request_in_progress(false), first_run(true),
-      hub_reachable(false) {
-  last_color = {0, 0, 0};
-  g_hue_client = this;
+    : hub_reachable(false), config(), last_update_ms(0), off_latched(false),
+      target_count(0), first_run(true), probe_pending(false), probe_sent_ms(0),
+      last_contact_ms(0), probe_request_len(0), template_count(0) {
+  desired_color = {0, 0, 0};
+  off_color = {0, 0, 0};
+  memset(targets, 0, sizeof(targets));
+  memset(&staleness, 0, sizeof(staleness));
+  for (int i = 0; i < HUE_TARGET_COUNT; i++)
+    rate_limits[i].init(RATE_LIMITS[i]);
+  btstack_run_loop_set_timer_handler(&reconcile_timer,
+                                     &reconcile_timer_handler);
+  btstack_run_loop_set_timer_context(&reconcile_timer, this);
+  btstack_run_loop_set_timer_handler(&probe_timer, &probe_timer_handler);
+  btstack_run_loop_set_timer_context(&probe_timer, this);
+  off_template = {{0, 0, 0}, nullptr, 0};
+#if HUE_ENTERTAINMENT
+  stream_configured = false;
+  stream_activating = false;
+  last_stream_attempt_ms = 0;
+#endif
+#if HUE_SCENES
+  memset(scene_templates, 0, sizeof(scene_templates));
+  memset(scenes_failed, 0, sizeof(scenes_failed));
+  memset(scenes_created, 0, sizeof(scenes_created));
+  scene_arena_used = 0;
+  scene_step = SceneStep::IDLE;
+  scene_target = 0;
+  scene_zone = 0;
+  scene_lights[0] = '\0';
+#endif
+  connection.set_response_callback([this](const HueResponse &response) {
+    // Any answer shows the bridge is there, a dead connection that it is not
+    if (response.status != 0)
+      last_contact_ms = to_ms_since_boot(get_absolute_time());
+    set_reachable(response.status != 0);
+    if (response.tag == PROBE_TAG) {
+      probe_pending = false;
+      return;
+    }
+#if HUE_SCENES
+    if (response.tag == SCENE_TAG) {
+      on_scene_response(response);
+      return;
+    }
+#endif
+#if HUE_ENTERTAINMENT
+    if (response.tag == STREAM_TAG) {
+      stream_activating = false;
+      if (response.status == 200 && !response.api_error)
+        stream.start();
+      else
+        LOG_WARN("[Hue] Stream activation failed (status %d)\n",
+                 response.status);
+      reconcile(to_ms_since_boot(get_absolute_time()));
+      return;
+    }
+#endif
+    on_response(response);
+  });
 }
 
-void HueClient::init() {
-  printf("Hue Client Initialized. Target: %s Group: %s\n", HUE_IP, HUE_GROUP);
+void HueClient::init(const HueBridgeConfig &config) {
+  this->config = config;
+  init_targets();
+  if (targets[0].type == HUE_TARGET_LIGHT)
+    printf("Hue Client Initialized. Target: %s Lights: %s\n", config.ip,
+           config.lights);
+  else
+    printf("Hue Client Initialized. Target: %s Group: %s\n", config.ip,
+           config.groups);
+  build_templates();
+#if HUE_SCENES
+  scene_store.init(config.ip);
+  for (uint8_t t = 0; t < target_count; t++) {
+    for (uint8_t k = 0; k < template_count; k++) {
+      char id[HUE_SCENE_ID_MAX];
+      if (targets[t].type == HUE_TARGET_GROUP &&
+          scene_store.load(targets[t].id, k, templates[k].color, id))
+        add_scene_template(t, k, id);
+    }
+  }
+  printf("[Hue] %d bytes of cached scene recalls\n", (int)scene_arena_used);
+#endif
+  probe_request_len = snprintf(probe_request, sizeof(probe_request),
+                               "GET /api/config HTTP/1.1\r\n"
+                               "Host: %s\r\n"
+                               "\r\n",
+                               config.ip);
+  connection.init(config.ip, 80);
+
+  // Reachability is probed from the run loop from now on
+  probe(to_ms_since_boot(get_absolute_time()));
+  btstack_run_loop_set_timer(&probe_timer, HUE_PROBE_TICK_MS);
+  btstack_run_loop_add_timer(&probe_timer);
+#if HUE_SCENES
+  provision_scenes();
+#endif
+#if HUE_ENTERTAINMENT
+  stream_configured = config.clientkey[0] &&
+                      stream.init(config.ip, config.user, config.clientkey,
+                                  config.ent_lights);
+  if (stream_configured)
+    activate_stream(to_ms_since_boot(get_absolute_time()));
+#endif
 }
 
-// Blocking TCP connect to check if Hue bridge is reachable
-// Must be called before BTstack run loop starts (uses polling)
-static volatile bool reachability_done;
-static volatile bool reachability_result;
-
-static err_t reachable_connected(void *arg, struct tcp_pcb *tpcb, err_t err) {
-  (void)arg;
-  reachability_result = (err == ERR_OK);
-  reachability_done = true;
-  tcp_close(tpcb);
-  return ERR_OK;
+#if HUE_ENTERTAINMENT
+// The bridge only accepts DTLS once streaming is active for the group
+void HueClient::activate_stream(uint32_t now) {
+  char path[96];
+  snprintf(path, sizeof(path), "/api/%s/groups/%s", config.user,
+           config.ent_group);
+  printf("[Hue] Activating entertainment group %s\n", config.ent_group);
+  last_stream_attempt_ms = now;
+  stream_activating =
+      send_http("PUT", path, "{\"stream\":{\"active\":true}}", STREAM_TAG);
 }
+#endif
 
-static void reachable_err(void *arg, err_t err) {
-  (void)arg;
-  (void)err;
-  reachability_result = false;
-  reachability_done = true;
+void HueClient::set_reachability_callback(std::function<void(bool)> cb) {
+  reachability_callback = cb;
 }
 
-bool HueClient::check_reachable() {
-  printf("[Hue] Checking reachability of %s...\n", HUE_IP);
+void HueClient::set_reachable(bool reachable) {
+  if (reachable == hub_reachable)
+    return;
+  hub_reachable = reachable;
+  printf("[Hue] Hub reachable: %s\n", hub_reachable ? "YES" : "NO");
+  if (reachability_callback)
+    reachability_callback(hub_reachable);
+}
 
-  ip_addr_t ip;
-  if (!ipaddr_aton(HUE_IP, &ip)) {
-    printf("[Hue] Invalid IP: %s\n", HUE_IP);
-    hub_reachable = false;
-    return false;
+// Non-blocking reachability check, run every HUE_PROBE_TICK_MS. Colour
+// traffic counts as contact, so an active bridge is not probed at all.
+void HueClient::probe(uint32_t now) {
+#if HUE_SCENES
+  provision_scenes(); // Resume after a failed connection
+#endif
+  if (probe_pending) {
+    // Stays queued until the connection is back; its answer then marks the
+    // bridge reachable again
+    if (now - probe_sent_ms > HUE_PROBE_TIMEOUT_MS)
+      set_reachable(false);
+    return;
   }
+  if (hub_reachable && now - last_contact_ms < HUE_PROBE_INTERVAL_MS)
+    return;
+  if (probe_request_len <= 0 || probe_request_len >= (int)sizeof(probe_request))
+    return;
 
-  reachability_done = false;
-  reachability_result = false;
+  probe_sent_ms = now;
+  probe_pending =
+      connection.request(probe_request, probe_request_len, PROBE_TAG);
+  LOG_DEBUG("[Hue] Probe %s\n", probe_pending ? "sent" : "deferred");
+}
 
-  cyw43_arch_lwip_begin();
-  struct tcp_pcb *pcb = tcp_new();
-  if (!pcb) {
-    cyw43_arch_lwip_end();
-    printf("[Hue] Failed to create PCB for reachability check\n");
-    hub_reachable = false;
-    return false;
+// One target per light if lights are configured, otherwise one per group
+void HueClient::init_targets() {
+  bool lights = config.lights[0] != '\0';
+  HueTarget type = lights ? HUE_TARGET_LIGHT : HUE_TARGET_GROUP;
+  target_count = 0;
+  const char *p = lights ? config.lights : config.groups;
+  while (*p && target_count < HUE_MAX_TARGETS) {
+    char *end;
+    long id = strtol(p, &end, 10);
+    if (end == p)
+      break;
+    Target &t = targets[target_count++];
+    t.type = type;
+    t.id = (uint16_t)id;
+    if (lights)
+      snprintf(t.path, sizeof(t.path), "/api/%s/lights/%ld/state",
+               config.user, id);
+    else
+      snprintf(t.path, sizeof(t.path), "/api/%s/groups/%ld/action",
+               config.user, id);
+    p = (*end == ',') ? end + 1 : end;
+  }
+  if (target_count == 0) {
+    // Group 0 is all lights
+    Target &t = targets[target_count++];
+    t.type = HUE_TARGET_GROUP;
+    snprintf(t.path, sizeof(t.path), "/api/%s/groups/0/action", config.user);
   }
+}
 
-  tcp_err(pcb, reachable_err);
-  err_t err = tcp_connect(pcb, &ip, 80, reachable_connected);
-  cyw43_arch_lwip_end();
+// Records the desired colour. Each target is sent it as soon as it has no
+// request in flight and the rate budget allows; colours arriving meanwhile
+// replace it.
+void HueClient::update(Color color) {
+  uint32_t now = to_ms_since_boot(get_absolute_time());
+  LOG_DEBUG("[Hue] Update? Now:%lu Last:%lu Color:%06lx\n", now,
+            last_update_ms,
+            ((uint32_t)color.r << 16) | ((uint32_t)color.g << 8) | color.b);
 
-  if (err != ERR_OK) {
-    printf("[Hue] tcp_connect failed: %d\n", err);
-    hub_reachable = false;
-    return false;
+  // Off stays off while the power stays in the zone it was turned off in
+  if (off_latched) {
+    if (same_color(color, off_color))
+      return;
+    off_latched = false;
   }
 
-  // Poll until connected or timeout (3 seconds)
-  uint32_t start = to_ms_since_boot(get_absolute_time());
-  while (!reachability_done) {
-    uint32_t now = to_ms_since_boot(get_absolute_time());
-    if (now - start > 3000) {
-      printf("[Hue] Reachability check timed out\n");
-      cyw43_arch_lwip_begin();
-      tcp_abort(pcb);
-      cyw43_arch_lwip_end();
-      hub_reachable = false;
-      return false;
+  if (!same_color(color, desired_color)) {
+    for (uint8_t i = 0; i < target_count; i++) {
+      Target &t = targets[i];
+      if (t.dirty && !same_color(desired_color, t.sent_color))
+        staleness.superseded++;
+      // Back to what the light already shows, unless a different colour is
+      // still in flight: the light ends up on that one
+      bool in_flight_other = t.in_flight && !same_color(color, t.sent_color);
+      if (t.applied_valid && same_color(color, t.applied_color) &&
+          !in_flight_other) {
+        t.dirty = false;
+      } else if (!t.dirty) {
+        t.dirty = true;
+        t.dirty_since_ms = now;
+      }
     }
-    cyw43_arch_poll();
-    sleep_ms(10);
+    desired_color = color;
   }
 
-  hub_reachable = reachability_result;
-  printf("[Hue] Hub reachable: %s\n", hub_reachable ? "YES" : "NO");
-  return hub_reachable;
-}
-
-// Simple RGB to HSV/Hue mapping
-// Hue: 0-65535
-// Sat: 0-254
-// Bri: 0-254
-void HueClient::update(Color color) {
-  uint32_t now = to_ms_since_boot(get_absolute_time());
-  printf("[Hue] Update? Now:%lu Last:%lu InProg:%d First:%d Color:%d,%d,%d\n",
-         now, last_update_ms, request_in_progress, first_run, color.r, color.g,
-         color.b);
-  if (now - last_update_ms < HUE_UPDATE_INTERVAL_MS) {
-    // printf("[Hue] Throttled.\n");
+#if HUE_ENTERTAINMENT
+  // Streaming takes every colour change, unthrottled
+  if (stream.is_active()) {
+    stream.set_color(color);
     return;
   }
-  if (request_in_progress) {
-    if (now - last_update_ms > 5000) {
-      printf("[Hue] Request stuck > 5s. Forcing reset.\n");
-      request_in_progress = false;
-    } else {
-      printf("[Hue] Request in progress. Skipping.\n");
-      return;
-    }
+  if (stream_configured && !stream_activating &&
+      now - last_stream_attempt_ms > HUE_STREAM_RETRY_MS) {
+    activate_stream(now);
+    return;
   }
+#endif
+  reconcile(now);
+}
 
-  // Check if color changed significantly?
-  // Check if color changed significantly?
-  if (color.r == last_color.r && color.g == last_color.g &&
-      color.b == last_color.b) {
-    if (now - last_update_ms > 5000) {
-      printf("[Hue] Color unchanged (R%d G%d B%d). Skipping.\n", color.r,
-             color.g, color.b);
-      last_update_ms = now;
+// The dirty target without a request in flight that has been out of date
+// the longest (earlier ones in the list win ties). With a stagger, a
+// light becomes due only once the lights before it had their turn; wait_ms
+// is lowered to when the next one does.
+HueClient::Target *HueClient::next_target(uint32_t now, uint32_t &wait_ms) {
+  Target *best = nullptr;
+  for (uint8_t i = 0; i < target_count; i++) {
+    Target &t = targets[i];
+    if (!t.dirty || t.in_flight)
+      continue;
+    uint32_t age = now - t.dirty_since_ms;
+    uint32_t due = (uint32_t)i * HUE_LIGHT_STAGGER_MS;
+    if (age < due) {
+      if (due - age < wait_ms)
+        wait_ms = due - age;
+      continue;
     }
+    if (!best || (int32_t)(t.dirty_since_ms - best->dirty_since_ms) < 0)
+      best = &t;
+  }
+  return best;
+}
+
+// Fill the pipeline with the most out of date targets the rate budget allows
+void HueClient::reconcile(uint32_t now) {
+#if HUE_ENTERTAINMENT
+  if (stream.is_active())
     return;
+#endif
+  uint32_t wait_ms = UINT32_MAX;
+  while (connection.can_accept()) { // Otherwise on_response() calls back in
+    Target *t = next_target(now, wait_ms);
+    if (!t)
+      break;
+    TokenBucket &bucket = rate_limits[t->type];
+    if (!bucket.try_acquire(now)) {
+      uint32_t ms = bucket.ms_until_available(now);
+      if (ms < wait_ms)
+        wait_ms = ms;
+      break;
+    }
+
+    uint32_t last_sent_ms = t->last_sent_ms;
+    uint32_t interval_ms = t->interval_ms;
+    if (t->last_sent_ms) {
+      // Gaps beyond the longest fade say nothing about the cadence
+      uint32_t gap = now - t->last_sent_ms;
+      if (gap > HUE_TRANSITION_MAX_DS * 100)
+        gap = HUE_TRANSITION_MAX_DS * 100;
+      t->interval_ms = t->interval_ms ? (t->interval_ms * 3 + gap) / 4 : gap;
+    }
+    t->last_sent_ms = now;
+    t->sent_color = desired_color;
+    t->in_flight = true;
+    first_run = false;
+    if (!send_color((uint8_t)(t - targets))) {
+      // Not sent: give the token back and try again shortly
+      t->in_flight = false;
+      t->last_sent_ms = last_sent_ms;
+      t->interval_ms = interval_ms;
+      bucket.release();
+      if (HUE_SEND_RETRY_MS < wait_ms)
+        wait_ms = HUE_SEND_RETRY_MS;
+      break;
+    }
+    last_update_ms = now;
   }
 
-  last_update_ms = now;
-  last_color = color;
-  last_update_ms = now;
-  last_color = color;
-  request_in_progress = true;
-  first_run = false;
-
-  // Convert RGB to Hue/Sat/Bri
-  // This is a rough approximation.
-  // Normalized R,G,B [0,1]
-  float r = color.r / 255.0f;
-  float g = color.g / 255.0f;
-  float b = color.b / 255.0f;
-
-  float max_val = (r > g) ? ((r > b) ? r : b) : ((g > b) ? g : b);
-  float min_val = (r < g) ? ((r < b) ? r : b) : ((g < b) ? g : b);
-  float delta = max_val - min_val;
-
-  float hue_f = 0;
-  if (delta == 0) {
-    hue_f = 0;
-  } else if (max_val == r) {
-    hue_f = 60 * fmod(((g - b) / delta), 6.0f);
-  } else if (max_val == g) {
-    hue_f = 60 * (((b - r) / delta) + 2);
-  } else {
-    hue_f = 60 * (((r - g) / delta) + 4);
+  if (wait_ms != UINT32_MAX) {
+    // Send when the rate budget or the stagger allows, or retry a send
+    btstack_run_loop_remove_timer(&reconcile_timer);
+    btstack_run_loop_set_timer(&reconcile_timer, wait_ms);
+    btstack_run_loop_add_timer(&reconcile_timer);
   }
+}
 
-  if (hue_f < 0)
-    hue_f += 360;
+void HueClient::record_staleness(uint32_t stale_ms) {
+  staleness.count++;
+  staleness.last_ms = stale_ms;
+  staleness.total_ms += stale_ms;
+  staleness.avg_ms = staleness.avg_ms ? (staleness.avg_ms * 7 + stale_ms) / 8
+                                      : stale_ms;
+  if (stale_ms > staleness.max_ms)
+    staleness.max_ms = stale_ms;
+}
 
-  // Map 0-360 -> 0-65535
-  uint16_t hue_api = (uint16_t)((hue_f / 360.0f) * 65535);
+void HueClient::on_response(const HueResponse &response) {
+  uint32_t now = to_ms_since_boot(get_absolute_time());
+  if (response.tag >= target_count)
+    return;
+  Target &t = targets[response.tag];
+  t.in_flight = false;
+  TokenBucket &bucket = rate_limits[t.type];
+  bool was_dirty = t.dirty;
+  if (response.status == 200 && !response.api_error) {
+    bucket.on_success(response.latency_ms);
+    t.applied_color = t.sent_color;
+    t.applied_valid = true;
+  } else {
+    // Error, busy or no answer. The state of the light is unknown (dirty),
+    // so resend once the rate budget allows. Only a busy bridge slows the
+    // rate: a lost connection or a rejected request says nothing about load.
+    LOG_WARN("[Hue] Request %lu failed (status %d, error type %d)\n",
+             response.tag, response.status, response.error_type);
+    bool busy = response.status == 429 || response.status == 503 ||
+                (response.api_error &&
+                 response.error_type == HUE_ERROR_BRIDGE_BUSY);
+    bucket.on_error(busy);
+    t.applied_valid = false;
+#if HUE_SCENES
+    // The scene was deleted on the bridge (resource not available / invalid
+    // value): forget it, the colour is sent instead and the scene recreated
+    // unless it was already created this boot
+    if (t.sent_scene >= 0 && response.api_error &&
+        (response.error_type == 3 || response.error_type == 7)) {
+      printf("[Hue] Scene for group %d zone %d is gone\n", t.id,
+             t.sent_scene);
+      scene_store.forget(t.id, (uint8_t)t.sent_scene);
+      scene_templates[response.tag][t.sent_scene].data = nullptr;
+      provision_scenes();
+    }
+#endif
+  }
+  // The desired colour may have changed, or changed back, while in flight
+  t.dirty = !t.applied_valid || !same_color(t.applied_color, desired_color);
+  if (was_dirty && !t.dirty)
+    record_staleness(now - t.dirty_since_ms);
+  else if (!was_dirty && t.dirty)
+    t.dirty_since_ms = now;
+  reconcile(now);
+}
 
-  // Saturation
-  float sat_f = (max_val == 0) ? 0 : (delta / max_val);
-  uint8_t sat_api = (uint8_t)(sat_f * 254);
+uint8_t HueClient::transition_ds(const Target &target) {
+  if (target.interval_ms == 0)
+    return HUE_TRANSITION_DEFAULT_DS;
+  uint32_t ds = (target.interval_ms + 50) / 100;
+  return ds > HUE_TRANSITION_MAX_DS ? HUE_TRANSITION_MAX_DS : (uint8_t)ds;
+}
 
-  // Brightness
-  uint8_t bri_api = (uint8_t)(max_val * 254);
+bool HueClient::send_color(uint8_t index) {
+  Target &target = targets[index];
+  const RequestTemplate *t = find_template(target.sent_color);
+#if HUE_SCENES
+  target.sent_scene = -1;
+#endif
+  if (t && target.request_line) {
+    const char *suffix = transition_suffixes[transition_ds(target)];
+#if HUE_SCENES
+    int zone = (t == &off_template) ? -1 : (int)(t - templates);
+    const RequestTemplate *scene =
+        zone >= 0 ? &scene_templates[index][zone] : nullptr;
+    if (scene && scene->data) {
+      LOG_DEBUG("[Hue] Recall scene %d on target %d\n", zone, index);
+      target.sent_scene = (int8_t)zone;
+      return connection.request_static(
+          target.request_line, target.request_line_len, scene->data,
+          scene->len, suffix, TRANSITION_SUFFIX_LEN, index);
+    }
+#endif
+    LOG_DEBUG("[Hue] PUT template %d to target %d\n", (int)(t - templates),
+              index);
+    return connection.request_static(target.request_line,
+                                     target.request_line_len, t->data,
+                                     t->len, suffix, TRANSITION_SUFFIX_LEN,
+                                     index);
+  }
 
-  // Ensure "on":true is sent. If Black, turn off?
-  // User logic said: {"on":true, ...}
-  // If color is black (0,0,0), maybe turn off?
-  // Let's stick to user request for structure but handle OFF if bri is 0.
+  // Colours outside the zone table are formatted on the fly
+  uint16_t hue_api;
+  uint8_t sat_api, bri_api;
+  color_to_hsb(target.sent_color, hue_api, sat_api, bri_api);
+  return send_request(index, hue_api, sat_api, bri_api);
+}
 
-  send_request(hue_api, sat_api, bri_api);
+uint32_t HueClient::get_latency_ms() const {
+#if HUE_ENTERTAINMENT
+  if (stream.is_active())
+    return HUE_LIGHT_DELAY_MS; // Frames go out as colours arrive
+#endif
+  if (staleness.count == 0)
+    return 0;
+  return staleness.avg_ms + HUE_LIGHT_DELAY_MS;
 }
 
+// Black maps to {"on":false}
 void HueClient::turn_off() {
   printf("[Hue] Turning OFF.\n");
-  // send_request with brightness 0 triggers {"on":false} logic in send_request
-  send_request(0, 0, 0);
+  Color shown = desired_color;
+  off_latched = false;
+  update({0, 0, 0});
+  off_color = shown;
+  off_latched = true;
 }
 
-void HueClient::send_request(uint16_t hue, uint8_t sat, uint8_t bri) {
-  struct tcp_pcb *pcb = tcp_new();
-  if (!pcb) {
-    printf("Hue: Failed to create PCB\n");
-    request_in_progress = false;
-    return;
+// The next update() is sent even in the zone the lights were turned off in
+void HueClient::wake() { off_latched = false; }
+
+void HueClient::print_stats() {
+  connection.print_stats();
+  LOG_TELEMETRY("[Hue] Staleness last %lu ms, avg %lu ms, max %lu ms\n",
+                staleness.last_ms,
+                staleness.count ? staleness.total_ms / staleness.count : 0,
+                staleness.max_ms);
+  LOG_TELEMETRY(
+      "[Hue] Applied %lu, superseded before sending %lu (%d targets)\n",
+      staleness.count, staleness.superseded, target_count);
+  LOG_TELEMETRY("[Hue] Cadence %lu ms, transition %d ms\n",
+                targets[0].interval_ms, transition_ds(targets[0]) * 100);
+  for (int i = 0; i < HUE_TARGET_COUNT; i++) {
+    const TokenBucket &bucket = rate_limits[i];
+    const TokenBucket::Stats &st = bucket.get_stats();
+    if (st.granted == 0)
+      continue;
+    const char *name = (i == HUE_TARGET_GROUP) ? "Group" : "Light";
+    LOG_TELEMETRY("[Hue] %s rate %lu/1000s, rtt %lu ms\n", name,
+                  bucket.get_rate_mrps(), bucket.get_rtt_ms());
+    LOG_TELEMETRY("[Hue] %s sent %lu, errors %lu (busy %lu), rate decreases "
+                  "%lu\n",
+                  name, st.granted, st.errors, st.busy, st.decreases);
   }
+#if HUE_ENTERTAINMENT
+  if (stream_configured)
+    stream.print_stats();
+#endif
+}
 
-  char *payload = (char *)malloc(512);
-  if (!payload) {
-    tcp_close(pcb);
-    request_in_progress = false;
-    return;
-  }
+// Hue: 0-65535, Sat: 0-254, Bri: 0-254
+void HueClient::color_to_hsb(Color color, uint16_t &hue, uint8_t &sat,
+                             uint8_t &bri) {
+  HueHsb hsb = rgb_to_hsb(color);
+  hue = hsb.hue;
+  sat = hsb.sat;
+  bri = hsb.bri;
+}
 
-  // Construct JSON Body
-  char body[128];
+// Brightness 0 turns the group or light off. Transition is in 100 ms.
+void HueClient::format_body(char *buf, size_t size, uint16_t hue, uint8_t sat,
+                            uint8_t bri, uint8_t transition) {
   if (bri == 0) {
-    sprintf(body, "{\"on\":false}");
+    snprintf(buf, size, "{\"on\":false, \"transitiontime\":%3u}",
+             transition);
   } else {
-    sprintf(body, "{\"on\":true, \"sat\":%d, \"bri\":%d, \"hue\":%d}", sat, bri,
-            hue);
+    snprintf(buf, size,
+             "{\"on\":true, \"sat\":%d, \"bri\":%d, \"hue\":%d, "
+             "\"transitiontime\":%3u}",
+             sat, bri, hue, transition);
   }
+}
 
-  // Construct HTTP Request
-  sprintf(payload,
-          "PUT /api/%s/groups/%s/action HTTP/1.1\r\n"
-          "Host: %s\r\n"
-          "Content-Type: application/json\r\n"
-          "Content-Length: %d\r\n"
-          "\r\n"
-          "%s",
-          HUE_USER, HUE_GROUP, HUE_IP, (int)strlen(body), body);
-
-  printf("[Hue] Target: %s URL: /api/%s/groups/%s/action\n", HUE_IP, HUE_USER,
-         HUE_GROUP);
-  printf("[Hue] Body: %s\n", body);
-
-  tcp_arg(pcb, payload); // Pass payload as arg
-  tcp_err(pcb, hue_err);
-
-  ip_addr_t ip;
-  if (!ipaddr_aton(HUE_IP, &ip)) {
-    printf("Hue: Invalid IP Address string: '%s'\n", HUE_IP);
-    free(payload);
-    tcp_close(pcb);
-    request_in_progress = false;
-    return;
+// Everything after the request line (keep-alive is the HTTP/1.1 default).
+// Returns the length, or -1 if it does not fit.
+int HueClient::format_headers(char *buf, size_t size,
+                              const char *body) const {
+  int len = snprintf(buf, size,
+                     "Host: %s\r\n"
+                     "Content-Type: application/json\r\n"
+                     "Content-Length: %d\r\n"
+                     "\r\n"
+                     "%s",
+                     config.ip, (int)strlen(body), body);
+  return (len >= 0 && len < (int)size) ? len : -1;
+}
+
+// Full request. Returns the length, or -1 if it does not fit.
+int HueClient::format_request(char *buf, size_t size, const char *method,
+                              const char *path, const char *body) const {
+  int line = snprintf(buf, size, "%s %s HTTP/1.1\r\n", method, path);
+  if (line < 0 || line >= (int)size)
+    return -1;
+  int len = format_headers(buf + line, size - line, body);
+  return len < 0 ? -1 : line + len;
+}
+
+void HueClient::build_templates() {
+  for (uint8_t ds = 0; ds <= HUE_TRANSITION_MAX_DS; ds++)
+    snprintf(transition_suffixes[ds], sizeof(transition_suffixes[ds]),
+             "%3u}", ds);
+
+  size_t used = 0;
+  for (uint8_t i = 0; i < target_count; i++) {
+    Target &target = targets[i];
+    char *line = &template_arena[used];
+    int len = snprintf(line, sizeof(template_arena) - used,
+                       "PUT %s HTTP/1.1\r\n", target.path);
+    if (len < 0 || len >= (int)(sizeof(template_arena) - used)) {
+      printf("[Hue] Template arena full, target %d formatted per request\n",
+             i);
+      target.request_line = nullptr;
+      continue;
+    }
+    target.request_line = line;
+    target.request_line_len = (uint16_t)len;
+    used += len;
   }
 
-  // printf("Hue: Connecting to %s...\n", ipaddr_ntoa(&ip)); // Optional debug
+  template_count = 0;
+  off_template.data = nullptr;
+  for (size_t i = 0; i <= POWER_ZONES.size(); i++) {
+    // The zones, then off
+    bool off = (i == POWER_ZONES.size());
+    if (!off && template_count == HUE_MAX_TEMPLATES)
+      continue;
+    uint16_t hue = 0;
+    uint8_t sat = 0, bri = 0;
+    if (!off)
+      color_to_hsb(POWER_ZONES[i].color, hue, sat, bri);
+
+    // Content-Length covers the suffix appended per command
+    char body[128];
+    format_body(body, sizeof(body), hue, sat, bri, 0);
+    int len = format_headers(&template_arena[used],
+                             sizeof(template_arena) - used, body);
+    if (len >= 0)
+      len -= TRANSITION_SUFFIX_LEN;
+    if (len < 0) {
+      printf("[Hue] Template arena full, zone %d formatted per request\n",
+             (int)i);
+      continue;
+    }
 
-  tcp_connect(pcb, &ip, 80, hue_connected);
+    RequestTemplate &t = off ? off_template : templates[template_count++];
+    t.color = off ? Color{0, 0, 0} : POWER_ZONES[i].color;
+    t.data = &template_arena[used];
+    t.len = (uint16_t)len;
+    used += len;
+  }
+  printf("[Hue] %d zone request templates, %d targets (%d bytes)\n",
+         (int)template_count, target_count, (int)used);
 }
 
-// Callbacks
-static err_t hue_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p,
-                      err_t err) {
-  if (!p) {
-    // Server closed connection
-    tcp_close(tpcb);
-    if (g_hue_client)
-      g_hue_client->on_request_complete();
-    return ERR_OK;
+const HueClient::RequestTemplate *HueClient::find_template(Color color) const {
+  for (size_t i = 0; i < template_count; i++) {
+    const Color &c = templates[i].color;
+    if (same_color(c, color))
+      return &templates[i];
   }
+  if (off_template.data && same_color(color, off_template.color))
+    return &off_template;
+  return nullptr;
+}
 
-  // Reading response (limited by pbuf structure, but good enough for status)
-  if (p->payload) {
-    char buffer[128];
-    uint16_t len = p->len > 127 ? 127 : p->len;
-    memcpy(buffer, p->payload, len);
-    buffer[len] = 0;
-    printf("[Hue] Rx: %s\n", buffer);
-  }
+bool HueClient::send_request(uint8_t index, uint16_t hue, uint8_t sat,
+                             uint8_t bri) {
+  char body[128];
+  format_body(body, sizeof(body), hue, sat, bri,
+              transition_ds(targets[index]));
 
-  pbuf_free(p);
-  tcp_close(tpcb); // Close after first response
-  if (g_hue_client)
-    g_hue_client->on_request_complete();
+  LOG_DEBUG("[Hue] PUT target %d hue=%u sat=%u bri=%u\n", index, hue, sat,
+            bri);
 
-  return ERR_OK;
+  return send_http("PUT", targets[index].path, body, index);
 }
 
-static err_t hue_connected(void *arg, struct tcp_pcb *tpcb, err_t err) {
-  if (err != ERR_OK) {
-    printf("Hue Connect Error: %d\n", err);
-    if (arg)
-      free(arg);
-    if (g_hue_client)
-      g_hue_client->on_request_complete();
-    return err;
+// Queue a request on the keep-alive connection. Returns false if it could
+// not be queued.
+bool HueClient::send_http(const char *method, const char *path,
+                          const char *body, uint32_t tag, const char *capture,
+                          char capture_end, bool retry) {
+  int len =
+      format_request(request_buf, sizeof(request_buf), method, path, body);
+  return len >= 0 && connection.request(request_buf, len, tag, capture,
+                                        capture_end, retry);
+}
+
+#if HUE_SCENES
+static_assert(HUE_MAX_TEMPLATES <= 8, "scenes_created holds a bit per zone");
+
+static const char LIGHTS_TOKEN[] = "\"lights\":[";
+static const char ID_TOKEN[] = "\"id\":\"";
+
+// Appends the recall request for a scene to the arena
+void HueClient::add_scene_template(uint8_t target, uint8_t zone,
+                                   const char *id) {
+  char body[64];
+  snprintf(body, sizeof(body), "{\"scene\":\"%s\", \"transitiontime\":%3u}",
+           id, 0);
+  int len = format_headers(&scene_arena[scene_arena_used],
+                           sizeof(scene_arena) - scene_arena_used, body);
+  if (len < 0) {
+    printf("[Hue] Scene arena full, zone %d sends colours\n", zone);
+    return;
   }
+  RequestTemplate &t = scene_templates[target][zone];
+  t.color = templates[zone].color;
+  t.data = &scene_arena[scene_arena_used];
+  t.len = (uint16_t)(len - TRANSITION_SUFFIX_LEN);
+  scene_arena_used += len;
+}
 
-  char *payload = (char *)arg;
-  tcp_write(tpcb, payload, strlen(payload), TCP_WRITE_FLAG_COPY);
-  tcp_output(tpcb);
+bool HueClient::find_missing_scene(uint8_t &target, uint8_t &zone) const {
+  for (uint8_t t = 0; t < target_count; t++) {
+    if (targets[t].type != HUE_TARGET_GROUP || scenes_failed[t])
+      continue;
+    for (uint8_t k = 0; k < template_count; k++) {
+      if (!scene_templates[t][k].data && !(scenes_created[t] & (1u << k))) {
+        target = t;
+        zone = k;
+        return true;
+      }
+    }
+  }
+  return false;
+}
 
-  free(payload);
+// Sends the next provisioning request, if any is due and none is in flight
+void HueClient::provision_scenes() {
+  uint8_t t, k;
+  if (scene_step != SceneStep::IDLE || !find_missing_scene(t, k) ||
+      !connection.can_accept())
+    return;
 
-  // Do NOT close immediately. Wait for response.
-  tcp_recv(tpcb, hue_recv);
+  if (t != scene_target || scene_lights[0] == '\0') {
+    // Lights of the group, captured as "1","2",...
+    char path[96];
+    snprintf(path, sizeof(path), "/api/%s/groups/%d", config.user,
+             targets[t].id);
+    scene_target = t;
+    scene_lights[0] = '\0';
+    if (send_http("GET", path, "", SCENE_TAG, LIGHTS_TOKEN, ']'))
+      scene_step = SceneStep::LIGHTS;
+    return;
+  }
 
-  return ERR_OK;
+  scene_zone = k;
+  if (create_scene(t, k)) {
+    scene_step = SceneStep::CREATE;
+  } else if (scene_step == SceneStep::IDLE && scenes_failed[t]) {
+    provision_scenes(); // Next group
+  }
 }
 
-static void hue_err(void *arg, err_t err) {
-  if (arg)
-    free(arg);
-  if (g_hue_client)
-    g_hue_client->on_request_complete();
-  // printf("Hue Error: %d\n", err);
+// POST a scene holding the zone colour on every light of the group
+bool HueClient::create_scene(uint8_t target, uint8_t zone) {
+  uint16_t hue;
+  uint8_t sat, bri;
+  color_to_hsb(templates[zone].color, hue, sat, bri);
+
+  size_t size = sizeof(scene_body);
+  int n = snprintf(scene_body, size,
+                   "{\"name\":\"ZPL zone %d\",\"type\":\"GroupScene\","
+                   "\"group\":\"%d\",\"recycle\":false,\"lightstates\":{",
+                   zone + 1, targets[target].id);
+  int lights = 0;
+  const char *p = scene_lights;
+  while (*p && n > 0 && n < (int)size) {
+    char *end;
+    long id = strtol(p, &end, 10);
+    if (end == p) {
+      p++; // Quotes and commas
+      continue;
+    }
+    n += snprintf(&scene_body[n], size - n,
+                  "%s\"%ld\":{\"on\":true,\"bri\":%d,\"hue\":%d,\"sat\":%d}",
+                  lights++ ? "," : "", id, bri, hue, sat);
+    p = end;
+  }
+  if (n > 0 && n < (int)size)
+    n += snprintf(&scene_body[n], size - n, "}}");
+  if (lights == 0 || n <= 0 || n >= (int)size) {
+    printf("[Hue] Cannot build scene for group %d (%d lights)\n",
+           targets[target].id, lights);
+    scenes_failed[target] = true;
+    return false;
+  }
+
+  char path[96];
+  snprintf(path, sizeof(path), "/api/%s/scenes", config.user);
+  // Never written twice: scenes are not recycled, so each copy would stay
+  if (!send_http("POST", path, scene_body, SCENE_TAG, ID_TOKEN, '"', false))
+    return false;
+  scenes_created[target] |= (uint8_t)(1u << zone);
+  return true;
+}
+
+void HueClient::on_scene_response(const HueResponse &response) {
+  SceneStep step = scene_step;
+  scene_step = SceneStep::IDLE;
+  if (response.status == 0) {
+    // Connection lost, provision_scenes() resumes from the probe tick. A
+    // scene POST may have been applied: that zone is not created again.
+    if (step == SceneStep::CREATE)
+      printf("[Hue] Scene for group %d zone %d unconfirmed, sending colours\n",
+             targets[scene_target].id, scene_zone);
+    return;
+  }
+
+  Target &t = targets[scene_target];
+  bool ok = response.status == 200 && !response.api_error && response.capture;
+  if (ok && step == SceneStep::LIGHTS) {
+    strncpy(scene_lights, response.capture, sizeof(scene_lights) - 1);
+    scene_lights[sizeof(scene_lights) - 1] = '\0';
+  } else if (ok && step == SceneStep::CREATE &&
+             strlen(response.capture) < HUE_SCENE_ID_MAX) {
+    Color color = templates[scene_zone].color;
+    scene_store.store(t.id, scene_zone, color, response.capture);
+    add_scene_template(scene_target, scene_zone, response.capture);
+    if (!scene_templates[scene_target][scene_zone].data)
+      scenes_failed[scene_target] = true; // Arena full
+  } else {
+    printf("[Hue] Scene setup for group %d failed (status %d, error %d)\n",
+           t.id, response.status, response.error_type);
+    scenes_failed[scene_target] = true;
+  }
+  provision_scenes();
 }
+#endif
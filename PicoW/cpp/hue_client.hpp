@@ -1,29 +1,204 @@
 #pragma once
 
 #include "config.h"
+#include "hue_connection.hpp"
+#include "hue_scenes.hpp"
+#include "hue_stream.hpp"
+#include "token_bucket.hpp"
 #include "pico/cyw43_arch.h"
 #include "pico/stdlib.h"
+#include <functional>
 #include <string>
 
-// To avoid flooding the bridge
-#define HUE_UPDATE_INTERVAL_MS 1000
+// Bridge round trip above which the request rate stops growing
+#define HUE_RTT_TARGET_MS 150
+// Reachability: probe every tick while unreachable, or once the bridge has
+// been silent for the interval; a probe unanswered by the timeout marks it
+// unreachable
+#define HUE_PROBE_TICK_MS 5000
+#define HUE_PROBE_INTERVAL_MS 30000
+#define HUE_PROBE_TIMEOUT_MS 5000
+// Each command fades over the measured time between commands (in 100 ms
+// steps, as the bridge counts), so the bridge interpolates until the next
+// one arrives. Until there is a cadence the bridge's own default is used.
+#define HUE_TRANSITION_DEFAULT_DS 4
+#define HUE_TRANSITION_MAX_DS 20
+// Retry a colour request that could not be queued
+#define HUE_SEND_RETRY_MS 100
+// Retry activating entertainment streaming after it failed
+#define HUE_STREAM_RETRY_MS 10000
+// Static storage for the precomputed per-zone requests
+#define HUE_TEMPLATE_ARENA_SIZE 2048
+#define HUE_MAX_TEMPLATES 8
+// Static storage for the scene recall requests (HUE_SCENES)
+#define HUE_SCENE_ARENA_SIZE 1536
+// Groups, or lights addressed individually, per bridge
+#define HUE_MAX_TARGETS 8
+// Delay between successive lights or groups picking up a new colour, so
+// changes sweep across the room. 0 updates them as fast as the rate allows.
+#define HUE_LIGHT_STAGGER_MS 0
+// Bridge to light (Zigbee) delay after the bridge acknowledged a command. We
+// cannot observe it, so it is added to the measured latency.
+#define HUE_LIGHT_DELAY_MS 100
+
+// One bridge and what to drive on it. groups and lights are comma separated
+// IDs; lights, if given, are addressed individually instead of the groups.
+// Entertainment streaming needs clientkey.
+struct HueBridgeConfig {
+  const char *ip;
+  const char *user;
+  const char *groups;
+  const char *lights;
+  const char *clientkey;
+  const char *ent_group;
+  const char *ent_lights;
+};
+
+// Rate limits are kept per target type: the bridge copes with far more
+// single-light commands than group commands
+enum HueTarget { HUE_TARGET_GROUP, HUE_TARGET_LIGHT, HUE_TARGET_COUNT };
 
 class HueClient {
 public:
   HueClient();
-  void init();
+  void init(const HueBridgeConfig &config);
   void update(Color color);
+  // Off until the colour moves away from the one shown before, or wake()
   void turn_off();
-  void on_request_complete() { request_in_progress = false; }
-  bool check_reachable();
+  void wake();
+  void print_stats();
+  // Time from update() until the lights change, smoothed. 0 until measured.
+  uint32_t get_latency_ms() const;
+  // Called when hub_reachable changes
+  void set_reachability_callback(std::function<void(bool)> cb);
+
+  // Internal use (public so C-style callbacks can reach them)
+  void reconcile(uint32_t now);
+  void probe(uint32_t now);
 
   bool hub_reachable;
 
 private:
-  uint32_t last_update_ms;
-  Color last_color;
-  bool request_in_progress;
+  // Desired (latest requested) vs applied (acknowledged by the bridge) state
+  struct StalenessStats {
+    uint32_t count; // Desired colours that reached the bridge
+    uint32_t last_ms;
+    uint32_t max_ms;
+    uint32_t total_ms;
+    uint32_t avg_ms; // Smoothed
+    uint32_t superseded; // Replaced by a newer colour before being sent
+  };
+
+  // Each group or light, reconciled towards desired_color on its own
+  struct Target {
+    HueTarget type;
+    uint16_t id; // Group or light ID
+    char path[96];
+    const char *request_line; // "PUT <path> HTTP/1.1\r\n" in the arena
+    uint16_t request_line_len;
+    Color sent_color;
+    Color applied_color;
+    bool applied_valid;
+    bool dirty; // desired != applied, or not yet confirmed
+    bool in_flight;
+    uint32_t dirty_since_ms;
+    uint32_t last_sent_ms;
+    uint32_t interval_ms; // Smoothed time between commands
+#if HUE_SCENES
+    int8_t sent_scene; // Zone whose scene was recalled, or -1
+#endif
+  };
+
+  HueBridgeConfig config;
+  uint32_t last_update_ms; // Last request sent
+  Color desired_color;
+  bool off_latched; // Since turn_off(), updates to off_color are ignored
+  Color off_color;
+  Target targets[HUE_MAX_TARGETS];
+  uint8_t target_count;
+  StalenessStats staleness;
+  TokenBucket rate_limits[HUE_TARGET_COUNT];
+  btstack_timer_source_t reconcile_timer;
   bool first_run;
+  HueConnection connection; // Persistent keep-alive connection to the bridge
+
+  btstack_timer_source_t probe_timer;
+  bool probe_pending;
+  uint32_t probe_sent_ms;
+  uint32_t last_contact_ms; // Last response of any kind from the bridge
+  char probe_request[96];   // Unauthenticated and small
+  int probe_request_len;
+  std::function<void(bool)> reachability_callback;
+
+  // Headers and body of the PUT for each power zone colour and for off, and
+  // the request line of each target, built once in init() so the update path
+  // neither formats nor allocates
+  struct RequestTemplate {
+    Color color;
+    const char *data;
+    uint16_t len;
+  };
+  RequestTemplate templates[HUE_MAX_TEMPLATES];
+  size_t template_count;
+  RequestTemplate off_template;
+  char template_arena[HUE_TEMPLATE_ARENA_SIZE];
+  char request_buf[HUE_REQUEST_MAX_LEN]; // Scratch for send_http()
+
+  void init_targets();
+  void build_templates();
+  const RequestTemplate *find_template(Color color) const;
+  Target *next_target(uint32_t now, uint32_t &wait_ms);
+  void record_staleness(uint32_t stale_ms);
+  static void color_to_hsb(Color color, uint16_t &hue, uint8_t &sat,
+                           uint8_t &bri);
+  static uint8_t transition_ds(const Target &target);
+  static void format_body(char *buf, size_t size, uint16_t hue, uint8_t sat,
+                          uint8_t bri, uint8_t transition);
+  int format_headers(char *buf, size_t size, const char *body) const;
+  int format_request(char *buf, size_t size, const char *method,
+                     const char *path, const char *body) const;
+  void on_response(const HueResponse &response);
+  void set_reachable(bool reachable);
+  bool send_color(uint8_t index);
+  bool send_request(uint8_t index, uint16_t hue, uint8_t sat, uint8_t bri);
+  bool send_http(const char *method, const char *path, const char *body,
+                 uint32_t tag, const char *capture = nullptr,
+                 char capture_end = '"', bool retry = true);
+
+#if HUE_ENTERTAINMENT
+  HueStream stream;
+  bool stream_configured;
+  bool stream_activating; // Activation PUT in flight
+  uint32_t last_stream_attempt_ms;
+
+  void activate_stream(uint32_t now);
+#endif
+
+#if HUE_SCENES
+  // One bridge scene per group and zone, recalled by ID instead of sending
+  // the colour. Missing scenes are created one request at a time: fetch the
+  // group's lights, then POST a scene with their state for each zone. A
+  // scene is created at most once per group and zone per boot: a POST whose
+  // answer was lost may still have created it, so it is neither retried nor
+  // sent again, and that zone sends colours until the next boot.
+  enum class SceneStep : uint8_t { IDLE, LIGHTS, CREATE };
+
+  HueSceneStore scene_store;
+  RequestTemplate scene_templates[HUE_MAX_TARGETS][HUE_MAX_TEMPLATES];
+  char scene_arena[HUE_SCENE_ARENA_SIZE];
+  size_t scene_arena_used; // Append only: queued requests point into it
+  SceneStep scene_step;    // Request in flight
+  uint8_t scene_target;
+  uint8_t scene_zone;
+  char scene_lights[HttpResponseParser::CAPTURE_MAX]; // Of scene_target
+  bool scenes_failed[HUE_MAX_TARGETS];
+  uint8_t scenes_created[HUE_MAX_TARGETS]; // Zone bits, POSTed this boot
+  char scene_body[512];
 
-  void send_request(uint16_t hue, uint8_t sat, uint8_t bri);
+  void add_scene_template(uint8_t target, uint8_t zone, const char *id);
+  bool find_missing_scene(uint8_t &target, uint8_t &zone) const;
+  void provision_scenes();
+  bool create_scene(uint8_t target, uint8_t zone);
+  void on_scene_response(const HueResponse &response);
+#endif
 };
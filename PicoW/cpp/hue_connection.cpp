@@ -0,0 +1,497 @@
+#include "hue_connection.hpp"
+#include "log.hpp"
+#include "pico/cyw43_arch.h"
+#include "pico/stdlib.h"
+#include <cstdio>
+#include <cstring>
+
+// TCP Callbacks (arg is the HueConnection)
+static err_t conn_connected(void *arg, struct tcp_pcb *tpcb, err_t err) {
+  (void)tpcb;
+  (void)err; // Always ERR_OK, failures are reported via conn_err
+  return static_cast<HueConnection *>(arg)->on_connected() ? ERR_OK
+                                                           : ERR_ABRT;
+}
+
+static err_t conn_recv(void *arg, struct tcp_pcb *tpcb, struct pbuf *p,
+                       err_t err) {
+  (void)tpcb;
+  (void)err;
+  return static_cast<HueConnection *>(arg)->on_recv(p) ? ERR_OK : ERR_ABRT;
+}
+
+static err_t conn_sent(void *arg, struct tcp_pcb *tpcb, u16_t len) {
+  (void)tpcb;
+  (void)len;
+  return static_cast<HueConnection *>(arg)->on_sent() ? ERR_OK : ERR_ABRT;
+}
+
+static err_t conn_poll(void *arg, struct tcp_pcb *tpcb) {
+  (void)tpcb;
+  return static_cast<HueConnection *>(arg)->on_poll() ? ERR_OK : ERR_ABRT;
+}
+
+static void conn_err(void *arg, err_t err) {
+  static_cast<HueConnection *>(arg)->on_error(err);
+}
+
+// Detach our callbacks first so neither path calls back into the connection.
+// Returns true if the pcb was aborted (callers inside lwIP callbacks must then
+// return ERR_ABRT).
+static bool close_pcb(struct tcp_pcb *tpcb, bool abort) {
+  tcp_arg(tpcb, nullptr);
+  tcp_recv(tpcb, nullptr);
+  tcp_sent(tpcb, nullptr);
+  tcp_err(tpcb, nullptr);
+  tcp_poll(tpcb, nullptr, 0);
+  if (!abort && tcp_close(tpcb) == ERR_OK)
+    return false;
+  tcp_abort(tpcb);
+  return true;
+}
+
+static void reconnect_timer_handler(btstack_timer_source_t *ts) {
+  static_cast<HueConnection *>(btstack_run_loop_get_timer_context(ts))
+      ->on_reconnect_timer();
+}
+
+static uint32_t now_ms() { return to_ms_since_boot(get_absolute_time()); }
+
+static const uint32_t LATENCY_EDGES_MS[HUE_LATENCY_BINS - 1] = {
+    50, 100, 200, 500, 1000, 2000};
+
+#if HUE_FAULTS
+// xorshift32, good enough to pick faults
+static bool inject_fault(uint8_t percent) {
+  static uint32_t x = 0x2545f491;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return x % 100 < percent;
+}
+#endif
+
+HueConnection::HueConnection()
+    : pcb(nullptr), port(80), addr_valid(false), state(State::CLOSED),
+      connect_start_ms(0), head(0), queued(0), written(0),
+      reconnect_scheduled(false), reconnect_delay_ms(HUE_RECONNECT_MIN_MS),
+      outage_start_ms(0), print_responses(0), print_ms(0) {
+  memset(&stats, 0, sizeof(stats));
+  btstack_run_loop_set_timer_handler(&reconnect_timer,
+                                     &reconnect_timer_handler);
+  btstack_run_loop_set_timer_context(&reconnect_timer, this);
+}
+
+void HueConnection::set_response_callback(HueResponseCallback cb) {
+  response_callback = cb;
+}
+
+void HueConnection::init(const char *ip, uint16_t port) {
+  this->port = port;
+  addr_valid = ipaddr_aton(ip, &addr);
+  if (!addr_valid) {
+    printf("[Hue] Invalid IP Address string: '%s'\n", ip);
+    return;
+  }
+  // Open the connection up front so the first request skips the handshake
+  cyw43_arch_lwip_begin();
+  connect();
+  cyw43_arch_lwip_end();
+}
+
+void HueConnection::connect() {
+  if (!addr_valid || state != State::CLOSED)
+    return;
+
+  pcb = tcp_new();
+  if (!pcb) {
+    LOG_WARN("[Hue] Failed to create PCB\n");
+    schedule_reconnect();
+    return;
+  }
+  tcp_arg(pcb, this);
+  tcp_err(pcb, conn_err);
+  tcp_recv(pcb, conn_recv);
+  tcp_sent(pcb, conn_sent);
+  tcp_poll(pcb, conn_poll, 1); // Every 500 ms (coarse TCP timer)
+
+  state = State::CONNECTING;
+  connect_start_ms = now_ms();
+  err_t err = tcp_connect(pcb, &addr, port, conn_connected);
+  if (err != ERR_OK) {
+    LOG_WARN("[Hue] tcp_connect failed: %d\n", err);
+    close_pcb(pcb, true);
+    pcb = nullptr;
+    state = State::CLOSED;
+    schedule_reconnect();
+  }
+}
+
+void HueConnection::schedule_reconnect() {
+  if (reconnect_scheduled)
+    return;
+  reconnect_scheduled = true;
+  btstack_run_loop_set_timer(&reconnect_timer, reconnect_delay_ms);
+  btstack_run_loop_add_timer(&reconnect_timer);
+  reconnect_delay_ms *= 2;
+  if (reconnect_delay_ms > HUE_RECONNECT_MAX_MS)
+    reconnect_delay_ms = HUE_RECONNECT_MAX_MS;
+}
+
+void HueConnection::on_reconnect_timer() {
+  reconnect_scheduled = false;
+  cyw43_arch_lwip_begin();
+  connect();
+  cyw43_arch_lwip_end();
+}
+
+bool HueConnection::on_connected() {
+  state = State::CONNECTED;
+  stats.connects++;
+  reconnect_delay_ms = HUE_RECONNECT_MIN_MS;
+  tcp_nagle_disable(pcb); // Each request goes out as soon as it is written
+  LOG_DEBUG("[Hue] Connected (%lu ms)\n", now_ms() - connect_start_ms);
+  return flush();
+}
+
+// The connection is gone (pcb already freed or aborted by the caller)
+void HueConnection::handle_failure() {
+  // An idle socket the bridge dropped is not an outage
+  if (outage_start_ms == 0 && queued > 0)
+    outage_start_ms = now_ms() | 1; // Never 0
+  pcb = nullptr;
+  state = State::CLOSED;
+  written = 0;
+  parser.reset();
+  schedule_reconnect();
+
+  // Everything queued is written again on the next connection (the bridge
+  // may have dropped an idle socket), except requests already retried and
+  // written ones that must not be repeated. The rest keep their order.
+  uint32_t failed_tags[HUE_PIPELINE_DEPTH];
+  uint32_t failed_elapsed[HUE_PIPELINE_DEPTH];
+  uint8_t failed = 0;
+  uint8_t kept = 0;
+  for (uint8_t i = 0; i < queued; i++) {
+    Slot &s = slot(i);
+    if (s.attempts >= s.max_attempts) {
+      failed_tags[failed] = s.tag;
+      failed_elapsed[failed++] = now_ms() - s.start_ms;
+      continue;
+    }
+    if (kept != i) {
+      Slot &to = slot(kept);
+      to = s;
+      for (size_t j = 0; j < 3; j++) {
+        if (s.parts[j] == s.buf)
+          to.parts[j] = to.buf;
+      }
+    }
+    kept++;
+  }
+  queued = kept;
+
+  for (uint8_t i = 0; i < failed; i++) {
+    stats.failures++;
+    if (response_callback)
+      response_callback({failed_tags[i], 0, false, 0, failed_elapsed[i],
+                         nullptr});
+  }
+}
+
+void HueConnection::on_error(err_t err) {
+  LOG_WARN("[Hue] Connection error: %d\n", err);
+  handle_failure();
+}
+
+bool HueConnection::on_poll() {
+  uint32_t now = now_ms();
+  const char *what = nullptr;
+  uint32_t elapsed = 0;
+  if (state == State::CONNECTING) {
+    elapsed = now - connect_start_ms;
+    if (elapsed > HUE_CONNECT_TIMEOUT_MS)
+      what = "Connect";
+  } else if (written > 0) {
+    elapsed = now - slot(0).start_ms;
+    if (elapsed > HUE_REQUEST_TIMEOUT_MS)
+      what = "Request";
+  }
+  if (what) {
+    LOG_WARN("[Hue] %s timed out after %lu ms. Aborting.\n", what, elapsed);
+    stats.timeouts++;
+    close_pcb(pcb, true);
+    handle_failure();
+    return false;
+  }
+  // A write deferred for lack of send buffer is retried here
+  return flush();
+}
+
+bool HueConnection::on_sent() { return flush(); }
+
+HueConnection::Slot *HueConnection::enqueue(uint32_t tag) {
+  if (queued == HUE_PIPELINE_DEPTH)
+    return nullptr;
+  Slot &s = slot(queued);
+  s.tag = tag;
+  s.start_ms = 0;
+  s.attempts = 0;
+  s.max_attempts = 2;
+  s.capture = nullptr;
+  s.capture_end = '\0';
+  return &s;
+}
+
+bool HueConnection::request(const char *data, size_t len, uint32_t tag,
+                            const char *capture, char capture_end,
+                            bool retry) {
+  if (len > HUE_REQUEST_MAX_LEN) {
+    LOG_WARN("[Hue] Request too long (%d bytes)\n", (int)len);
+    return false;
+  }
+
+  cyw43_arch_lwip_begin();
+  Slot *s = enqueue(tag);
+  if (s) {
+    memcpy(s->buf, data, len);
+    s->parts[0] = s->buf;
+    s->lens[0] = (uint16_t)len;
+    s->capture = capture;
+    s->capture_end = capture_end;
+    s->max_attempts = retry ? 2 : 1;
+    for (size_t i = 1; i < 3; i++) {
+      s->parts[i] = nullptr;
+      s->lens[i] = 0;
+    }
+    queued++;
+    if (state == State::CLOSED && !reconnect_scheduled)
+      connect();
+    else
+      flush();
+  }
+  cyw43_arch_lwip_end();
+  return s != nullptr;
+}
+
+bool HueConnection::request_static(const char *head, size_t head_len,
+                                   const char *tail, size_t tail_len,
+                                   const char *suffix, size_t suffix_len,
+                                   uint32_t tag) {
+  if (head_len + tail_len + suffix_len > 0xffff ||
+      suffix_len > HUE_REQUEST_MAX_LEN)
+    return false;
+
+  cyw43_arch_lwip_begin();
+  Slot *s = enqueue(tag);
+  if (s) {
+    s->parts[0] = head;
+    s->lens[0] = (uint16_t)head_len;
+    s->parts[1] = tail;
+    s->lens[1] = (uint16_t)tail_len;
+    memcpy(s->buf, suffix, suffix_len);
+    s->parts[2] = s->buf;
+    s->lens[2] = (uint16_t)suffix_len;
+    queued++;
+    if (state == State::CLOSED && !reconnect_scheduled)
+      connect();
+    else
+      flush();
+  }
+  cyw43_arch_lwip_end();
+  return s != nullptr;
+}
+
+// Write queued requests the socket has room for. Returns false if the pcb
+// had to be aborted.
+bool HueConnection::flush() {
+  if (state != State::CONNECTED)
+    return true;
+
+  uint8_t before = written;
+  while (written < queued) {
+    Slot &s = slot(written);
+    // All parts must go in together or the stream is left half a request
+    // long, so check for room up front
+    if (tcp_sndbuf(pcb) < (uint32_t)s.lens[0] + s.lens[1] + s.lens[2] ||
+        tcp_sndqueuelen(pcb) + 6 > TCP_SND_QUEUELEN)
+      break; // Retried from on_sent() / on_poll()
+
+    // Static data is referenced by the queued segment instead of copied.
+    // Note LWIP_NETIF_TX_SINGLE_PBUF makes lwIP copy anyway to build a
+    // single pbuf.
+    uint32_t left = s.lens[0] + s.lens[1] + s.lens[2];
+    err_t err = ERR_OK;
+    for (size_t i = 0; i < 3 && err == ERR_OK; i++) {
+      if (s.lens[i] == 0)
+        continue;
+      left -= s.lens[i];
+      u8_t flags = (s.parts[i] == s.buf) ? TCP_WRITE_FLAG_COPY : 0;
+      if (left)
+        flags |= TCP_WRITE_FLAG_MORE;
+      err = tcp_write(pcb, s.parts[i], s.lens[i], flags);
+    }
+    if (err != ERR_OK) {
+      LOG_WARN("[Hue] tcp_write failed: %d. Reconnecting.\n", err);
+      close_pcb(pcb, true);
+      handle_failure();
+      return false;
+    }
+
+    s.attempts++;
+    s.start_ms = now_ms();
+    stats.requests++;
+    written++;
+
+#if HUE_FAULTS
+    if (inject_fault(HUE_FAULT_RESET_PCT)) {
+      LOG_WARN("[Hue] Fault: resetting connection\n");
+      stats.faults_injected++;
+      close_pcb(pcb, true);
+      handle_failure();
+      return false;
+    }
+#endif
+  }
+  if (written != before)
+    tcp_output(pcb);
+  return true;
+}
+
+bool HueConnection::on_recv(struct pbuf *p) {
+  if (!p) {
+    // Bridge closed the connection (idle timeout or Connection: close)
+    LOG_DEBUG("[Hue] Connection closed by bridge\n");
+    bool aborted = close_pcb(pcb, false);
+    handle_failure();
+    return !aborted;
+  }
+
+  // Open the receive window again before parsing, the responses may close
+  // the connection
+  tcp_recved(pcb, p->tot_len);
+
+  // The parser reads each pbuf of the chain in place. Pipelined responses
+  // can share a segment: each completes as soon as its body is in.
+  bool alive = true;
+  bool malformed = false;
+  for (struct pbuf *q = p; q && alive && written > 0; q = q->next) {
+    const char *data = (const char *)q->payload;
+    size_t offset = 0;
+    while (offset < q->len && alive && written > 0) {
+      if (parser.at_start())
+        parser.set_capture(slot(0).capture, slot(0).capture_end);
+      offset += parser.feed(data + offset, q->len - offset);
+      if (parser.is_failed()) {
+        malformed = true;
+        alive = false;
+      } else if (parser.is_done()) {
+        alive = finish_response();
+      }
+    }
+  }
+  pbuf_free(p);
+
+  if (malformed) {
+    LOG_WARN("[Hue] Malformed response. Reconnecting.\n");
+    close_pcb(pcb, true);
+    handle_failure();
+    return false;
+  }
+
+  // Without a length the response is taken as complete once the headers and
+  // whatever arrived with them are in
+  if (alive && written > 0 && parser.reads_until_close())
+    alive = finish_response();
+  return alive;
+}
+
+bool HueConnection::finish_response() {
+  Slot &s = slot(0);
+  uint32_t latency = now_ms() - s.start_ms;
+  int status = parser.get_status();
+#if HUE_FAULTS
+  if (inject_fault(HUE_FAULT_BUSY_PCT)) {
+    LOG_WARN("[Hue] Fault: answering 503\n");
+    stats.faults_injected++;
+    status = 503;
+  }
+#endif
+  HueResponse response = {s.tag, status, parser.get_errors() > 0,
+                          parser.get_error_type(), latency,
+                          parser.get_capture()};
+  head = (head + 1) % HUE_PIPELINE_DEPTH;
+  queued--;
+  written--;
+
+  stats.responses++;
+  stats.last_latency_ms = latency;
+  stats.total_latency_ms += latency;
+  if (latency > stats.max_latency_ms)
+    stats.max_latency_ms = latency;
+  size_t bin = 0;
+  while (bin < HUE_LATENCY_BINS - 1 && latency > LATENCY_EDGES_MS[bin])
+    bin++;
+  stats.latency_bins[bin]++;
+  if (outage_start_ms && status == 200) {
+    uint32_t recovery = now_ms() - outage_start_ms;
+    outage_start_ms = 0;
+    stats.outages++;
+    stats.last_recovery_ms = recovery;
+    if (recovery > stats.max_recovery_ms)
+      stats.max_recovery_ms = recovery;
+  }
+  LOG_DEBUG("[Hue] Response %d in %lu ms (%d ok, %d errors)\n", status,
+            latency, parser.get_successes(), parser.get_errors());
+
+  bool closing = !parser.keep_alive() || parser.reads_until_close();
+  bool aborted = false;
+  if (closing) {
+    // Requests written behind this one are resent on the next connection
+    aborted = close_pcb(pcb, false);
+    pcb = nullptr;
+    state = State::CLOSED;
+    written = 0;
+    schedule_reconnect();
+  }
+
+  struct tcp_pcb *current = pcb;
+  if (response_callback)
+    response_callback(response);
+  parser.reset(); // After the callback, it holds the capture
+  if (pcb != current)
+    return false; // A write from the callback failed and aborted the pcb
+
+  return !aborted && flush();
+}
+
+void HueConnection::print_stats() {
+  LOG_TELEMETRY(
+      "[Hue] Requests %lu, responses %lu, failures %lu, timeouts %lu\n",
+      stats.requests, stats.responses, stats.failures, stats.timeouts);
+  LOG_TELEMETRY(
+      "[Hue] Connects %lu, latency last %lu ms avg %lu ms max %lu ms\n",
+      stats.connects, stats.last_latency_ms,
+      stats.responses ? stats.total_latency_ms / stats.responses : 0,
+      stats.max_latency_ms);
+  const uint32_t *bins = stats.latency_bins;
+  LOG_TELEMETRY("[Hue] Latency <=50 %lu, <=100 %lu, <=200 %lu, <=500 %lu\n",
+                bins[0], bins[1], bins[2], bins[3]);
+  LOG_TELEMETRY("[Hue] Latency <=1000 %lu, <=2000 %lu, >2000 %lu\n", bins[4],
+                bins[5], bins[6]);
+
+  // Throughput since the last print
+  uint32_t now = now_ms();
+  uint32_t elapsed = now - print_ms;
+  uint32_t per_min =
+      elapsed ? (stats.responses - print_responses) * 60000 / elapsed : 0;
+  print_responses = stats.responses;
+  print_ms = now;
+  LOG_TELEMETRY("[Hue] Throughput %lu/min, outages %lu, recovery last %lu ms "
+                "max %lu ms\n",
+                per_min, stats.outages, stats.last_recovery_ms,
+                stats.max_recovery_ms);
+#if HUE_FAULTS
+  LOG_TELEMETRY("[Hue] Faults injected %lu\n", stats.faults_injected);
+#endif
+}
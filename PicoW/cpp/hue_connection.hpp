@@ -0,0 +1,150 @@
+#pragma once
+
+#include "btstack.h"
+#include "http_response.hpp"
+#include "lwip/ip_addr.h"
+#include "lwip/tcp.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// Largest request (headers + body) that can be queued
+#define HUE_REQUEST_MAX_LEN 768
+// Abort the connection if a response has not completed in time
+#define HUE_REQUEST_TIMEOUT_MS 2000
+#define HUE_CONNECT_TIMEOUT_MS 3000
+// Background reconnect backoff
+#define HUE_RECONNECT_MIN_MS 250
+#define HUE_RECONNECT_MAX_MS 8000
+// Requests that can be queued or awaiting a response at once (HTTP/1.1
+// pipelining, answered in order)
+#define HUE_PIPELINE_DEPTH 3
+// Response latency bins: <=50, 100, 200, 500, 1000, 2000, >2000 ms
+#define HUE_LATENCY_BINS 7
+
+// Fault injection (cmake -DHUE_FAULTS=ON) to exercise the recovery paths
+// against a real bridge: percentage of requests whose connection is reset
+// right after writing, and of responses turned into 503 Busy
+#ifndef HUE_FAULT_RESET_PCT
+#define HUE_FAULT_RESET_PCT 5
+#endif
+#ifndef HUE_FAULT_BUSY_PCT
+#define HUE_FAULT_BUSY_PCT 5
+#endif
+
+struct HueResponse {
+  uint32_t tag;   // As passed with the request
+  int status;     // HTTP status code, 0 if the request failed
+  bool api_error; // The bridge answered with an "error" object
+  uint16_t error_type; // Of the first error object
+  uint32_t latency_ms;
+  const char *capture; // Requested capture, valid during the callback only
+};
+
+// Called once per request
+using HueResponseCallback = std::function<void(const HueResponse &)>;
+
+struct HueConnectionStats {
+  uint32_t requests; // Requests written to the socket (including retries)
+  uint32_t responses;
+  uint32_t failures; // Requests reported failed after the retry
+  uint32_t timeouts;
+  uint32_t connects;
+  uint32_t last_latency_ms; // Write to end of response
+  uint32_t max_latency_ms;
+  uint32_t total_latency_ms;
+  uint32_t latency_bins[HUE_LATENCY_BINS];
+  // Outage: connection lost until the next successful response
+  uint32_t outages;
+  uint32_t last_recovery_ms;
+  uint32_t max_recovery_ms;
+  uint32_t faults_injected;
+};
+
+// Persistent HTTP/1.1 keep-alive connection to the Hue bridge. Up to
+// HUE_PIPELINE_DEPTH requests are written back to back without waiting for
+// the responses, which the bridge returns in order. Requests that die with
+// the connection are retried once on the next connection, unless queued
+// without retry.
+class HueConnection {
+public:
+  HueConnection();
+  void init(const char *ip, uint16_t port);
+  void set_response_callback(HueResponseCallback cb);
+  // Queue a request; false if the pipeline is full or it does not fit.
+  // capture (static) picks a value out of the response body, see
+  // HttpResponseParser::set_capture(). Without retry a request written
+  // before the connection dropped fails instead of being written again, for
+  // requests that must not be applied twice.
+  bool request(const char *data, size_t len, uint32_t tag,
+               const char *capture = nullptr, char capture_end = '"',
+               bool retry = true);
+  // As request(), but head and tail (e.g. a request line and a shared
+  // header/body template) are not copied and must stay valid until the
+  // bridge acknowledged them. The short suffix, if any, is copied.
+  bool request_static(const char *head, size_t head_len, const char *tail,
+                      size_t tail_len, const char *suffix, size_t suffix_len,
+                      uint32_t tag);
+  bool can_accept() const { return queued < HUE_PIPELINE_DEPTH; }
+  bool is_connected() const { return state == State::CONNECTED; }
+  const HueConnectionStats &get_stats() const { return stats; }
+  void print_stats();
+
+  // Internal use (public so C-style callbacks can reach them)
+  // Return false if the pcb was aborted
+  bool on_connected();
+  bool on_recv(struct pbuf *p);
+  bool on_sent();
+  bool on_poll();
+  void on_error(err_t err);
+  void on_reconnect_timer();
+
+private:
+  enum class State { CLOSED, CONNECTING, CONNECTED };
+
+  struct Slot {
+    char buf[HUE_REQUEST_MAX_LEN]; // Copy of a non-static request or suffix
+    const char *parts[3];
+    uint16_t lens[3];
+    uint32_t tag;
+    uint32_t start_ms; // Written to the socket
+    uint8_t attempts;
+    uint8_t max_attempts; // Writes before it fails
+    const char *capture;
+    char capture_end;
+  };
+
+  // i-th queued request, oldest first
+  Slot &slot(uint8_t i) { return slots[(head + i) % HUE_PIPELINE_DEPTH]; }
+  Slot *enqueue(uint32_t tag);
+  void connect();
+  void schedule_reconnect();
+  void handle_failure();
+  bool flush();
+  bool finish_response();
+
+  struct tcp_pcb *pcb;
+  ip_addr_t addr;
+  uint16_t port;
+  bool addr_valid;
+  State state;
+  uint32_t connect_start_ms;
+
+  Slot slots[HUE_PIPELINE_DEPTH];
+  uint8_t head;    // Oldest queued request
+  uint8_t queued;  // Requests queued, written or not
+  uint8_t written; // The first 'written' of them await a response
+
+  // Response to the oldest written request
+  HttpResponseParser parser;
+
+  bool reconnect_scheduled;
+  uint32_t reconnect_delay_ms;
+  btstack_timer_source_t reconnect_timer;
+
+  HueConnectionStats stats;
+  uint32_t outage_start_ms; // 0 while healthy
+  uint32_t print_responses; // Responses and time at the last print_stats()
+  uint32_t print_ms;
+  HueResponseCallback response_callback;
+};
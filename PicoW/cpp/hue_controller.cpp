@@ -0,0 +1,129 @@
+#include "hue_controller.hpp"
+#include "log.hpp"
+#include <cstdio>
+
+// Defined in CMake from .env
+#ifndef HUE_IP
+#define HUE_IP "192.168.1.100"
+#endif
+#ifndef HUE_USER
+#define HUE_USER "user"
+#endif
+// Group IDs ("1" or "1,2"), each updated separately
+#ifndef HUE_GROUP
+#define HUE_GROUP "1"
+#endif
+// Light IDs to address individually instead of the groups ("1,2,3"), in the
+// order a change should sweep across them
+#ifndef HUE_LIGHTS
+#define HUE_LIGHTS ""
+#endif
+// Entertainment streaming (first bridge only): clientkey from registration
+// (32 hex digits), the entertainment group and the IDs of its lights
+#ifndef HUE_CLIENTKEY
+#define HUE_CLIENTKEY ""
+#endif
+#ifndef HUE_ENT_GROUP
+#define HUE_ENT_GROUP HUE_GROUP
+#endif
+#ifndef HUE_ENT_LIGHTS
+#define HUE_ENT_LIGHTS ""
+#endif
+
+// Further bridges: HUE_IP_n with HUE_USER_n and HUE_GROUP_n or HUE_LIGHTS_n
+#ifdef HUE_IP_2
+#ifndef HUE_USER_2
+#error "HUE_IP_2 needs HUE_USER_2"
+#endif
+#ifndef HUE_GROUP_2
+#define HUE_GROUP_2 "1"
+#endif
+#ifndef HUE_LIGHTS_2
+#define HUE_LIGHTS_2 ""
+#endif
+#endif
+#ifdef HUE_IP_3
+#ifndef HUE_USER_3
+#error "HUE_IP_3 needs HUE_USER_3"
+#endif
+#ifndef HUE_GROUP_3
+#define HUE_GROUP_3 "1"
+#endif
+#ifndef HUE_LIGHTS_3
+#define HUE_LIGHTS_3 ""
+#endif
+#endif
+
+static const HueBridgeConfig BRIDGES[] = {
+    {HUE_IP, HUE_USER, HUE_GROUP, HUE_LIGHTS, HUE_CLIENTKEY, HUE_ENT_GROUP,
+     HUE_ENT_LIGHTS},
+#ifdef HUE_IP_2
+    {HUE_IP_2, HUE_USER_2, HUE_GROUP_2, HUE_LIGHTS_2, "", "", ""},
+#endif
+#ifdef HUE_IP_3
+    {HUE_IP_3, HUE_USER_3, HUE_GROUP_3, HUE_LIGHTS_3, "", "", ""},
+#endif
+};
+static_assert(sizeof(BRIDGES) / sizeof(BRIDGES[0]) <= HUE_MAX_BRIDGES,
+              "Too many Hue bridges");
+
+HueController::HueController() : client_count(0), reachable(false) {}
+
+void HueController::init() {
+  client_count = sizeof(BRIDGES) / sizeof(BRIDGES[0]);
+  for (size_t i = 0; i < client_count; i++) {
+    clients[i].set_reachability_callback([this](bool) {
+      bool now_reachable = is_reachable();
+      if (now_reachable == reachable)
+        return;
+      reachable = now_reachable;
+      if (reachability_callback)
+        reachability_callback(reachable);
+    });
+    clients[i].init(BRIDGES[i]);
+  }
+}
+
+bool HueController::is_reachable() const {
+  for (size_t i = 0; i < client_count; i++) {
+    if (!clients[i].hub_reachable)
+      return false;
+  }
+  return client_count > 0;
+}
+
+uint32_t HueController::get_latency_ms() const {
+  uint32_t latency = 0;
+  for (size_t i = 0; i < client_count; i++) {
+    if (clients[i].hub_reachable && clients[i].get_latency_ms() > latency)
+      latency = clients[i].get_latency_ms();
+  }
+  return latency;
+}
+
+void HueController::set_reachability_callback(std::function<void(bool)> cb) {
+  reachability_callback = cb;
+}
+
+void HueController::update(Color color) {
+  for (size_t i = 0; i < client_count; i++)
+    clients[i].update(color);
+}
+
+void HueController::turn_off() {
+  for (size_t i = 0; i < client_count; i++)
+    clients[i].turn_off();
+}
+
+void HueController::wake() {
+  for (size_t i = 0; i < client_count; i++)
+    clients[i].wake();
+}
+
+void HueController::print_stats() {
+  for (size_t i = 0; i < client_count; i++) {
+    if (client_count > 1)
+      LOG_TELEMETRY("[Hue] Bridge %d (%s)\n", (int)i + 1, BRIDGES[i].ip);
+    clients[i].print_stats();
+  }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "config.h"
+#include "hue_client.hpp"
+#include <functional>
+
+#define HUE_MAX_BRIDGES 3
+
+// Drives every configured bridge (HUE_IP, HUE_IP_2, HUE_IP_3) with the same
+// colour. Each bridge has its own HueClient, so its own connection, rate
+// budget and pending state; all of them are non-blocking, so a slow or
+// offline bridge never holds up the others.
+class HueController {
+public:
+  HueController();
+  void init();
+  void update(Color color);
+  void turn_off();
+  void wake();
+  void print_stats();
+
+  // Of the slowest reachable bridge, 0 until measured
+  uint32_t get_latency_ms() const;
+  // Reachable only while every bridge is
+  bool is_reachable() const;
+  // Called when is_reachable() changes
+  void set_reachability_callback(std::function<void(bool)> cb);
+
+private:
+  HueClient clients[HUE_MAX_BRIDGES];
+  size_t client_count;
+  bool reachable;
+  std::function<void(bool)> reachability_callback;
+};
@@ -0,0 +1,88 @@
+#include "hue_scenes.hpp"
+#include "btstack.h"
+#include <cstdio>
+#include <cstring>
+
+// Stored as [bridge_hash(4), group(2), zone, r, g, b, id...]
+struct SceneRecord {
+  uint32_t bridge_hash;
+  uint16_t group;
+  uint8_t zone;
+  uint8_t r, g, b;
+  char id[HUE_SCENE_ID_MAX];
+};
+
+static bool get_tlv(const btstack_tlv_t **tlv_impl, void **tlv_context) {
+  *tlv_impl = nullptr;
+  *tlv_context = nullptr;
+  btstack_tlv_get_instance(tlv_impl, tlv_context);
+  return *tlv_impl != nullptr;
+}
+
+HueSceneStore::HueSceneStore() : bridge_hash(0) {}
+
+void HueSceneStore::init(const char *bridge_ip) {
+  // FNV-1a
+  bridge_hash = 2166136261u;
+  for (const char *p = bridge_ip; *p; p++)
+    bridge_hash = (bridge_hash ^ (uint8_t)*p) * 16777619u;
+}
+
+// 'S' and 24 bits of a hash over the whole bridge hash, group and zone, so
+// bridges whose hashes share a byte do not share tags. The record itself
+// says which bridge, group and zone it belongs to.
+uint32_t HueSceneStore::tag(uint16_t group, uint8_t zone) const {
+  uint32_t h = bridge_hash;
+  const uint8_t key[3] = {(uint8_t)group, (uint8_t)(group >> 8), zone};
+  for (uint8_t b : key)
+    h = (h ^ b) * 16777619u;
+  return BTSTACK_TAG32('S', 0, 0, 0) | ((h ^ (h >> 24)) & 0x00ffffff);
+}
+
+bool HueSceneStore::load(uint16_t group, uint8_t zone, Color color,
+                         char *id) const {
+  const btstack_tlv_t *tlv_impl;
+  void *tlv_context;
+  if (!get_tlv(&tlv_impl, &tlv_context))
+    return false;
+
+  SceneRecord record;
+  int len = tlv_impl->get_tag(tlv_context, tag(group, zone),
+                              (uint8_t *)&record, sizeof(record));
+  if (len != (int)sizeof(record) || record.bridge_hash != bridge_hash ||
+      record.group != group || record.zone != zone || record.r != color.r ||
+      record.g != color.g || record.b != color.b)
+    return false;
+  record.id[HUE_SCENE_ID_MAX - 1] = '\0';
+  strcpy(id, record.id);
+  return id[0] != '\0';
+}
+
+void HueSceneStore::store(uint16_t group, uint8_t zone, Color color,
+                          const char *id) {
+  const btstack_tlv_t *tlv_impl;
+  void *tlv_context;
+  if (!get_tlv(&tlv_impl, &tlv_context))
+    return;
+
+  SceneRecord record;
+  memset(&record, 0, sizeof(record));
+  record.bridge_hash = bridge_hash;
+  record.group = group;
+  record.zone = zone;
+  record.r = color.r;
+  record.g = color.g;
+  record.b = color.b;
+  strncpy(record.id, id, HUE_SCENE_ID_MAX - 1);
+  tlv_impl->store_tag(tlv_context, tag(group, zone), (const uint8_t *)&record,
+                      sizeof(record));
+  printf("[Hue] Stored scene %s for group %d zone %d\n", record.id, group,
+         zone);
+}
+
+void HueSceneStore::forget(uint16_t group, uint8_t zone) {
+  const btstack_tlv_t *tlv_impl;
+  void *tlv_context;
+  if (get_tlv(&tlv_impl, &tlv_context))
+    tlv_impl->delete_tag(tlv_context, tag(group, zone));
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "config.h"
+#include <cstddef>
+#include <cstdint>
+
+// Scene IDs are 16 characters on current bridges
+#define HUE_SCENE_ID_MAX 24
+
+// Bridge scene IDs per group and power zone, persisted in flash via BTstack
+// TLV so scenes are only created once. Each entry remembers the bridge and
+// the zone colour it was created for; a different bridge or a changed zone
+// table makes it stale.
+class HueSceneStore {
+public:
+  HueSceneStore();
+  void init(const char *bridge_ip);
+  // Copies the scene ID into id (HUE_SCENE_ID_MAX). False if none is stored.
+  bool load(uint16_t group, uint8_t zone, Color color, char *id) const;
+  void store(uint16_t group, uint8_t zone, Color color, const char *id);
+  void forget(uint16_t group, uint8_t zone);
+
+private:
+  uint32_t tag(uint16_t group, uint8_t zone) const;
+
+  uint32_t bridge_hash;
+};
@@ -0,0 +1,341 @@
+#include "hue_stream.hpp"
+
+#if HUE_ENTERTAINMENT
+
+#include "log.hpp"
+#include "pico/cyw43_arch.h"
+#include "pico/stdlib.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// The only suite the bridge accepts
+static const int CIPHERSUITES[] = {MBEDTLS_TLS_PSK_WITH_AES_128_GCM_SHA256,
+                                   0};
+
+static uint32_t now_ms() { return to_ms_since_boot(get_absolute_time()); }
+
+static void stream_udp_recv(void *arg, struct udp_pcb *pcb, struct pbuf *p,
+                            const ip_addr_t *addr, uint16_t port) {
+  (void)pcb;
+  (void)addr;
+  (void)port;
+  static_cast<HueStream *>(arg)->on_udp_recv(p);
+}
+
+static void stream_tick_handler(btstack_timer_source_t *ts) {
+  static_cast<HueStream *>(btstack_run_loop_get_timer_context(ts))->on_tick();
+}
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+HueStream::HueStream()
+    : state(State::IDLE), identity(nullptr), light_count(0),
+      configured(false), pcb(nullptr), rx_len(0), timer_start_ms(0),
+      timer_int_ms(0), timer_fin_ms(0), color_changed_ms(0), last_frame_ms(0),
+      handshake_start_ms(0), sequence(0) {
+  color = {0, 0, 0};
+  memset(&stats, 0, sizeof(stats));
+  btstack_run_loop_set_timer_handler(&tick_timer, &stream_tick_handler);
+  btstack_run_loop_set_timer_context(&tick_timer, this);
+}
+
+// lights is a comma separated list of light IDs in the entertainment group
+bool HueStream::init(const char *ip, const char *identity,
+                     const char *psk_hex, const char *lights) {
+  this->identity = identity;
+  if (!ipaddr_aton(ip, &addr)) {
+    printf("[HueStream] Invalid IP: %s\n", ip);
+    return false;
+  }
+  if (strlen(psk_hex) != 2 * sizeof(psk)) {
+    printf("[HueStream] Client key must be %d hex digits\n",
+           (int)(2 * sizeof(psk)));
+    return false;
+  }
+  for (size_t i = 0; i < sizeof(psk); i++) {
+    int hi = hex_value(psk_hex[2 * i]);
+    int lo = hex_value(psk_hex[2 * i + 1]);
+    if (hi < 0 || lo < 0) {
+      printf("[HueStream] Client key is not hex\n");
+      return false;
+    }
+    psk[i] = (uint8_t)(hi << 4 | lo);
+  }
+
+  light_count = 0;
+  const char *p = lights;
+  while (*p && light_count < HUE_STREAM_MAX_LIGHTS) {
+    char *end;
+    long id = strtol(p, &end, 10);
+    if (end == p)
+      break;
+    light_ids[light_count++] = (uint16_t)id;
+    p = (*end == ',') ? end + 1 : end;
+  }
+  if (light_count == 0) {
+    printf("[HueStream] No entertainment lights configured\n");
+    return false;
+  }
+
+  configured = true;
+  printf("[HueStream] %d lights, identity %s\n", light_count, identity);
+  return true;
+}
+
+// Called once the bridge has activated streaming for the group
+void HueStream::start() {
+  if (!configured || is_active())
+    return;
+
+  mbedtls_ssl_init(&ssl);
+  mbedtls_ssl_config_init(&conf);
+  mbedtls_ctr_drbg_init(&drbg);
+  mbedtls_entropy_init(&entropy);
+
+  int ret = mbedtls_ctr_drbg_seed(&drbg, mbedtls_entropy_func, &entropy,
+                                  (const unsigned char *)"zpl", 3);
+  if (ret == 0)
+    ret = mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT,
+                                      MBEDTLS_SSL_TRANSPORT_DATAGRAM,
+                                      MBEDTLS_SSL_PRESET_DEFAULT);
+  if (ret == 0) {
+    mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &drbg);
+    mbedtls_ssl_conf_ciphersuites(&conf, CIPHERSUITES);
+    mbedtls_ssl_conf_handshake_timeout(&conf, 400, 4000);
+    ret = mbedtls_ssl_conf_psk(&conf, psk, sizeof(psk),
+                               (const unsigned char *)identity,
+                               strlen(identity));
+  }
+  if (ret == 0)
+    ret = mbedtls_ssl_setup(&ssl, &conf);
+  if (ret != 0) {
+    state = State::HANDSHAKE; // So teardown() frees the contexts
+    fail(ret);
+    return;
+  }
+  mbedtls_ssl_set_bio(&ssl, this, bio_send, bio_recv, nullptr);
+  mbedtls_ssl_set_timer_cb(&ssl, this, timer_set, timer_get);
+
+  cyw43_arch_lwip_begin();
+  pcb = udp_new();
+  if (pcb) {
+    udp_recv(pcb, stream_udp_recv, this);
+    udp_connect(pcb, &addr, HUE_STREAM_PORT);
+  }
+  cyw43_arch_lwip_end();
+  state = State::HANDSHAKE;
+  if (!pcb) {
+    fail(0);
+    return;
+  }
+
+  printf("[HueStream] DTLS handshake...\n");
+  rx_len = 0;
+  handshake_start_ms = now_ms();
+  cyw43_arch_lwip_begin();
+  continue_handshake();
+  cyw43_arch_lwip_end();
+  if (!is_active())
+    return;
+
+  btstack_run_loop_set_timer(&tick_timer, HUE_STREAM_INTERVAL_MS);
+  btstack_run_loop_add_timer(&tick_timer);
+}
+
+void HueStream::stop() {
+  if (state == State::STREAMING) {
+    cyw43_arch_lwip_begin();
+    mbedtls_ssl_close_notify(&ssl);
+    cyw43_arch_lwip_end();
+  }
+  teardown();
+  state = State::IDLE;
+}
+
+void HueStream::teardown() {
+  btstack_run_loop_remove_timer(&tick_timer);
+  if (pcb) {
+    cyw43_arch_lwip_begin();
+    udp_remove(pcb);
+    cyw43_arch_lwip_end();
+    pcb = nullptr;
+  }
+  if (is_active()) {
+    mbedtls_ssl_free(&ssl);
+    mbedtls_ssl_config_free(&conf);
+    mbedtls_ctr_drbg_free(&drbg);
+    mbedtls_entropy_free(&entropy);
+  }
+}
+
+void HueStream::fail(int ret) {
+  LOG_WARN("[HueStream] Failed (-0x%04x). Falling back to REST.\n", -ret);
+  stats.failures++;
+  teardown();
+  state = State::FAILED;
+}
+
+void HueStream::continue_handshake() {
+  int ret = mbedtls_ssl_handshake(&ssl);
+  if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE)
+    return;
+  if (ret != 0) {
+    fail(ret);
+    return;
+  }
+  stats.handshakes++;
+  stats.last_handshake_ms = now_ms() - handshake_start_ms;
+  printf("[HueStream] Streaming (handshake %lu ms)\n",
+         (unsigned long)stats.last_handshake_ms);
+  state = State::STREAMING;
+  send_frame();
+}
+
+void HueStream::set_color(Color c) {
+  if (c.r == color.r && c.g == color.g && c.b == color.b)
+    return;
+  color = c;
+  color_changed_ms = now_ms();
+}
+
+// HueStream v1: "HueStream", version 1.0, sequence, 2 reserved, colour space
+// (0 = RGB), 1 reserved, then 9 bytes per light: type (0 = light), ID and
+// 16-bit R, G, B, all big endian
+void HueStream::send_frame() {
+  uint8_t frame[16 + 9 * HUE_STREAM_MAX_LIGHTS];
+  memcpy(frame, "HueStream", 9);
+  frame[9] = 0x01;
+  frame[10] = 0x00;
+  frame[11] = sequence++;
+  frame[12] = 0x00;
+  frame[13] = 0x00;
+  frame[14] = 0x00;
+  frame[15] = 0x00;
+
+  uint8_t *p = &frame[16];
+  for (uint8_t i = 0; i < light_count; i++, p += 9) {
+    p[0] = 0x00;
+    p[1] = light_ids[i] >> 8;
+    p[2] = light_ids[i] & 0xff;
+    // 8 to 16 bit by repeating the byte (x * 257)
+    p[3] = p[4] = color.r;
+    p[5] = p[6] = color.g;
+    p[7] = p[8] = color.b;
+  }
+
+  cyw43_arch_lwip_begin();
+  int ret = mbedtls_ssl_write(&ssl, frame, 16 + 9 * light_count);
+  cyw43_arch_lwip_end();
+  if (ret < 0) {
+    fail(ret);
+    return;
+  }
+  stats.frames++;
+  last_frame_ms = now_ms();
+}
+
+void HueStream::on_tick() {
+  uint32_t now = now_ms();
+  if (state == State::HANDSHAKE) {
+    if (now - handshake_start_ms > HUE_STREAM_HANDSHAKE_TIMEOUT_MS) {
+      fail(MBEDTLS_ERR_SSL_TIMEOUT);
+      return;
+    }
+    cyw43_arch_lwip_begin();
+    continue_handshake(); // Drives retransmissions
+    cyw43_arch_lwip_end();
+  } else if (state == State::STREAMING) {
+    // Full rate for a while after a change so a lost datagram is covered by
+    // the next one, keepalive rate otherwise
+    if (now - color_changed_ms < 10 * HUE_STREAM_INTERVAL_MS ||
+        now - last_frame_ms >= HUE_STREAM_KEEPALIVE_MS)
+      send_frame();
+  }
+
+  if (is_active()) {
+    btstack_run_loop_set_timer(&tick_timer, HUE_STREAM_INTERVAL_MS);
+    btstack_run_loop_add_timer(&tick_timer);
+  }
+}
+
+void HueStream::on_udp_recv(struct pbuf *p) {
+  if (!p)
+    return;
+  rx_len = pbuf_copy_partial(p, rx_buf, sizeof(rx_buf), 0);
+  pbuf_free(p);
+
+  if (state == State::HANDSHAKE) {
+    continue_handshake();
+  } else if (state == State::STREAMING) {
+    // The bridge sends nothing but alerts once streaming
+    uint8_t buf[32];
+    int ret = mbedtls_ssl_read(&ssl, buf, sizeof(buf));
+    if (ret < 0 && ret != MBEDTLS_ERR_SSL_WANT_READ)
+      fail(ret);
+  }
+}
+
+int HueStream::bio_send(void *ctx, const unsigned char *buf, size_t len) {
+  HueStream *self = static_cast<HueStream *>(ctx);
+  struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
+  if (!p) {
+    // Treated like loss on the air: frames are superseded by the next one
+    // and the handshake retransmits
+    self->stats.dropped++;
+    return (int)len;
+  }
+  memcpy(p->payload, buf, len);
+  if (udp_send(self->pcb, p) != ERR_OK)
+    self->stats.dropped++;
+  pbuf_free(p);
+  return (int)len;
+}
+
+int HueStream::bio_recv(void *ctx, unsigned char *buf, size_t len) {
+  HueStream *self = static_cast<HueStream *>(ctx);
+  if (self->rx_len == 0)
+    return MBEDTLS_ERR_SSL_WANT_READ;
+  size_t n = self->rx_len < len ? self->rx_len : len;
+  memcpy(buf, self->rx_buf, n);
+  self->rx_len = 0;
+  return (int)n;
+}
+
+void HueStream::timer_set(void *ctx, uint32_t int_ms, uint32_t fin_ms) {
+  HueStream *self = static_cast<HueStream *>(ctx);
+  self->timer_start_ms = now_ms();
+  self->timer_int_ms = int_ms;
+  self->timer_fin_ms = fin_ms;
+}
+
+// -1 cancelled, 0 running, 1 intermediate delay passed, 2 final delay passed
+int HueStream::timer_get(void *ctx) {
+  HueStream *self = static_cast<HueStream *>(ctx);
+  if (self->timer_fin_ms == 0)
+    return -1;
+  uint32_t elapsed = now_ms() - self->timer_start_ms;
+  if (elapsed >= self->timer_fin_ms)
+    return 2;
+  if (elapsed >= self->timer_int_ms)
+    return 1;
+  return 0;
+}
+
+void HueStream::print_stats() {
+  LOG_TELEMETRY(
+      "[HueStream] State %d, handshakes %lu (last %lu ms), failures %lu\n",
+      (int)state, stats.handshakes, stats.last_handshake_ms, stats.failures);
+  LOG_TELEMETRY("[HueStream] Frames %lu, dropped %lu\n", stats.frames,
+                stats.dropped);
+}
+
+#endif
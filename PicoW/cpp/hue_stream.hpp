@@ -0,0 +1,104 @@
+#pragma once
+
+#include "btstack.h"
+#include "config.h"
+#include "lwip/ip_addr.h"
+#include "lwip/udp.h"
+#include <cstdint>
+
+// Hue Entertainment streaming (enable with -DHUE_ENTERTAINMENT=ON). Colour
+// frames go to the bridge as HueStream v1 messages over DTLS 1.2 with a
+// pre-shared key (the clientkey from bridge registration), UDP port 2100.
+// The entertainment group must be activated over REST first (HueClient).
+#ifndef HUE_ENTERTAINMENT
+#define HUE_ENTERTAINMENT 0
+#endif
+
+#if HUE_ENTERTAINMENT
+
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ssl.h"
+
+#define HUE_STREAM_PORT 2100
+#define HUE_STREAM_MAX_LIGHTS 10 // Limit of the v1 streaming API
+#define HUE_STREAM_INTERVAL_MS 20 // 50 Hz while the colour is changing
+// Unchanged colours are resent at this interval; the bridge ends the stream
+// after 10 s without frames
+#define HUE_STREAM_KEEPALIVE_MS 1000
+#define HUE_STREAM_HANDSHAKE_TIMEOUT_MS 5000
+
+struct HueStreamStats {
+  uint32_t handshakes;
+  uint32_t last_handshake_ms;
+  uint32_t failures;
+  uint32_t frames;
+  uint32_t dropped; // Datagrams that could not be queued in lwIP
+};
+
+class HueStream {
+public:
+  enum class State { IDLE, HANDSHAKE, STREAMING, FAILED };
+
+  HueStream();
+  bool init(const char *ip, const char *identity, const char *psk_hex,
+            const char *lights);
+  void start();
+  void stop();
+  void set_color(Color color);
+  State get_state() const { return state; }
+  bool is_active() const {
+    return state == State::HANDSHAKE || state == State::STREAMING;
+  }
+  const HueStreamStats &get_stats() const { return stats; }
+  void print_stats();
+
+  // Internal use (public so C-style callbacks can reach them)
+  void on_udp_recv(struct pbuf *p);
+  void on_tick();
+
+private:
+  void continue_handshake();
+  void send_frame();
+  void fail(int ret);
+  void teardown();
+
+  // mbedTLS BIO and DTLS retransmission timer callbacks
+  static int bio_send(void *ctx, const unsigned char *buf, size_t len);
+  static int bio_recv(void *ctx, unsigned char *buf, size_t len);
+  static void timer_set(void *ctx, uint32_t int_ms, uint32_t fin_ms);
+  static int timer_get(void *ctx);
+
+  State state;
+  ip_addr_t addr;
+  const char *identity;
+  uint8_t psk[16];
+  uint16_t light_ids[HUE_STREAM_MAX_LIGHTS];
+  uint8_t light_count;
+  bool configured;
+
+  struct udp_pcb *pcb;
+  mbedtls_ssl_context ssl;
+  mbedtls_ssl_config conf;
+  mbedtls_ctr_drbg_context drbg;
+  mbedtls_entropy_context entropy;
+
+  // One datagram handed from lwIP to mbedTLS
+  uint8_t rx_buf[256];
+  uint16_t rx_len;
+
+  uint32_t timer_start_ms;
+  uint32_t timer_int_ms;
+  uint32_t timer_fin_ms; // 0 = cancelled
+
+  Color color;
+  uint32_t color_changed_ms;
+  uint32_t last_frame_ms;
+  uint32_t handshake_start_ms;
+  uint8_t sequence;
+  btstack_timer_source_t tick_timer;
+
+  HueStreamStats stats;
+};
+
+#endif
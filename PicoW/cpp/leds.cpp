@@ -63,24 +63,3 @@ void LEDController::flash_green() {
   }
   clear();
 }
-
-Color LEDController::update_from_power(uint16_t power, uint16_t ftp) {
-  float percentage = ((float)power / (float)ftp) * 100.0f;
-  Color target_color = {0, 0, 0};
-
-  for (const auto &zone : POWER_ZONES) {
-    if (percentage >= zone.min_percent && percentage < zone.max_percent) {
-      target_color = zone.color;
-      break;
-    }
-  }
-
-  // Check for last zone (handle > max)
-  const auto &last_zone = POWER_ZONES.back();
-  if (percentage >= last_zone.min_percent) {
-    target_color = last_zone.color;
-  }
-
-  fill(target_color);
-  return target_color;
-}
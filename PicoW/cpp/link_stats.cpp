@@ -0,0 +1,153 @@
+#include "link_stats.hpp"
+#include "config.h"
+#include "log.hpp"
+#include <cstring>
+
+static const uint32_t HISTOGRAM_EDGES_MS[LinkStats::HISTOGRAM_BINS - 1] = {
+    50, 100, 200, 300, 500, 1000, 2000};
+
+void LinkStats::reset() {
+  received = 0;
+  estimated_missed = 0;
+  gaps = 0;
+  confirmed = 0;
+  idle_gaps = 0;
+  max_interval_ms = 0;
+  period_ms = 0;
+  jitter_ms = 0;
+  memset(histogram, 0, sizeof(histogram));
+  have_prev = false;
+  prev_ms = 0;
+  memset(&prev, 0, sizeof(prev));
+}
+
+// Cycling Power Measurement (0x2A63): flags (16), instantaneous power (16),
+// then optional fields in flag order
+bool LinkStats::parse(const uint8_t *value, uint16_t len, Counters &out) {
+  memset(&out, 0, sizeof(out));
+  if (len < 4)
+    return false;
+  uint16_t flags = value[0] | (value[1] << 8);
+  uint16_t pos = 4;
+
+  if (flags & (1 << 0)) // Pedal power balance
+    pos += 1;
+  if (flags & (1 << 2)) // Accumulated torque
+    pos += 2;
+  if (flags & (1 << 4)) { // Wheel revolutions (32) + last event time (16)
+    if (pos + 6 > len)
+      return false;
+    out.wheel_revs = value[pos] | (value[pos + 1] << 8) |
+                     (value[pos + 2] << 16) | ((uint32_t)value[pos + 3] << 24);
+    out.has_wheel = true;
+    pos += 6;
+  }
+  if (flags & (1 << 5)) { // Crank revolutions (16) + last event time (16)
+    if (pos + 4 > len)
+      return false;
+    out.crank_revs = value[pos] | (value[pos + 1] << 8);
+    out.has_crank = true;
+    pos += 4;
+  }
+  if (flags & (1 << 6)) // Extreme force magnitudes
+    pos += 4;
+  if (flags & (1 << 7)) // Extreme torque magnitudes
+    pos += 4;
+  if (flags & (1 << 8)) // Extreme angles (2 x 12 bit)
+    pos += 3;
+  if (flags & (1 << 9)) // Top dead spot angle
+    pos += 2;
+  if (flags & (1 << 10)) // Bottom dead spot angle
+    pos += 2;
+  if (flags & (1 << 11)) { // Accumulated energy (kJ)
+    if (pos + 2 > len)
+      return false;
+    out.energy_kj = value[pos] | (value[pos + 1] << 8);
+    out.has_energy = true;
+  }
+  return true;
+}
+
+bool LinkStats::counters_advanced(const Counters &now) const {
+  return (now.has_wheel && prev.has_wheel &&
+          now.wheel_revs != prev.wheel_revs) ||
+         (now.has_crank && prev.has_crank &&
+          now.crank_revs != prev.crank_revs) ||
+         (now.has_energy && prev.has_energy &&
+          now.energy_kj != prev.energy_kj);
+}
+
+void LinkStats::on_notification(const uint8_t *value, uint16_t len,
+                                uint32_t now_ms) {
+  received++;
+  Counters now;
+  bool valid = parse(value, len, now);
+
+  if (have_prev) {
+    uint32_t dt = now_ms - prev_ms;
+    size_t bin = 0;
+    while (bin < HISTOGRAM_BINS - 1 && dt > HISTOGRAM_EDGES_MS[bin])
+      bin++;
+    histogram[bin]++;
+    if (dt > max_interval_ms)
+      max_interval_ms = dt;
+
+    if (valid && ((now.has_wheel && prev.has_wheel &&
+                   now.wheel_revs < prev.wheel_revs) ||
+                  (now.has_energy && prev.has_energy &&
+                   now.energy_kj < prev.energy_kj))) {
+      LOG_WARN("[BLE] Measurement counters went backwards (sensor reset)\n");
+    }
+
+    if (period_ms && dt > period_ms * LINK_STATS_GAP_FACTOR_PCT / 100) {
+      gaps++;
+      uint32_t missed = (dt + period_ms / 2) / period_ms - 1;
+      bool has_counters = valid && (now.has_wheel || now.has_crank ||
+                                    now.has_energy);
+      if (!has_counters) {
+        // Nothing to confirm against: assume the notifications were lost
+        estimated_missed += missed;
+      } else if (counters_advanced(now)) {
+        confirmed++;
+        estimated_missed += missed;
+      } else {
+        idle_gaps++;
+      }
+    } else if (dt >= LINK_STATS_MIN_PERIOD_MS) {
+      // Back-to-back notifications from one connection event would drag the
+      // nominal period down, so they are left out
+      if (period_ms == 0) {
+        period_ms = dt;
+      } else {
+        uint32_t dev = dt > period_ms ? dt - period_ms : period_ms - dt;
+        jitter_ms = (jitter_ms * 7 + dev) / 8;
+        period_ms = (period_ms * 7 + dt) / 8;
+      }
+    }
+  }
+
+  have_prev = true;
+  prev_ms = now_ms;
+  if (valid)
+    prev = now;
+}
+
+uint32_t LinkStats::loss_permille() const {
+  uint32_t total = received + estimated_missed;
+  return total ? (uint32_t)((uint64_t)estimated_missed * 1000 / total) : 0;
+}
+
+void LinkStats::print(int link) const {
+  LOG_TELEMETRY("[BLE %d] Received %lu, est. missed %lu, loss %lu permille\n",
+                link, received, estimated_missed, loss_permille());
+  LOG_TELEMETRY("[BLE %d] Gaps %lu (counters moved %lu, sensor idle %lu)\n",
+                link, gaps, confirmed, idle_gaps);
+  LOG_TELEMETRY("[BLE %d] Period %lu ms, jitter %lu ms, max interval %lu ms\n",
+                link, period_ms, jitter_ms, max_interval_ms);
+  LOG_TELEMETRY("[BLE %d] Intervals <=50:%lu <=100:%lu <=200:%lu\n", link,
+                histogram[0], histogram[1], histogram[2]);
+  LOG_TELEMETRY("[BLE %d] Intervals <=300:%lu <=500:%lu <=1000:%lu\n", link,
+                histogram[3], histogram[4], histogram[5]);
+  LOG_TELEMETRY("[BLE %d] Intervals <=2000:%lu >2000:%lu\n", link, histogram[6],
+                histogram[7]);
+}
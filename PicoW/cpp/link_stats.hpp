@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Notification loss and jitter statistics for one power source link.
+//
+// Gaps are detected from inter-arrival times against the link's nominal
+// notification period. The cumulative counters in the Cycling Power
+// Measurement (wheel and crank revolutions, accumulated energy) tell a lost
+// notification apart from a sensor that simply paused: if the counters moved
+// across a gap the sensor kept producing data we did not receive.
+class LinkStats {
+public:
+  // Inter-arrival bins: <=50, 100, 200, 300, 500, 1000, 2000, >2000 ms
+  static constexpr size_t HISTOGRAM_BINS = 8;
+
+  void reset(); // On (re)connect; all-zero is also a valid initial state
+  void on_notification(const uint8_t *value, uint16_t len, uint32_t now_ms);
+  void print(int link) const;
+
+  uint32_t get_received() const { return received; }
+  uint32_t get_estimated_missed() const { return estimated_missed; }
+  // Estimated loss as missed / (received + missed), in 1/1000
+  uint32_t loss_permille() const;
+
+private:
+  // Fields of interest from one Cycling Power Measurement
+  struct Counters {
+    bool has_wheel;
+    bool has_crank;
+    bool has_energy;
+    uint32_t wheel_revs;
+    uint16_t crank_revs;
+    uint16_t energy_kj;
+  };
+
+  static bool parse(const uint8_t *value, uint16_t len, Counters &out);
+  bool counters_advanced(const Counters &now) const;
+
+  uint32_t received;
+  uint32_t estimated_missed;
+  uint32_t gaps;      // Inter-arrival above the gap threshold
+  uint32_t confirmed; // Gaps where the counters show the sensor was active
+  uint32_t idle_gaps; // Gaps with counters present but unchanged
+  uint32_t max_interval_ms;
+  uint32_t period_ms; // EMA of intervals outside gaps (nominal period)
+  uint32_t jitter_ms; // EMA of |interval - period|
+  uint32_t histogram[HISTOGRAM_BINS];
+
+  bool have_prev;
+  uint32_t prev_ms;
+  Counters prev;
+};
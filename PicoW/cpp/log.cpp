@@ -0,0 +1,92 @@
+#include "log.hpp"
+#include "btstack_run_loop.h"
+#include "pico/stdlib.h"
+#include <atomic>
+#include <cstdarg>
+#include <cstdio>
+
+static_assert((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0,
+              "LOG_RING_SIZE must be a power of two");
+
+// Single-producer / single-consumer ring. All producers (BTstack and lwIP
+// callbacks) run in the same async context, and so does the drain timer, so
+// plain acquire/release loads and stores are enough (no atomic RMW, which the
+// Cortex-M0+ lacks).
+static LogRecord ring[LOG_RING_SIZE];
+static std::atomic<uint32_t> ring_head{0}; // Written by producer
+static std::atomic<uint32_t> ring_tail{0}; // Written by consumer
+static uint32_t dropped_count = 0;
+
+static btstack_timer_source_t drain_timer;
+
+// Drain cadence and batch size; kept small so USB CDC writes never hog the
+// run loop.
+static const uint32_t LOG_DRAIN_INTERVAL_MS = 20;
+static const size_t LOG_DRAIN_BATCH = 4;
+
+static void drain_handler(btstack_timer_source_t *ts) {
+  log_drain(LOG_DRAIN_BATCH);
+  btstack_run_loop_set_timer(ts, LOG_DRAIN_INTERVAL_MS);
+  btstack_run_loop_add_timer(ts);
+}
+
+void log_init() {
+  drain_timer.process = &drain_handler;
+  btstack_run_loop_set_timer(&drain_timer, LOG_DRAIN_INTERVAL_MS);
+  btstack_run_loop_add_timer(&drain_timer);
+}
+
+void log_push(uint8_t level, const char *fmt, uint8_t nargs,
+              const uintptr_t *args) {
+  uint32_t head = ring_head.load(std::memory_order_relaxed);
+  uint32_t tail = ring_tail.load(std::memory_order_acquire);
+  if (head - tail >= LOG_RING_SIZE) {
+    dropped_count++;
+    return;
+  }
+
+  LogRecord &rec = ring[head & (LOG_RING_SIZE - 1)];
+  rec.timestamp_ms = to_ms_since_boot(get_absolute_time());
+  rec.fmt = fmt;
+  rec.level = level;
+  rec.nargs = nargs;
+  for (uint8_t i = 0; i < nargs; i++)
+    rec.args[i] = args[i];
+
+  ring_head.store(head + 1, std::memory_order_release);
+}
+
+void log_drain(size_t max_records) {
+  static uint32_t reported_dropped = 0;
+
+  for (size_t n = 0; n < max_records; n++) {
+    uint32_t tail = ring_tail.load(std::memory_order_relaxed);
+    uint32_t head = ring_head.load(std::memory_order_acquire);
+    if (tail == head)
+      break;
+
+    const LogRecord &rec = ring[tail & (LOG_RING_SIZE - 1)];
+    printf("[%lu] ", (unsigned long)rec.timestamp_ms);
+    // Unused argument slots are harmless for printf-style varargs
+    printf(rec.fmt, rec.args[0], rec.args[1], rec.args[2], rec.args[3]);
+
+    ring_tail.store(tail + 1, std::memory_order_release);
+  }
+
+  if (dropped_count != reported_dropped) {
+    printf("[Log] Dropped %lu records\n",
+           (unsigned long)(dropped_count - reported_dropped));
+    reported_dropped = dropped_count;
+  }
+}
+
+void log_print(const char *fmt, ...) {
+  log_drain(LOG_RING_SIZE); // Keep the order
+  printf("[%lu] ", (unsigned long)to_ms_since_boot(get_absolute_time()));
+  va_list args;
+  va_start(args, fmt);
+  vprintf(fmt, args);
+  va_end(args);
+}
+
+uint32_t log_dropped() { return dropped_count; }
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// Compile-time log levels. Anything above LOG_LEVEL compiles to nothing, so
+// disabled call sites cost no code and do not evaluate their arguments.
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_TELEMETRY 3 // Periodic status and statistics
+#define LOG_LEVEL_INFO 4
+#define LOG_LEVEL_DEBUG 5
+
+#ifndef LOG_LEVEL
+#ifdef NDEBUG
+#define LOG_LEVEL LOG_LEVEL_TELEMETRY
+#else
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+#endif
+
+// Records are stored in binary form (format pointer + raw arguments) and only
+// formatted when drained to USB stdio from a low-priority run loop timer.
+//
+// Restrictions on arguments:
+//  - integers and pointers only (no float/double)
+//  - %s arguments must point to storage that outlives the drain (literals,
+//    static buffers that are not rewritten), since only the pointer is kept
+constexpr size_t LOG_MAX_ARGS = 4;
+constexpr size_t LOG_RING_SIZE = 64; // Records, must be a power of two
+
+struct LogRecord {
+  uint32_t timestamp_ms;
+  const char *fmt;
+  uint8_t level;
+  uint8_t nargs;
+  uintptr_t args[LOG_MAX_ARGS];
+};
+
+void log_init();
+void log_push(uint8_t level, const char *fmt, uint8_t nargs,
+              const uintptr_t *args);
+void log_drain(size_t max_records);
+uint32_t log_dropped();
+// Telemetry is printed at once, after whatever is still queued: one report is
+// more lines than the ring holds. For timers only, never the notification
+// path.
+void log_print(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+// Never defined or called: the LOG_* macros pass their arguments to it
+// unevaluated, so the compiler checks them against the format as it does
+// for printf (log_write() is a template and cannot carry the attribute)
+int log_check_format(const char *fmt, ...)
+    __attribute__((format(printf, 1, 2)));
+
+template <typename T> inline uintptr_t log_arg(T value) {
+  static_assert(!std::is_floating_point<T>::value,
+                "log: floating point arguments are not supported");
+  if constexpr (std::is_pointer<T>::value) {
+    return reinterpret_cast<uintptr_t>(value);
+  } else {
+    return static_cast<uintptr_t>(value);
+  }
+}
+
+template <typename... Args>
+inline void log_write(uint8_t level, const char *fmt, Args... args) {
+  static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "log: too many arguments");
+  uintptr_t packed[LOG_MAX_ARGS] = {log_arg(args)...};
+  log_push(level, fmt, sizeof...(Args), packed);
+}
+
+#define LOG_WRITE(level, ...)                                                  \
+  ((void)sizeof(log_check_format(__VA_ARGS__)), log_write(level, __VA_ARGS__))
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) LOG_WRITE(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) LOG_WRITE(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_TELEMETRY
+#define LOG_TELEMETRY(...) log_print(__VA_ARGS__)
+#else
+#define LOG_TELEMETRY(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) LOG_WRITE(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) LOG_WRITE(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
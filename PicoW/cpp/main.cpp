@@ -1,26 +1,39 @@
 #include "ble_client.hpp"
 #include "btstack_run_loop.h"
 #include "display.hpp"
-#include "hue_client.hpp"
+#include "hci_capture.hpp"
+#include "hue_controller.hpp"
 #include "leds.hpp"
+#include "power_relay.hpp"
+#include "smoother.hpp"
+#include "zone_predictor.hpp"
+#include "log.hpp"
+#include "output_align.hpp"
 #include "pico/cyw43_arch.h"
 #include "pico/stdlib.h"
 #include <cstdio>
-#include <deque>
-#include <numeric>
 
 LEDController leds;
 Display display;
 BLEClient client;
-HueClient hue;
+HueController hue;
+PowerRelay relay;
+ZonePredictor predictor;
+OutputAligner aligner;
 
 static btstack_timer_source_t heartbeat;
 static btstack_timer_source_t ui_timer;
 
+static uint32_t heartbeat_count = 0;
+static const uint32_t TELEMETRY_INTERVAL_S = 10;
+
 static uint16_t last_power = 0;
 static uint16_t current_ftp = DEFAULT_FTP;
 static bool show_ftp = false;
 static bool hue_enabled = true; // Default ON
+// Set by power updates; the status screen is redrawn from ui_handler, so
+// the notification path neither formats text nor draws
+static bool status_dirty = false;
 
 // Button State Tracking (Simple Polling)
 struct Button {
@@ -49,9 +62,7 @@ struct Button {
 
 Button btn_a, btn_b, btn_x, btn_y;
 
-// Smoothing Buffer (Size 5 for approx 1.5s smoothing if ~3Hz updates)
-static std::deque<uint16_t> power_history;
-static const size_t SMOOTHING_WINDOW = 5;
+static Smoother smoother;
 
 static uint32_t btn_x_press_start = 0;
 static bool btn_x_handled = false;
@@ -65,11 +76,35 @@ static uint32_t last_repeat_time = 0;
 static uint32_t last_active_power_time = 0;
 static bool hue_auto_off_sent = false;
 
+static Color zone_color_for(uint16_t power) {
+  return POWER_ZONES[ZonePredictor::zone_of(power, current_ftp)].color;
+}
+
+// Redraw the status screen with the current state. Only the display: the
+// light outputs go through the aligner from the power path, and are left off
+// during auto-off.
+static void show_status() {
+  Color zone_color = zone_color_for(last_power);
+  bool wifi_up =
+      cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA) == CYW43_LINK_UP;
+  display.update_status(true, wifi_up, last_power, zone_color, show_ftp,
+                        current_ftp, hue_enabled, hue.is_reachable());
+}
+
 void heartbeat_handler(btstack_timer_source_t *ts) {
+  client.check_watchdog();
+
   if (client.is_connected()) {
-    printf("[Status] Connected | Power: %d W | FTP: %d\n", last_power,
-           current_ftp);
-    client.check_watchdog();
+    LOG_TELEMETRY("[Status] Connected | Power: %d W | FTP: %d\n", last_power,
+                  current_ftp);
+
+    if (++heartbeat_count % TELEMETRY_INTERVAL_S == 0) {
+      client.print_link_info();
+      relay.print_stats();
+      hue.print_stats();
+      predictor.print_stats();
+      aligner.print_stats();
+    }
 
     // Auto Hue Off (60s timeout)
     if (hue_enabled && !hue_auto_off_sent && last_power == 0) {
@@ -84,6 +119,7 @@ void heartbeat_handler(btstack_timer_source_t *ts) {
         hue.turn_off();
         cyw43_arch_lwip_end();
         hue_auto_off_sent = true;
+        aligner.cancel();
         leds.clear(); // Turn off LED strip
         display.set_led({0, 0, 0}); // Sync LED Off
       }
@@ -96,57 +132,74 @@ void heartbeat_handler(btstack_timer_source_t *ts) {
 }
 
 void on_power_update(uint16_t raw_power) {
-  // Add to buffer
-  power_history.push_back(raw_power);
-  if (power_history.size() > SMOOTHING_WINDOW) {
-    power_history.pop_front();
-  }
-
-  // Calculate Average
-  uint32_t sum = 0;
-  for (uint16_t p : power_history)
-    sum += p;
-  uint16_t avg_power = sum / power_history.size();
+  uint32_t now = to_ms_since_boot(get_absolute_time());
+  uint16_t avg_power = smoother.add(raw_power, now);
 
   last_power = avg_power;
+  size_t hue_zone = predictor.update(avg_power, current_ftp, now);
 
   // Check if we're transitioning from auto-off back to active
   bool was_auto_off = hue_auto_off_sent;
   
   if (avg_power > 0) {
-    last_active_power_time = to_ms_since_boot(get_absolute_time());
+    last_active_power_time = now;
     hue_auto_off_sent = false;
     
     // If we were in auto-off state and now have power, explicitly turn everything back on
     if (was_auto_off && hue_enabled) {
-      printf("[Auto] Power detected after auto-off. Turning lights back on.\n");
+      LOG_INFO("[Auto] Power detected after auto-off. Turning lights back on.\n");
+      hue.wake();
     }
   }
 
-  printf("Power: %d W (Raw: %d)\n", avg_power, raw_power);
+  LOG_DEBUG("Power: %d W (Raw: %d)\n", avg_power, raw_power);
 
-  Color zone_color = leds.update_from_power(avg_power, current_ftp);
-  bool wifi_up =
-      cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA) == CYW43_LINK_UP;
-  display.update_status(true, wifi_up, avg_power, zone_color, show_ftp,
-                        current_ftp, hue_enabled, hue.hub_reachable);
+  // The strip and LED wait for the Hue lights when alignment is on
+  aligner.set_latency(OUTPUT_HUE, hue.get_latency_ms());
+  Color zone_color = zone_color_for(avg_power);
+  aligner.present(OUTPUT_STRIP, zone_color);
+  status_dirty = true;
 
   // Gate LED Control matches Hue State
   if (hue_enabled && !hue_auto_off_sent) {
-    display.set_led(zone_color);
+    aligner.present(OUTPUT_LED, zone_color);
   } else {
-    display.set_led({0, 0, 0});
+    aligner.present(OUTPUT_LED, {0, 0, 0});
   }
 
-  // Update Hue
-  if (hue_enabled) {
-    cyw43_arch_lwip_begin();
-    hue.update(zone_color);
-    cyw43_arch_lwip_end();
+  // Update Hue, ahead of the strip when a zone change is predicted
+  if (hue_enabled && !hue_auto_off_sent)
+    aligner.present(OUTPUT_HUE, POWER_ZONES[hue_zone].color);
+}
+
+// Single-character commands over USB serial
+void handle_usb_command() {
+  int c = getchar_timeout_us(0);
+  if (c == PICO_ERROR_TIMEOUT)
+    return;
+
+  switch (c) {
+  case 'd': // Dump HCI capture (btsnoop, hex)
+    hci_capture_export();
+    break;
+  case 'f': { // Next power smoothing filter
+    int next = ((int)smoother.get_mode() + 1) % (int)SmoothingMode::COUNT;
+    smoother.set_mode((SmoothingMode)next);
+    printf("Smoothing -> %s\n", Smoother::mode_name(smoother.get_mode()));
+    break;
+  }
+  case 'a': // Toggle presentation delay alignment
+    aligner.set_enabled(!aligner.is_enabled());
+    printf("Output alignment -> %d\n", aligner.is_enabled());
+    break;
+  default:
+    break;
   }
 }
 
 void ui_handler(btstack_timer_source_t *ts) {
+  handle_usb_command();
+
   // Poll Buttons
   if (btn_y.just_pressed()) {
     show_ftp = !show_ftp;
@@ -217,18 +270,24 @@ void ui_handler(btstack_timer_source_t *ts) {
         hue_enabled = !hue_enabled;
         printf("UI: Hue Toggle -> %d\n", hue_enabled);
 
-        cyw43_arch_lwip_begin();
         if (!hue_enabled) {
+          cyw43_arch_lwip_begin();
           hue.turn_off();
+          cyw43_arch_lwip_end();
+          aligner.cancel();
           leds.clear(); // Turn off LED strip
           display.set_led({0, 0, 0}); // Sync LED Off
         } else {
-          // Immediate Wake with current settings
-          Color zone_color = leds.update_from_power(last_power, current_ftp);
-          hue.update(zone_color);
-          display.set_led(zone_color); // Sync LED On
+          // Immediate Wake with current settings, aligned like any update,
+          // and the auto-off timeout counting from now
+          hue_auto_off_sent = false;
+          last_active_power_time = now;
+          Color zone_color = zone_color_for(last_power);
+          hue.wake();
+          aligner.present(OUTPUT_STRIP, zone_color);
+          aligner.present(OUTPUT_LED, zone_color);
+          aligner.present(OUTPUT_HUE, zone_color);
         }
-        cyw43_arch_lwip_end();
 
         btn_x_handled = true;
         changed = true;
@@ -239,27 +298,33 @@ void ui_handler(btstack_timer_source_t *ts) {
     btn_x_handled = false;
   }
 
+  // Scan log lines are batched and flushed at a limited rate
+  if (!client.is_connected()) {
+    display.render_logs_if_due(now);
+  }
+
+  if (status_dirty) {
+    status_dirty = false;
+    changed |= client.is_connected();
+  }
+
   // Force display update if UI changed and we are connected (so the screen is
   // active)
   if (changed || (btn_y.just_pressed() && client.is_connected())) {
-    Color zone_color = leds.update_from_power(last_power, current_ftp);
-    bool wifi_up =
-        cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA) == CYW43_LINK_UP;
-    display.update_status(true, wifi_up, last_power, zone_color, show_ftp,
-                          current_ftp, hue_enabled, hue.hub_reachable);
+    show_status();
   }
 
   btstack_run_loop_set_timer(ts, 20); // Poll at 50Hz (20ms)
   btstack_run_loop_add_timer(ts);
 }
 
-void on_scan_result(const char *mac, const char *name) {
-  printf("Found: %s | %s\n", mac, name);
+void on_scan_result(const char *mac, const char *name, int8_t rssi) {
+  printf("Found: %s | %s | %d dBm\n", mac, name, rssi);
   char buf[64];
   if (strlen(name) > 0) {
-    snprintf(buf, sizeof(buf), "> %s", name);
+    snprintf(buf, sizeof(buf), "> %s %d", name, rssi);
   } else {
-    snprintf(buf, sizeof(buf), "> %s", mac);
+    snprintf(buf, sizeof(buf), "> %s %d", mac, rssi);
   }
   display.add_log_line(buf);
 }
@@ -285,13 +350,26 @@ int main() {
     // Continue anyway? Or halt? Let's continue but log error.
   } else {
     printf("WiFi Connected!\n");
+    // Reachability is probed in the background, boot does not wait for it.
+    // The icon follows changes while the status screen is up.
+    hue.set_reachability_callback([](bool reachable) {
+      (void)reachable;
+      if (client.is_connected())
+        show_status();
+    });
     hue.init();
-    hue.check_reachable();
   }
 
   // 1. Initialize
   leds.init();
   display.init();
+  aligner.init(OUTPUT_STRIP, [](Color color) { leds.fill(color); });
+  aligner.init(OUTPUT_LED, [](Color color) { display.set_led(color); });
+  aligner.init(OUTPUT_HUE, [](Color color) {
+    cyw43_arch_lwip_begin();
+    hue.update(color);
+    cyw43_arch_lwip_end();
+  });
   display.text("ZwiftPowerLighting\nC++ Starting...", 10, 10, {255, 255, 255},
                2);
 
@@ -307,9 +385,19 @@ int main() {
   // 4. Initialize BLE
   client.set_power_callback(on_power_update);
   client.set_scan_callback(on_scan_result);
+  hci_capture_init(); // Before BLE power on so the init sequence is captured
   client.init();
+  if (BLE_RELAY_ENABLED) {
+    client.set_notification_callback(
+        [](const uint8_t *value, uint16_t len, uint64_t rx_time_us) {
+          relay.forward(value, len, rx_time_us);
+        });
+    relay.init();
+  }
+
+  // 5. Start log drain (low-priority USB output) and Heartbeat Timer
+  log_init();
 
-  // 5. Setup Heartbeat Timer
   heartbeat.process = &heartbeat_handler;
   btstack_run_loop_set_timer(&heartbeat, 1000);
   btstack_run_loop_add_timer(&heartbeat);
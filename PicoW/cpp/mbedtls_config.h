@@ -0,0 +1,36 @@
+#ifndef _MBEDTLS_CONFIG_H
+#define _MBEDTLS_CONFIG_H
+
+// Minimal mbedTLS configuration for Hue Entertainment streaming: DTLS 1.2
+// client with TLS_PSK_WITH_AES_128_GCM_SHA256 only (HUE_ENTERTAINMENT=ON)
+
+// Platform: entropy from the Pico's hardware (pico_mbedtls), no filesystem
+#define MBEDTLS_NO_PLATFORM_ENTROPY
+#define MBEDTLS_ENTROPY_HARDWARE_ALT
+#define MBEDTLS_ENTROPY_C
+#define MBEDTLS_CTR_DRBG_C
+
+// Crypto needed by the cipher suite and the TLS 1.2 PRF
+#define MBEDTLS_AES_C
+#define MBEDTLS_GCM_C
+#define MBEDTLS_CIPHER_C
+#define MBEDTLS_MD_C
+#define MBEDTLS_SHA256_C
+
+// (D)TLS client
+#define MBEDTLS_SSL_TLS_C
+#define MBEDTLS_SSL_CLI_C
+#define MBEDTLS_SSL_PROTO_TLS1_2
+#define MBEDTLS_SSL_PROTO_DTLS
+#define MBEDTLS_SSL_DTLS_ANTI_REPLAY
+#define MBEDTLS_SSL_DTLS_HELLO_VERIFY
+#define MBEDTLS_KEY_EXCHANGE_PSK_ENABLED
+
+// Small records: frames are < 120 bytes, handshake messages a few hundred
+#define MBEDTLS_SSL_IN_CONTENT_LEN 1024
+#define MBEDTLS_SSL_OUT_CONTENT_LEN 1024
+#define MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+
+#define MBEDTLS_AES_FEWER_TABLES
+
+#endif
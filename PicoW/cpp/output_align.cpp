@@ -0,0 +1,150 @@
+#include "output_align.hpp"
+#include "log.hpp"
+#include "pico/stdlib.h"
+
+static void align_timer_handler(btstack_timer_source_t *ts) {
+  static_cast<OutputAligner *>(btstack_run_loop_get_timer_context(ts))
+      ->on_timer();
+}
+
+OutputAligner::OutputAligner() : enabled(OUTPUT_ALIGN_ENABLED) {
+  for (Channel &c : channels) {
+    c.latency_us = 0;
+    c.measured = true;
+    c.head = 0;
+    c.count = 0;
+  }
+  btstack_run_loop_set_timer_handler(&timer, &align_timer_handler);
+  btstack_run_loop_set_timer_context(&timer, this);
+}
+
+void OutputAligner::init(Output output, Apply apply) {
+  channels[output].apply = apply;
+}
+
+void OutputAligner::set_enabled(bool on) {
+  if (!on) {
+    // Show what is pending right away
+    for (size_t o = 0; o < OUTPUT_COUNT; o++) {
+      Channel &c = channels[o];
+      if (c.count > 0)
+        apply((Output)o, c.queue[(c.head + c.count - 1) % QUEUE_SIZE].color);
+    }
+    cancel();
+  }
+  enabled = on;
+}
+
+void OutputAligner::set_latency(Output output, uint32_t latency_ms) {
+  channels[output].latency_us = latency_ms * 1000;
+  channels[output].measured = false;
+}
+
+// Catch up with the slowest output, within the cap
+uint32_t OutputAligner::delay_ms(Output output) const {
+  if (!enabled)
+    return 0;
+  uint32_t slowest_us = 0;
+  for (const Channel &c : channels) {
+    if (c.latency_us > slowest_us)
+      slowest_us = c.latency_us;
+  }
+  uint32_t delay = (slowest_us - channels[output].latency_us) / 1000;
+  return delay < OUTPUT_ALIGN_MAX_DELAY_MS ? delay : OUTPUT_ALIGN_MAX_DELAY_MS;
+}
+
+void OutputAligner::apply(Output output, Color color) {
+  Channel &c = channels[output];
+  if (!c.apply)
+    return;
+  if (!c.measured) {
+    c.apply(color);
+    return;
+  }
+  uint32_t start = time_us_32();
+  c.apply(color);
+  uint32_t took = time_us_32() - start;
+  c.latency_us = c.latency_us ? (c.latency_us * 7 + took) / 8 : took;
+}
+
+void OutputAligner::present(Output output, Color color) {
+  Channel &c = channels[output];
+  uint32_t delay = delay_ms(output);
+  if (delay == 0 && c.count == 0) {
+    apply(output, color);
+    return;
+  }
+
+  uint32_t now = to_ms_since_boot(get_absolute_time());
+  uint32_t due = now + delay;
+  if (c.count > 0) {
+    // Keep the order if the delay shrank
+    uint32_t last_due = c.queue[(c.head + c.count - 1) % QUEUE_SIZE].due_ms;
+    if ((int32_t)(due - last_due) < 0)
+      due = last_due;
+  }
+  if (c.count == QUEUE_SIZE) {
+    apply(output, c.queue[c.head].color); // Full: show the oldest now
+    c.head = (c.head + 1) % QUEUE_SIZE;
+    c.count--;
+  }
+  c.queue[(c.head + c.count) % QUEUE_SIZE] = {due, color};
+  c.count++;
+  schedule(now);
+}
+
+void OutputAligner::cancel() {
+  for (Channel &c : channels) {
+    c.head = 0;
+    c.count = 0;
+  }
+  btstack_run_loop_remove_timer(&timer);
+}
+
+void OutputAligner::on_timer() {
+  uint32_t now = to_ms_since_boot(get_absolute_time());
+  for (size_t o = 0; o < OUTPUT_COUNT; o++) {
+    Channel &c = channels[o];
+    // Only the newest colour that is due matters
+    bool due = false;
+    Color color = {0, 0, 0};
+    while (c.count > 0 && (int32_t)(now - c.queue[c.head].due_ms) >= 0) {
+      color = c.queue[c.head].color;
+      due = true;
+      c.head = (c.head + 1) % QUEUE_SIZE;
+      c.count--;
+    }
+    if (due)
+      apply((Output)o, color);
+  }
+  schedule(now);
+}
+
+void OutputAligner::schedule(uint32_t now) {
+  bool pending = false;
+  uint32_t wait_ms = 0;
+  for (const Channel &c : channels) {
+    if (c.count == 0)
+      continue;
+    int32_t wait = (int32_t)(c.queue[c.head].due_ms - now);
+    if (wait < 0)
+      wait = 0;
+    if (!pending || (uint32_t)wait < wait_ms)
+      wait_ms = wait;
+    pending = true;
+  }
+  btstack_run_loop_remove_timer(&timer);
+  if (!pending)
+    return;
+  btstack_run_loop_set_timer(&timer, wait_ms);
+  btstack_run_loop_add_timer(&timer);
+}
+
+void OutputAligner::print_stats() const {
+  LOG_TELEMETRY("[Align] %s, latency strip %lu us, LED %lu us, Hue %lu ms\n",
+                enabled ? "On" : "Off", channels[OUTPUT_STRIP].latency_us,
+                channels[OUTPUT_LED].latency_us,
+                channels[OUTPUT_HUE].latency_us / 1000);
+  LOG_TELEMETRY("[Align] Delay strip %lu ms, LED %lu ms\n",
+                delay_ms(OUTPUT_STRIP), delay_ms(OUTPUT_LED));
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "btstack_run_loop.h"
+#include "config.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// Outputs showing the power zone, in the order they are presented
+enum Output { OUTPUT_STRIP, OUTPUT_LED, OUTPUT_HUE, OUTPUT_COUNT };
+
+// Presentation delay: the strip and the onboard LED change within a
+// millisecond while the Hue lights lag by the bridge round trip and more, so
+// the room changes in two steps. With alignment enabled each colour is held
+// back by the difference between its output's latency and the slowest
+// output's (at most OUTPUT_ALIGN_MAX_DELAY_MS), so all change together.
+//
+// Local outputs are timed around their apply function; outputs that cannot
+// be timed that way (Hue) report their latency with set_latency().
+class OutputAligner {
+public:
+  using Apply = std::function<void(Color)>;
+
+  OutputAligner();
+  void init(Output output, Apply apply);
+  void set_enabled(bool enabled);
+  bool is_enabled() const { return enabled; }
+  void set_latency(Output output, uint32_t latency_ms);
+
+  // Shows color on output once its delay has passed
+  void present(Output output, Color color);
+  // Drops colours not yet shown (e.g. before turning everything off)
+  void cancel();
+  void print_stats() const;
+
+  // Internal use (public so C-style callbacks can reach them)
+  void on_timer();
+
+private:
+  static constexpr size_t QUEUE_SIZE = 8; // Per output, > cap / update rate
+
+  struct Pending {
+    uint32_t due_ms;
+    Color color;
+  };
+
+  struct Channel {
+    Apply apply;
+    uint32_t latency_us; // Smoothed
+    bool measured;       // Timed around apply() rather than reported
+    Pending queue[QUEUE_SIZE];
+    size_t head;
+    size_t count;
+  };
+
+  uint32_t delay_ms(Output output) const;
+  void apply(Output output, Color color);
+  void schedule(uint32_t now_ms);
+
+  Channel channels[OUTPUT_COUNT];
+  bool enabled;
+  btstack_timer_source_t timer;
+  bool timer_active;
+};
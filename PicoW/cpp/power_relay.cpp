@@ -0,0 +1,194 @@
+#include "power_relay.hpp"
+#include "cycling_power.h"
+#include "log.hpp"
+#include <cstdio>
+#include <cstring>
+
+static PowerRelay *relay_instance = nullptr;
+
+static const uint16_t MEASUREMENT_VALUE_HANDLE =
+    ATT_CHARACTERISTIC_ORG_BLUETOOTH_CHARACTERISTIC_CYCLING_POWER_MEASUREMENT_01_VALUE_HANDLE;
+static const uint16_t MEASUREMENT_CCC_HANDLE =
+    ATT_CHARACTERISTIC_ORG_BLUETOOTH_CHARACTERISTIC_CYCLING_POWER_MEASUREMENT_01_CLIENT_CONFIGURATION_HANDLE;
+static const uint16_t FEATURE_VALUE_HANDLE =
+    ATT_CHARACTERISTIC_ORG_BLUETOOTH_CHARACTERISTIC_CYCLING_POWER_FEATURE_01_VALUE_HANDLE;
+static const uint16_t SENSOR_LOCATION_VALUE_HANDLE =
+    ATT_CHARACTERISTIC_ORG_BLUETOOTH_CHARACTERISTIC_SENSOR_LOCATION_01_VALUE_HANDLE;
+
+// No optional Cycling Power features are advertised; the measurement flags of
+// each forwarded notification still describe the fields that are present.
+static const uint8_t CP_FEATURES[4] = {0, 0, 0, 0};
+static const uint8_t SENSOR_LOCATION_REAR_HUB = 13;
+
+static uint8_t adv_data[] = {
+    // Flags: LE General Discoverable, BR/EDR not supported
+    0x02, 0x01, 0x06,
+    // Complete list of 16-bit UUIDs: Cycling Power
+    0x03, 0x03, 0x18, 0x18,
+    // Complete local name
+    0x0a, 0x09, 'Z', 'P', 'L', ' ', 'P', 'o', 'w', 'e', 'r'};
+
+static void static_packet_handler(uint8_t packet_type, uint16_t channel,
+                                  uint8_t *packet, uint16_t size) {
+  if (relay_instance) {
+    relay_instance->packet_handler(packet_type, channel, packet, size);
+  }
+}
+
+static uint16_t static_read_callback(hci_con_handle_t con_handle,
+                                     uint16_t att_handle, uint16_t offset,
+                                     uint8_t *buffer, uint16_t buffer_size) {
+  if (!relay_instance)
+    return 0;
+  return relay_instance->read_callback(con_handle, att_handle, offset, buffer,
+                                       buffer_size);
+}
+
+static int static_write_callback(hci_con_handle_t con_handle,
+                                 uint16_t att_handle,
+                                 uint16_t transaction_mode, uint16_t offset,
+                                 uint8_t *buffer, uint16_t buffer_size) {
+  if (!relay_instance)
+    return 0;
+  return relay_instance->write_callback(con_handle, att_handle,
+                                        transaction_mode, offset, buffer,
+                                        buffer_size);
+}
+
+PowerRelay::PowerRelay()
+    : con_handle(HCI_CON_HANDLE_INVALID), notifications_enabled(false),
+      pending_len(0), pending_rx_us(0), pending(false) {
+  memset(&stats, 0, sizeof(stats));
+  relay_instance = this;
+}
+
+void PowerRelay::init() {
+  att_server_init(profile_data, static_read_callback, static_write_callback);
+  att_server_register_packet_handler(static_packet_handler);
+
+  // 100-150 ms advertising interval (units of 0.625 ms), connectable
+  bd_addr_t null_addr;
+  memset(null_addr, 0, sizeof(null_addr));
+  gap_advertisements_set_params(0x00A0, 0x00F0, 0, 0, null_addr, 0x07, 0x00);
+  gap_advertisements_set_data(sizeof(adv_data), adv_data);
+  gap_advertisements_enable(1);
+  printf("[Relay] Advertising Cycling Power as \"ZPL Power\"\n");
+}
+
+void PowerRelay::packet_handler(uint8_t packet_type, uint16_t channel,
+                                uint8_t *packet, uint16_t size) {
+  if (packet_type != HCI_EVENT_PACKET)
+    return;
+
+  switch (hci_event_packet_get_type(packet)) {
+  case ATT_EVENT_CONNECTED:
+    con_handle = att_event_connected_get_handle(packet);
+    printf("[Relay] Client connected. Handle: 0x%04x\n", con_handle);
+    break;
+
+  case ATT_EVENT_DISCONNECTED:
+    printf("[Relay] Client disconnected.\n");
+    con_handle = HCI_CON_HANDLE_INVALID;
+    notifications_enabled = false;
+    pending = false;
+    break;
+
+  case ATT_EVENT_CAN_SEND_NOW:
+    if (pending && notifications_enabled) {
+      att_server_notify(con_handle, MEASUREMENT_VALUE_HANDLE, pending_value,
+                        pending_len);
+      pending = false;
+      stats.deferred++;
+      record_latency(pending_rx_us);
+    }
+    break;
+
+  default:
+    break;
+  }
+}
+
+uint16_t PowerRelay::read_callback(hci_con_handle_t con_handle,
+                                   uint16_t att_handle, uint16_t offset,
+                                   uint8_t *buffer, uint16_t buffer_size) {
+  (void)con_handle;
+  if (att_handle == FEATURE_VALUE_HANDLE) {
+    return att_read_callback_handle_blob(CP_FEATURES, sizeof(CP_FEATURES),
+                                         offset, buffer, buffer_size);
+  }
+  if (att_handle == SENSOR_LOCATION_VALUE_HANDLE) {
+    return att_read_callback_handle_blob(&SENSOR_LOCATION_REAR_HUB, 1, offset,
+                                         buffer, buffer_size);
+  }
+  return 0;
+}
+
+int PowerRelay::write_callback(hci_con_handle_t con_handle,
+                               uint16_t att_handle, uint16_t transaction_mode,
+                               uint16_t offset, uint8_t *buffer,
+                               uint16_t buffer_size) {
+  (void)transaction_mode;
+  (void)offset;
+  if (att_handle != MEASUREMENT_CCC_HANDLE || buffer_size < 2)
+    return 0;
+
+  this->con_handle = con_handle;
+  notifications_enabled =
+      (little_endian_read_16(buffer, 0) &
+       GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION) != 0;
+  printf("[Relay] Notifications %s\n",
+         notifications_enabled ? "enabled" : "disabled");
+  return 0;
+}
+
+// Queue the trainer notification on the relay link right away so it goes out
+// in the next connection event of the Zwift link. If the controller has no
+// buffer free, keep only the newest value and send it on CAN_SEND_NOW.
+void PowerRelay::forward(const uint8_t *value, uint16_t len,
+                         uint64_t rx_time_us) {
+  if (!notifications_enabled || con_handle == HCI_CON_HANDLE_INVALID)
+    return;
+  if (len > sizeof(pending_value))
+    len = sizeof(pending_value);
+
+  if (!pending &&
+      att_server_notify(con_handle, MEASUREMENT_VALUE_HANDLE, value, len) ==
+          ERROR_CODE_SUCCESS) {
+    stats.immediate++;
+    record_latency(rx_time_us);
+    return;
+  }
+
+  if (pending) {
+    stats.superseded++;
+  } else {
+    att_server_request_can_send_now_event(con_handle);
+  }
+  memcpy(pending_value, value, len);
+  pending_len = len;
+  pending_rx_us = rx_time_us;
+  pending = true;
+}
+
+void PowerRelay::record_latency(uint64_t rx_time_us) {
+  uint32_t latency_us = (uint32_t)(time_us_64() - rx_time_us);
+  stats.forwarded++;
+  stats.total_latency_us += latency_us;
+  if (latency_us > stats.max_latency_us)
+    stats.max_latency_us = latency_us;
+  if (latency_us > BLE_RELAY_LATENCY_TARGET_US)
+    stats.over_target++;
+}
+
+void PowerRelay::print_stats() {
+  if (!notifications_enabled)
+    return;
+  LOG_TELEMETRY(
+      "[Relay] Forwarded %lu (immediate %lu, deferred %lu, superseded %lu)\n",
+      stats.forwarded, stats.immediate, stats.deferred, stats.superseded);
+  LOG_TELEMETRY(
+      "[Relay] Added latency avg %lu us, max %lu us, over target %lu\n",
+      (uint32_t)(stats.forwarded ? stats.total_latency_us / stats.forwarded
+                                 : 0),
+      stats.max_latency_us, stats.over_target);
+}
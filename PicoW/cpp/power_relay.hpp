@@ -0,0 +1,54 @@
+#pragma once
+
+#include "btstack.h"
+#include "config.h"
+#include "pico/stdlib.h"
+
+// Forwarding statistics. Added latency is measured from the trainer
+// notification arriving at BLEClient to it being queued on the relay link.
+struct RelayStats {
+  uint32_t forwarded;
+  uint32_t immediate; // Queued in the same run loop pass as reception
+  uint32_t deferred;  // Had to wait for ATT_EVENT_CAN_SEND_NOW
+  uint32_t superseded; // Deferred value replaced by a newer one
+  uint32_t over_target; // Added latency above BLE_RELAY_LATENCY_TARGET_US
+  uint32_t max_latency_us;
+  uint64_t total_latency_us;
+};
+
+// GATT server re-exposing the trainer's Cycling Power service so Zwift can
+// connect to the Pico while it drives the lights.
+class PowerRelay {
+public:
+  PowerRelay();
+  void init();
+  void forward(const uint8_t *value, uint16_t len, uint64_t rx_time_us);
+  bool is_subscribed() const { return notifications_enabled; }
+  const RelayStats &get_stats() const { return stats; }
+  void print_stats();
+
+  // Internal use (public so C-style callbacks can reach them)
+  void packet_handler(uint8_t packet_type, uint16_t channel, uint8_t *packet,
+                      uint16_t size);
+  uint16_t read_callback(hci_con_handle_t con_handle, uint16_t att_handle,
+                         uint16_t offset, uint8_t *buffer,
+                         uint16_t buffer_size);
+  int write_callback(hci_con_handle_t con_handle, uint16_t att_handle,
+                     uint16_t transaction_mode, uint16_t offset,
+                     uint8_t *buffer, uint16_t buffer_size);
+
+private:
+  void record_latency(uint64_t rx_time_us);
+
+  hci_con_handle_t con_handle;
+  bool notifications_enabled;
+
+  // Latest value waiting for a send opportunity
+  uint8_t pending_value[32];
+  uint16_t pending_len;
+  uint64_t pending_rx_us;
+  bool pending;
+
+  RelayStats stats;
+  btstack_packet_callback_registration_t hci_event_callback_registration;
+};
@@ -0,0 +1,58 @@
+#include "scan_cache.hpp"
+#include "config.h"
+#include <cstring>
+
+ScanCache::ScanCache() { clear(); }
+
+void ScanCache::clear() { memset(entries, 0, sizeof(entries)); }
+
+// FNV-1a over the 6 address bytes
+uint32_t ScanCache::hash(const bd_addr_t addr) {
+  uint32_t h = 2166136261u;
+  for (int i = 0; i < 6; i++) {
+    h ^= addr[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+ScanCache::Result ScanCache::update(const bd_addr_t addr, int8_t rssi,
+                                    uint32_t now_ms) {
+  // Linear probe within a bounded window. Entries are never removed, only
+  // replaced in place, so probe chains stay intact without tombstones.
+  size_t start = hash(addr) & (CAPACITY - 1);
+  Entry *victim = nullptr;
+
+  for (size_t i = 0; i < MAX_PROBE; i++) {
+    Entry &e = entries[(start + i) & (CAPACITY - 1)];
+    if (!e.used) {
+      victim = &e;
+      break;
+    }
+    if (memcmp(e.addr, addr, sizeof(bd_addr_t)) == 0) {
+      e.rssi = rssi;
+      uint32_t since_seen = now_ms - e.last_seen_ms;
+      e.last_seen_ms = now_ms;
+
+      int delta = (int)rssi - (int)e.reported_rssi;
+      if (delta < 0)
+        delta = -delta;
+      if (delta >= SCAN_RSSI_REPORT_DELTA ||
+          since_seen >= SCAN_REAPPEAR_MS) {
+        e.reported_rssi = rssi;
+        return Result::CHANGED;
+      }
+      return Result::SEEN;
+    }
+    // Least recently seen entry in the window is evicted if no slot is free
+    if (!victim || (now_ms - e.last_seen_ms) > (now_ms - victim->last_seen_ms))
+      victim = &e;
+  }
+
+  memcpy(victim->addr, addr, sizeof(bd_addr_t));
+  victim->rssi = rssi;
+  victim->reported_rssi = rssi;
+  victim->used = true;
+  victim->last_seen_ms = now_ms;
+  return Result::NEW;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "btstack.h"
+#include <cstddef>
+#include <cstdint>
+
+// Fixed-capacity hash set of advertisers seen while scanning. Used to only
+// surface an advertiser on first sighting or when its RSSI moves noticeably,
+// so a room full of BLE devices does not flood the UI.
+class ScanCache {
+public:
+  enum class Result { NEW, CHANGED, SEEN };
+
+  ScanCache();
+  void clear();
+  Result update(const bd_addr_t addr, int8_t rssi, uint32_t now_ms);
+
+private:
+  static constexpr size_t CAPACITY = 32; // Must be a power of two
+  static constexpr size_t MAX_PROBE = 8; // Bounded lookup / eviction window
+
+  struct Entry {
+    bd_addr_t addr;
+    int8_t rssi;          // Most recent RSSI
+    int8_t reported_rssi; // RSSI when last reported to the caller
+    bool used;
+    uint32_t last_seen_ms;
+  };
+
+  static uint32_t hash(const bd_addr_t addr);
+
+  Entry entries[CAPACITY];
+};
@@ -0,0 +1,87 @@
+#include "smoother.hpp"
+
+Smoother::Smoother() : mode(SMOOTHING_MODE) { reset(); }
+
+void Smoother::reset() {
+  head = 0;
+  count = 0;
+  sum = 0;
+  ema_x256 = 0;
+  have_ema = false;
+  last_ms = 0;
+  recent_next = 0;
+  recent_count = 0;
+}
+
+uint16_t Smoother::add(uint16_t power, uint32_t now_ms) {
+  // Window: drop what fell out of it, then append
+  while (count > 0 &&
+         (count == CAPACITY ||
+          now_ms - window[head].ms >= SMOOTHING_WINDOW_MS)) {
+    sum -= window[head].power;
+    head = (head + 1) % CAPACITY;
+    count--;
+  }
+  window[(head + count) % CAPACITY] = {now_ms, power};
+  count++;
+  sum += power;
+
+  // EMA: alpha = dt / (tau + dt), so the same time constant at any rate
+  uint32_t target = (uint32_t)power << 8;
+  if (!have_ema) {
+    ema_x256 = target;
+    have_ema = true;
+  } else {
+    uint32_t dt = now_ms - last_ms;
+    if (dt > SMOOTHING_WINDOW_MS)
+      dt = SMOOTHING_WINDOW_MS; // After a gap, mostly the new sample
+    int64_t diff = (int64_t)target - ema_x256;
+    ema_x256 += (int32_t)(diff * dt / (SMOOTHING_EMA_TAU_MS + dt));
+  }
+  last_ms = now_ms;
+
+  recent[recent_next] = power;
+  recent_next = (recent_next + 1) % SMOOTHING_MEDIAN_N;
+  if (recent_count < SMOOTHING_MEDIAN_N)
+    recent_count++;
+
+  return value();
+}
+
+uint16_t Smoother::value() const {
+  switch (mode) {
+  case SmoothingMode::EMA:
+    return (uint16_t)((ema_x256 + 128) >> 8);
+
+  case SmoothingMode::MEDIAN: {
+    if (recent_count == 0)
+      return 0;
+    // Insertion sort of a handful of values
+    uint16_t sorted[SMOOTHING_MEDIAN_N];
+    for (size_t i = 0; i < recent_count; i++) {
+      size_t j = i;
+      for (; j > 0 && sorted[j - 1] > recent[i]; j--)
+        sorted[j] = sorted[j - 1];
+      sorted[j] = recent[i];
+    }
+    return sorted[recent_count / 2];
+  }
+
+  case SmoothingMode::WINDOW:
+  default:
+    return count ? (uint16_t)(sum / count) : 0;
+  }
+}
+
+const char *Smoother::mode_name(SmoothingMode mode) {
+  switch (mode) {
+  case SmoothingMode::WINDOW:
+    return "window";
+  case SmoothingMode::EMA:
+    return "EMA";
+  case SmoothingMode::MEDIAN:
+    return "median";
+  default:
+    return "?";
+  }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "config.h"
+#include <cstddef>
+#include <cstdint>
+
+// Power smoothing over time rather than over a number of notifications, so
+// the result does not depend on how often the trainer reports. All filters
+// run on every sample (O(1) each, fixed storage) so switching between them
+// takes effect at once without a warm-up.
+//
+//  - WINDOW: mean of the samples within the last SMOOTHING_WINDOW_MS (Zwift
+//    shows a 3 s average), kept as a ring buffer with a running sum
+//  - EMA: exponential moving average with time constant SMOOTHING_EMA_TAU_MS,
+//    weighted by the time since the previous sample
+//  - MEDIAN: median of the last SMOOTHING_MEDIAN_N samples, rejects spikes
+class Smoother {
+public:
+  // Enough for SMOOTHING_WINDOW_MS at 20 Hz. If samples come faster the
+  // window is shortened to the newest CAPACITY samples.
+  static constexpr size_t CAPACITY = 64;
+
+  Smoother();
+  void reset();
+  // Adds a sample and returns the smoothed power of the selected filter
+  uint16_t add(uint16_t power, uint32_t now_ms);
+  uint16_t value() const;
+
+  void set_mode(SmoothingMode mode) { this->mode = mode; }
+  SmoothingMode get_mode() const { return mode; }
+  static const char *mode_name(SmoothingMode mode);
+
+private:
+  struct Sample {
+    uint32_t ms;
+    uint16_t power;
+  };
+
+  SmoothingMode mode;
+
+  Sample window[CAPACITY];
+  size_t head; // Oldest
+  size_t count;
+  uint32_t sum;
+
+  uint32_t ema_x256; // Fixed point, 8 fractional bits
+  bool have_ema;
+  uint32_t last_ms;
+
+  uint16_t recent[SMOOTHING_MEDIAN_N]; // For the median, oldest overwritten
+  size_t recent_next;
+  size_t recent_count;
+};
@@ -0,0 +1,71 @@
+#include "token_bucket.hpp"
+#include <cstring>
+
+void TokenBucket::init(const Config &config) {
+  this->config = config;
+  rate_mrps = config.initial_mrps;
+  tokens = 1000; // First request goes out immediately
+  last_refill_ms = 0;
+  rtt_ms = 0;
+  memset(&stats, 0, sizeof(stats));
+}
+
+void TokenBucket::refill(uint32_t now_ms) {
+  uint32_t elapsed = now_ms - last_refill_ms;
+  last_refill_ms = now_ms;
+  uint32_t cap = config.burst * 1000u;
+  uint64_t added = (uint64_t)elapsed * rate_mrps / 1000;
+  tokens = (tokens + added > cap) ? cap : (uint32_t)(tokens + added);
+}
+
+bool TokenBucket::try_acquire(uint32_t now_ms) {
+  refill(now_ms);
+  if (tokens < 1000)
+    return false;
+  tokens -= 1000;
+  stats.granted++;
+  return true;
+}
+
+// Gives back a token whose request was never sent
+void TokenBucket::release() {
+  uint32_t cap = config.burst * 1000u;
+  tokens = (tokens + 1000 > cap) ? cap : tokens + 1000;
+  stats.granted--;
+}
+
+uint32_t TokenBucket::ms_until_available(uint32_t now_ms) {
+  refill(now_ms);
+  if (tokens >= 1000)
+    return 0;
+  uint32_t deficit = 1000 - tokens;
+  return (deficit * 1000 + rate_mrps - 1) / rate_mrps;
+}
+
+void TokenBucket::decrease(uint32_t num, uint32_t den) {
+  uint32_t rate = rate_mrps * num / den;
+  rate_mrps = rate < config.min_mrps ? config.min_mrps : rate;
+  stats.decreases++;
+}
+
+void TokenBucket::on_success(uint32_t rtt) {
+  stats.successes++;
+  rtt_ms = rtt_ms ? (rtt_ms * 7 + rtt) / 8 : rtt;
+
+  if (rtt_ms > 2 * config.rtt_target_ms) {
+    decrease(7, 8); // Bridge is queueing: ease off
+  } else if (rtt_ms < config.rtt_target_ms) {
+    rate_mrps += config.step_mrps;
+    if (rate_mrps > config.max_mrps)
+      rate_mrps = config.max_mrps;
+  }
+}
+
+void TokenBucket::on_error(bool busy) {
+  stats.errors++;
+  if (!busy)
+    return;
+  stats.busy++;
+  decrease(1, 2);
+  tokens = 0; // And wait a full interval at the new rate
+}
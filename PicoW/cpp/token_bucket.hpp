@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+
+// Token bucket whose refill rate adapts to how the far end copes (AIMD):
+// fast, successful requests raise the rate step by step, busy responses
+// halve it, and a round-trip time well above the target eases it down.
+// Other failures are counted but leave the rate alone. Rates are in
+// requests per 1000 s (milli-rps).
+class TokenBucket {
+public:
+  struct Config {
+    uint32_t initial_mrps;
+    uint32_t min_mrps;
+    uint32_t max_mrps;
+    uint32_t step_mrps; // Additive increase per fast success
+    uint8_t burst;      // Tokens that can accumulate while idle
+    uint32_t rtt_target_ms;
+  };
+
+  struct Stats {
+    uint32_t granted;
+    uint32_t successes;
+    uint32_t errors; // Including busy
+    uint32_t busy;
+    uint32_t decreases;
+  };
+
+  void init(const Config &config);
+  bool try_acquire(uint32_t now_ms);
+  void release();
+  uint32_t ms_until_available(uint32_t now_ms);
+  void on_success(uint32_t rtt_ms);
+  // busy: the far end is overloaded (e.g. 429/503), rather than the
+  // request being rejected or the connection lost
+  void on_error(bool busy);
+
+  uint32_t get_rate_mrps() const { return rate_mrps; }
+  uint32_t get_rtt_ms() const { return rtt_ms; }
+  const Stats &get_stats() const { return stats; }
+
+private:
+  void refill(uint32_t now_ms);
+  void decrease(uint32_t num, uint32_t den);
+
+  Config config;
+  uint32_t rate_mrps;
+  uint32_t tokens; // In 1/1000 of a request
+  uint32_t last_refill_ms;
+  uint32_t rtt_ms; // Smoothed round-trip time
+  Stats stats;
+};
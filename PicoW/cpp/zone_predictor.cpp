@@ -0,0 +1,140 @@
+#include "zone_predictor.hpp"
+#include "color_math.hpp"
+#include "config.h"
+#include "log.hpp"
+#include <cstring>
+
+void ZonePredictor::reset() {
+  memset(samples, 0, sizeof(samples));
+  count = 0;
+  next = 0;
+  actual_zone = 0;
+  predicting = false;
+  predicted_zone = 0;
+  predicted_ms = 0;
+  memset(&stats, 0, sizeof(stats));
+}
+
+size_t ZonePredictor::zone_of(uint16_t power, uint16_t ftp) {
+  uint32_t percent = ftp_percent(power, ftp);
+  for (size_t i = 0; i < POWER_ZONES.size(); i++) {
+    if (percent < POWER_ZONES[i].max_percent)
+      return i;
+  }
+  return POWER_ZONES.size() - 1;
+}
+
+bool ZonePredictor::fit(int32_t &slope_wps, uint32_t &r2_pct) const {
+  slope_wps = 0;
+  r2_pct = 0;
+  if (count < WINDOW)
+    return false;
+
+  // Times relative to the newest sample keep the sums small
+  const Sample &newest = samples[(next + WINDOW - 1) % WINDOW];
+  int64_t st = 0, sp = 0, stt = 0, stp = 0, spp = 0;
+  for (size_t i = 0; i < WINDOW; i++) {
+    int64_t t = (int32_t)(samples[i].ms - newest.ms);
+    int64_t p = samples[i].power;
+    if (-t > (int64_t)ZONE_PREDICT_MAX_SPAN_MS)
+      return false; // Stale after a gap in the data
+    st += t;
+    sp += p;
+    stt += t * t;
+    stp += t * p;
+    spp += p * p;
+  }
+  const int64_t n = WINDOW;
+  int64_t sxx = n * stt - st * st;
+  int64_t sxy = n * stp - st * sp;
+  int64_t syy = n * spp - sp * sp;
+  if (sxx <= 0)
+    return false;
+
+  slope_wps = (int32_t)(sxy * 1000 / sxx);
+  // sxy^2 / sxx <= syy, so the intermediate stays in range
+  if (syy > 0)
+    r2_pct = (uint32_t)((uint64_t)(sxy * sxy / sxx) * 100 / (uint64_t)syy);
+  return true;
+}
+
+void ZonePredictor::resolve(bool hit, uint32_t now_ms) {
+  predicting = false;
+  if (hit) {
+    stats.hits++;
+    stats.lead_total_ms += now_ms - predicted_ms;
+  } else {
+    stats.false_positives++;
+  }
+}
+
+size_t ZonePredictor::update(uint16_t power, uint16_t ftp, uint32_t now_ms) {
+  size_t zone = zone_of(power, ftp);
+  bool crossed = count > 0 && zone != actual_zone;
+  samples[next] = {now_ms, power};
+  next = (next + 1) % WINDOW;
+  if (count < WINDOW)
+    count++;
+
+  if (predicting) {
+    if (zone == predicted_zone) {
+      resolve(true, now_ms);
+    } else if (crossed) {
+      resolve(false, now_ms); // Went the other way
+      stats.unpredicted++;
+    } else if (now_ms - predicted_ms >
+               ZONE_PREDICT_LEAD_MS * ZONE_PREDICT_HOLD_FACTOR) {
+      resolve(false, now_ms);
+    }
+  } else if (crossed) {
+    stats.unpredicted++;
+  }
+  actual_zone = zone;
+
+  int32_t slope_wps;
+  uint32_t r2_pct;
+  if (ZONE_PREDICT_LEAD_MS == 0 || !fit(slope_wps, r2_pct))
+    return predicting ? predicted_zone : zone;
+  bool confident = r2_pct >= ZONE_PREDICT_MIN_R2_PCT &&
+                   (slope_wps >= ZONE_PREDICT_MIN_SLOPE_WPS ||
+                    slope_wps <= -ZONE_PREDICT_MIN_SLOPE_WPS);
+
+  if (predicting) {
+    // A steady trend the other way cancels the prediction
+    bool rising = predicted_zone > zone;
+    if (confident && (slope_wps > 0) != rising)
+      resolve(false, now_ms);
+  } else if (confident) {
+    int64_t projected =
+        power + (int64_t)slope_wps * ZONE_PREDICT_LEAD_MS / 1000;
+    if (projected < 0)
+      projected = 0;
+    if (projected > 0xffff)
+      projected = 0xffff;
+    size_t target = zone_of((uint16_t)projected, ftp);
+    // Only ever the adjacent zone, even if the trend reaches further
+    if (target != zone && (target > zone) == (slope_wps > 0)) {
+      predicting = true;
+      predicted_zone = target > zone ? zone + 1 : zone - 1;
+      predicted_ms = now_ms;
+      stats.predictions++;
+      LOG_DEBUG("[Predict] Zone %d -> %d (%ld W/s, R2 %lu%%)\n",
+                (int)zone + 1, (int)predicted_zone + 1, slope_wps, r2_pct);
+    }
+  }
+  return predicting ? predicted_zone : zone;
+}
+
+uint32_t ZonePredictor::false_positive_pct() const {
+  return stats.predictions ? stats.false_positives * 100 / stats.predictions
+                           : 0;
+}
+
+void ZonePredictor::print_stats() const {
+  LOG_TELEMETRY("[Predict] Predictions %lu, hits %lu, false %lu (%lu%%)\n",
+                stats.predictions, stats.hits, stats.false_positives,
+                false_positive_pct());
+  LOG_TELEMETRY("[Predict] Avg lead %lu ms, unpredicted crossings %lu\n",
+                stats.hits ? stats.lead_total_ms / stats.hits : 0,
+                stats.unpredicted);
+}
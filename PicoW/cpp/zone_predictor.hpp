@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Anticipates power zone crossings so slow outputs (Hue lights take several
+// hundred ms to a second to react) change with the effort rather than after
+// it.
+//
+// A least-squares line is fitted through the last few smoothed power samples.
+// When the fit is good and steep enough and the power it projects
+// ZONE_PREDICT_LEAD_MS ahead lies in the next zone, that zone is returned
+// early. A prediction is held until the power actually gets there (a hit) or
+// until it expires without doing so (a false positive).
+class ZonePredictor {
+public:
+  static constexpr size_t WINDOW = 6; // Samples in the fit
+
+  struct Stats {
+    uint32_t predictions;
+    uint32_t hits;
+    uint32_t false_positives;
+    uint32_t unpredicted; // Crossings no prediction announced
+    uint32_t lead_total_ms; // Sum over hits of how early the change was
+  };
+
+  void reset(); // All-zero is also a valid initial state
+  // Feeds one smoothed sample. Returns the zone the slow outputs should show.
+  size_t update(uint16_t power, uint16_t ftp, uint32_t now_ms);
+  void print_stats() const;
+
+  // Index into POWER_ZONES
+  static size_t zone_of(uint16_t power, uint16_t ftp);
+  // False positives per 100 predictions
+  uint32_t false_positive_pct() const;
+  const Stats &get_stats() const { return stats; }
+
+private:
+  struct Sample {
+    uint32_t ms;
+    uint16_t power;
+  };
+
+  // Slope in W/s and goodness of fit (R^2 in %). False without enough samples.
+  bool fit(int32_t &slope_wps, uint32_t &r2_pct) const;
+  void resolve(bool hit, uint32_t now_ms);
+
+  Sample samples[WINDOW];
+  size_t count;
+  size_t next;
+
+  size_t actual_zone;
+  bool predicting;
+  size_t predicted_zone;
+  uint32_t predicted_ms; // When the prediction was made
+  Stats stats;
+};